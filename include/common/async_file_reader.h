@@ -0,0 +1,83 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+
+namespace dip {
+struct AsyncReadOptions {
+    // Reads in flight at once; read() blocks beyond that.
+    int depth = 16;
+    // Fallback engine: threads doing blocking reads.
+    int threads = 4;
+    // Use io_uring where the build and kernel support it (Linux 5.6+), else the thread pool.
+    bool io_uring = true;
+    // Released buffers kept for reuse, so steady-state reads allocate nothing.
+    size_t pool_buffers = 64;
+};
+
+// One whole-file read, filled in by the reader. `buf` and `ok` are valid once wait() returns.
+class PendingRead {
+public:
+    std::string buf;
+    bool ok = false;
+    std::chrono::steady_clock::time_point submitted, completed;
+    // Blocks until the read completes; returns the time spent blocked.
+    std::chrono::steady_clock::duration wait();
+    bool ready() const { std::lock_guard<std::mutex> lk(mtx_); return done_; }
+    void complete(bool success);
+private:
+    mutable std::mutex mtx_;
+    std::condition_variable cv_;
+    bool done_ = false;
+};
+
+// Totals since start. read_ns runs from read() to completion, i.e. what a synchronous read would
+// have cost the caller; wait_ns is the part consumers actually blocked for in wait_for(), so
+// read_ns - wait_ns was hidden behind other work.
+struct AsyncReadStats { uint64_t reads = 0, failed = 0, bytes = 0, read_ns = 0, wait_ns = 0; };
+
+// Prefetches whole files into pooled buffers: read() returns at once and the bytes arrive in the
+// background, through one io_uring (open, statx and read submitted from the caller's thread and
+// reaped by a completion thread) or, without it, a pool of threads doing ordinary reads.
+class AsyncFileReader {
+public:
+    explicit AsyncFileReader(const AsyncReadOptions& opts = AsyncReadOptions());
+    ~AsyncFileReader();
+    AsyncFileReader(const AsyncFileReader&) = delete;
+    AsyncFileReader& operator=(const AsyncFileReader&) = delete;
+    std::shared_ptr<PendingRead> read(const std::string& path);
+    // Waits for `r` and counts the blocked time as exposed read latency.
+    void wait_for(PendingRead& r);
+    // An empty buffer from the pool, e.g. to receive a message into.
+    std::string buffer();
+    // Returns a buffer (read or otherwise) to the pool.
+    void recycle(std::string&& buf);
+    // "io_uring" or "threads".
+    const char* engine() const;
+    AsyncReadStats stats() const;
+private:
+    struct Ring;
+    struct Request { std::string path; std::shared_ptr<PendingRead> out; };
+    AsyncReadOptions opts_;
+    std::unique_ptr<Ring> ring_;
+    std::vector<std::thread> threads_;
+    std::deque<Request> queue_;
+    std::mutex mtx_, pool_mtx_;
+    std::condition_variable cv_, slot_cv_;
+    int in_flight_ = 0;
+    bool closing_ = false;
+    std::vector<std::string> pool_;
+    std::atomic<uint64_t> reads_{0}, failed_{0}, bytes_{0}, read_ns_{0}, wait_ns_{0};
+    void finish(const std::shared_ptr<PendingRead>& r, bool ok);
+    void thread_loop();
+    void ring_loop();
+};
+}
@@ -0,0 +1,49 @@
+#pragma once
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <cstddef>
+
+namespace dip {
+// FIFO that blocks producers while `capacity` items are queued, so a slow stage pushes back on the
+// one before it instead of buffering without limit.
+template <typename T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(size_t capacity) : capacity_(capacity < 1 ? 1 : capacity) {}
+    // Returns false (and drops the item) once closed.
+    bool push(T item) {
+        std::unique_lock<std::mutex> lk(mtx_);
+        not_full_.wait(lk, [&]{ return q_.size() < capacity_ || closed_; });
+        if (closed_) return false;
+        q_.push_back(std::move(item));
+        lk.unlock();
+        not_empty_.notify_one();
+        return true;
+    }
+    // Returns false once closed and drained.
+    bool pop(T& out) {
+        std::unique_lock<std::mutex> lk(mtx_);
+        not_empty_.wait(lk, [&]{ return !q_.empty() || closed_; });
+        if (q_.empty()) return false;
+        out = std::move(q_.front());
+        q_.pop_front();
+        lk.unlock();
+        not_full_.notify_one();
+        return true;
+    }
+    void close() {
+        { std::lock_guard<std::mutex> lk(mtx_); closed_ = true; }
+        not_empty_.notify_all();
+        not_full_.notify_all();
+    }
+    size_t size() const { std::lock_guard<std::mutex> lk(mtx_); return q_.size(); }
+    size_t capacity() const { return capacity_; }
+private:
+    size_t capacity_;
+    bool closed_ = false;
+    std::deque<T> q_;
+    mutable std::mutex mtx_;
+    std::condition_variable not_empty_, not_full_;
+};
+}
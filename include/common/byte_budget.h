@@ -0,0 +1,52 @@
+#pragma once
+#include <mutex>
+#include <condition_variable>
+#include <utility>
+#include <cstddef>
+
+namespace dip {
+// Caps the bytes of image data held between ingestion and decode. acquire() blocks while the
+// budget is spent, which backs up the producer instead of growing memory with the dataset. A
+// request larger than the whole budget is still admitted once nothing else is outstanding.
+class ByteBudget {
+public:
+    // Returns its bytes to the budget when destroyed or reset.
+    class Lease {
+    public:
+        Lease() = default;
+        Lease(ByteBudget* b, size_t n) : budget_(b), bytes_(n) {}
+        ~Lease() { reset(); }
+        Lease(Lease&& o) noexcept : budget_(std::exchange(o.budget_, nullptr)), bytes_(std::exchange(o.bytes_, 0)) {}
+        Lease& operator=(Lease&& o) noexcept {
+            if (this != &o) { reset(); budget_ = std::exchange(o.budget_, nullptr); bytes_ = std::exchange(o.bytes_, 0); }
+            return *this;
+        }
+        void reset() { if (budget_) budget_->release(bytes_); budget_ = nullptr; bytes_ = 0; }
+    private:
+        ByteBudget* budget_ = nullptr;
+        size_t bytes_ = 0;
+    };
+
+    explicit ByteBudget(size_t limit) : limit_(limit) {}
+    Lease acquire(size_t n) {
+        std::unique_lock<std::mutex> lk(mtx_);
+        cv_.wait(lk, [&]{ return used_ == 0 || used_ + n <= limit_; });
+        used_ += n;
+        if (used_ > peak_) peak_ = used_;
+        return Lease(this, n);
+    }
+    size_t used() const { std::lock_guard<std::mutex> lk(mtx_); return used_; }
+    size_t peak() const { std::lock_guard<std::mutex> lk(mtx_); return peak_; }
+    size_t limit() const { return limit_; }
+private:
+    void release(size_t n) {
+        { std::lock_guard<std::mutex> lk(mtx_); used_ -= n; }
+        cv_.notify_all();
+    }
+    size_t limit_;
+    size_t used_ = 0;
+    size_t peak_ = 0;
+    mutable std::mutex mtx_;
+    std::condition_variable cv_;
+};
+}
@@ -0,0 +1,18 @@
+#pragma once
+#include <string>
+#include <unordered_map>
+
+namespace dip {
+// Flat reader for config.json: top-level scalar keys only, arrays/objects are kept as raw text.
+class Config {
+public:
+    bool load(const std::string& path);
+    bool has(const std::string& key) const;
+    std::string get_string(const std::string& key, const std::string& def) const;
+    long long get_int(const std::string& key, long long def) const;
+    double get_double(const std::string& key, double def) const;
+    bool get_bool(const std::string& key, bool def) const;
+private:
+    std::unordered_map<std::string, std::string> values_;
+};
+}
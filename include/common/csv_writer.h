@@ -1,5 +1,6 @@
 #pragma once
 #include <string>
+#include <string_view>
 #include <vector>
 #include <fstream>
 
@@ -10,9 +11,14 @@ public:
     bool good() const;
     void write_header(const std::vector<std::string>& cols);
     void write_row(const std::vector<std::string>& cols);
+    // label,path,v0..v{dim-1} with fixed 6-digit floats, zero-padded or truncated to `dim`. Formats
+    // with std::to_chars into a reused line buffer, so steady-state rows do not allocate.
+    void write_embedding_row(std::string_view label, std::string_view path, const float* v, size_t n, size_t dim);
+    void flush();
 private:
     std::ofstream out_;
+    std::string line_;
     static std::string escape(const std::string& s);
+    static void append_escaped(std::string& out, std::string_view s);
 };
 }
-
@@ -0,0 +1,49 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <fstream>
+#include <mutex>
+#include <cstdint>
+#include <cstddef>
+#include "common/mapped_file.h"
+
+namespace dip {
+// Identifies image content independently of its path.
+struct ContentKey {
+    uint64_t hash = 0;
+    uint64_t size = 0;
+    bool operator==(const ContentKey& o) const { return hash == o.hash && size == o.size; }
+};
+struct ContentKeyHash { size_t operator()(const ContentKey& k) const { return static_cast<size_t>(k.hash ^ (k.size * 0x9E3779B97F4A7C15ULL)); } };
+ContentKey content_key(const unsigned char* data, size_t size);
+
+// Fingerprint of a model file's content, or 0 if it cannot be read.
+uint64_t file_fingerprint(const std::string& path);
+
+// Persistent embedding cache keyed by image content, valid for one model fingerprint. The file is
+// a fixed header plus append-only fixed-size records in host byte order; existing records are
+// served from a read-only mapping and new ones are appended, so lookups need no lock and memory
+// stays at an index entry per image. A cache written for another model or dimension is discarded.
+class EmbeddingCache {
+public:
+    bool open(const std::string& path, uint64_t model_fingerprint, size_t dim);
+    bool is_open() const { return out_.is_open(); }
+    // Only sees entries present when the cache was opened.
+    bool lookup(const ContentKey& key, std::vector<float>& out) const;
+    void insert(const ContentKey& key, const float* v, size_t n);
+    void flush();
+    size_t loaded() const { return index_.size(); }
+    size_t inserted() const { std::lock_guard<std::mutex> lk(mtx_); return inserted_; }
+private:
+    static const size_t kHeaderSize = 24;
+    size_t dim_ = 0;
+    MappedFile map_;
+    std::unordered_map<ContentKey, size_t, ContentKeyHash> index_;
+    mutable std::mutex mtx_;
+    std::ofstream out_;
+    size_t inserted_ = 0;
+    std::vector<float> pad_;
+    size_t record_size() const { return 16 + dim_ * sizeof(float); }
+};
+}
@@ -0,0 +1,70 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+namespace dip {
+// Compact embedding encodings, shared by the result frames and the .npy writer. Bytes per
+// embedding of dimension d: F32 4d, F16 2d, I8 d + 4 (a float scale), PQ m (one code per subspace).
+enum class EmbeddingEncoding { F32, F16, I8, PQ };
+const char* embedding_encoding_name(EmbeddingEncoding e);
+bool parse_embedding_encoding(std::string_view name, EmbeddingEncoding& out);
+
+// Per-vector symmetric INT8: q[i] = round(v[i] / scale) with scale = max|v| / 127. Returns the scale
+// (0 for an all-zero vector, whose codes are all 0).
+float encode_i8(const float* v, size_t n, int8_t* q);
+void decode_i8(const int8_t* q, size_t n, float scale, float* out);
+
+// Product quantizer: the dimensions are split into m contiguous subspaces of dim/m, and each
+// subvector is replaced by the index of the nearest of 256 centroids trained for its subspace by
+// k-means. An embedding becomes m bytes. Saved as "DIPPQ1\0\0", u32 dim, u32 m, u32 centroids, then
+// the float32 centroids subspace by subspace; all little-endian.
+class ProductQuantizer {
+public:
+    static constexpr size_t kCentroids = 256;
+    // `data` is `rows` row-major vectors of `dim`; dim must be a multiple of m. Rows beyond
+    // max_rows are subsampled evenly. False if there are fewer rows than centroids.
+    bool train(const float* data, size_t rows, size_t dim, size_t m, int iterations = 25, size_t max_rows = 65536);
+    bool load(const std::string& path);
+    bool save(const std::string& path) const;
+    bool empty() const { return centroids_.empty(); }
+    size_t dim() const { return dim_; }
+    size_t m() const { return m_; }
+    // Identifies the codebook, so a master only asks for PQ codes from workers using the same one.
+    uint64_t fingerprint() const { return fingerprint_; }
+    // `v` and `out` have dim() floats, `codes` m() bytes.
+    void encode(const float* v, uint8_t* codes) const;
+    void decode(const uint8_t* codes, float* out) const;
+private:
+    size_t dim_ = 0, m_ = 0, sub_ = 0;
+    std::vector<float> centroids_;  // m * kCentroids * sub
+    uint64_t fingerprint_ = 0;
+    size_t nearest(size_t s, const float* x) const;
+    void finish();
+};
+
+// Embeddings with their labels and paths, read back from embeddings.csv (label column) or from an .npy written
+// by NpyEmbeddingWriter and the index CSV next to it. Compact .npy files are decoded to float32;
+// PQ needs the codebook.
+struct LabeledEmbeddings {
+    size_t dim = 0;
+    std::vector<float> data;
+    std::vector<std::string> labels, paths;
+    size_t rows() const { return labels.size(); }
+};
+bool load_labeled_embeddings(const std::string& path, const ProductQuantizer* pq, LabeledEmbeddings& out);
+
+// What an encoding costs in retrieval quality, against exact float32 search over the same rows.
+struct EncodingReport {
+    EmbeddingEncoding encoding = EmbeddingEncoding::F32;
+    size_t bytes_per_embedding = 0;
+    double cos_mean = 0;       // cosine between each embedding and its decoded copy
+    double recall_at_10 = 0;   // share of the float32 top 10 neighbours found in the encoded top 10
+    double label_nn = 0;       // share of queries whose nearest other row has the same label
+};
+// Round-trips every row through `e` and runs `queries` evenly strided rows as queries by brute-force
+// inner product (the model's embeddings are L2-normalized). `pq` is required for PQ.
+EncodingReport evaluate_encoding(const LabeledEmbeddings& set, EmbeddingEncoding e, const ProductQuantizer* pq, size_t queries);
+}
@@ -0,0 +1,8 @@
+#pragma once
+#include <cstdint>
+
+namespace dip {
+// IEEE 754 binary16 conversion, round-to-nearest-even; NaN/Inf preserved.
+uint16_t float_to_half(float f);
+float half_to_float(uint16_t h);
+}
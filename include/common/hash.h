@@ -0,0 +1,9 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+
+namespace dip {
+// XXH64 (matches the reference implementation on little-endian hosts). Fast enough to hash every
+// image on ingest; used for content-addressed caching and exact dedup.
+uint64_t hash64(const void* data, size_t size, uint64_t seed = 0);
+}
@@ -0,0 +1,25 @@
+#pragma once
+#include <string>
+#include <cstddef>
+
+namespace dip {
+// Read-only memory map of a whole file. Pages are faulted in by whoever touches the bytes, so the
+// read happens lazily at decode time and the memory is page cache the kernel can reclaim, not heap.
+class MappedFile {
+public:
+    MappedFile() = default;
+    ~MappedFile();
+    MappedFile(MappedFile&& o) noexcept;
+    MappedFile& operator=(MappedFile&& o) noexcept;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    // An empty file opens successfully with size() == 0.
+    bool open(const std::string& path);
+    void close();
+    const unsigned char* data() const { return data_; }
+    size_t size() const { return size_; }
+private:
+    const unsigned char* data_ = nullptr;
+    size_t size_ = 0;
+};
+}
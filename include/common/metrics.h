@@ -0,0 +1,93 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <functional>
+#include <cstdint>
+#include <cstddef>
+
+namespace dip {
+// Pipeline stages with a latency histogram each. Recording is a few relaxed atomic adds, so the
+// hot paths stay instrumented in every build.
+enum class Stage {
+    FileRead,           // open/read an image file (master ingest, worker path tasks, ship-bytes sends)
+    FileReadWait,       // worker: decode thread blocked on a prefetched read (the part of file_read not hidden)
+    Decode,             // JPEG/PNG decode
+    Preprocess,         // resize + colour convert into the model tensor
+    SessionRun,         // ONNX Runtime Session::Run, per batch
+    Serialize,          // worker: encode a result message
+    Deserialize,        // master: parse a result message
+    NetSend,            // one framed send call
+    NetRecv,            // first byte to complete frame on a worker connection
+    DecodeQueueWait,    // pipeline: pushed -> taken by a decode thread
+    InferQueueWait,     // pipeline: decoded -> taken into an inference batch
+    DispatchQueueWait,  // master: enqueued -> sent to a worker
+    CsvWrite,           // one embeddings.csv row
+    Count
+};
+const char* stage_name(Stage s);
+
+enum class Counter { BytesSent, BytesReceived, Count };
+const char* counter_name(Counter c);
+
+// Fixed log2 buckets: bucket i counts samples below 2^i microseconds (i = 0 is < 1 us), up to
+// about 67 s; the last bucket takes everything longer.
+class LatencyHistogram {
+public:
+    static const int kBuckets = 28;
+    struct Snapshot {
+        uint64_t counts[kBuckets] = {};
+        uint64_t count = 0;
+        uint64_t sum_ns = 0;
+        // Interpolated within the bucket holding the q-th sample, in seconds.
+        double quantile(double q) const;
+    };
+    void record_ns(uint64_t ns) {
+        uint64_t us = ns / 1000;
+        int b = 0;
+        while (us && b < kBuckets - 1) { us >>= 1; ++b; }
+        counts_[b].fetch_add(1, std::memory_order_relaxed);
+        sum_ns_.fetch_add(ns, std::memory_order_relaxed);
+    }
+    void record(std::chrono::steady_clock::duration d) { record_ns(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(d).count())); }
+    Snapshot snapshot() const;
+    // Upper bound of bucket i in seconds (infinity for the last).
+    static double bucket_le(int i);
+private:
+    std::atomic<uint64_t> counts_[kBuckets] = {};
+    std::atomic<uint64_t> sum_ns_{0};
+};
+
+LatencyHistogram& stage_histogram(Stage s);
+inline void record_stage(Stage s, std::chrono::steady_clock::duration d) { stage_histogram(s).record(d); }
+void add_counter(Counter c, uint64_t n);
+
+// Records the scope's duration into a stage histogram.
+class StageTimer {
+public:
+    explicit StageTimer(Stage s) : stage_(s), start_(std::chrono::steady_clock::now()) {}
+    ~StageTimer() { record_stage(stage_, std::chrono::steady_clock::now() - start_); }
+    StageTimer(const StageTimer&) = delete;
+    StageTimer& operator=(const StageTimer&) = delete;
+private:
+    Stage stage_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+// Extra gauges/counters gathered at scrape time, e.g. per-worker state from NetMaster.
+// `labels` is preformatted Prometheus label text without braces, such as worker="gpu-0".
+struct MetricSample { std::string name; std::string labels; double value = 0; };
+using MetricsCollector = std::function<void(std::vector<MetricSample>&)>;
+// Returns an id for remove_metrics_collector; collectors must be removed before what they read dies.
+int add_metrics_collector(MetricsCollector c);
+void remove_metrics_collector(int id);
+
+// Prometheus text exposition format (dip_stage_seconds histograms, dip_*_total counters, collector samples).
+std::string metrics_prometheus();
+// One JSON object: per stage count, mean and p50/p90/p99 in milliseconds, counters, collector samples.
+std::string metrics_json();
+// Writes metrics_json() to `path` through a temporary file and a rename, so readers never see a
+// partial snapshot.
+bool write_metrics_snapshot(const std::string& path);
+}
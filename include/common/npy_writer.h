@@ -0,0 +1,46 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <fstream>
+#include <memory>
+#include <cstddef>
+#include <vector>
+#include "common/csv_writer.h"
+#include "common/embedding_codec.h"
+
+namespace dip {
+// Embeddings as a row-major float32 .npy of shape (rows, dim), loadable without parsing with
+// np.load(path, mmap_mode="r"), plus an index CSV of row,label,path. The header has a fixed size
+// and the row count in it is rewritten every kSyncRows rows and on close, so a run that never
+// exits cleanly still leaves a readable prefix. An empty index_path writes no index.
+// Compact encodings change the array: f16 is '<f2' (rows, dim); i8 is a structured array of
+// (scale '<f4', q '|i1' (dim,)) records of shape (rows,), decoded as rec['q'] * rec['scale'][:, None];
+// pq is '|u1' (rows, m) codes for the codebook `pq` (which must outlive the writer and have `dim`).
+class NpyEmbeddingWriter {
+public:
+    NpyEmbeddingWriter(const std::string& npy_path, const std::string& index_path, size_t dim, EmbeddingEncoding encoding = EmbeddingEncoding::F32, const ProductQuantizer* pq = nullptr);
+    ~NpyEmbeddingWriter();
+    bool good() const;
+    // Zero-padded or truncated to dim.
+    void append(std::string_view label, std::string_view path, const float* v, size_t n);
+    void close();
+    size_t rows() const { return rows_; }
+    size_t row_bytes() const;
+private:
+    static const size_t kHeaderSize = 128;
+    static const size_t kSyncRows = 1024;
+    std::ofstream out_;
+    std::unique_ptr<CsvWriter> index_;
+    size_t dim_;
+    EmbeddingEncoding encoding_;
+    const ProductQuantizer* pq_;
+    size_t rows_ = 0;
+    std::vector<float> row_;
+    std::string buf_;
+    void write_header();
+};
+
+// Reads an .npy written by NpyEmbeddingWriter in any encoding back as row-major float32; PQ codes
+// are decoded with `pq`, which must be the codebook they were written with.
+bool read_npy_embeddings(const std::string& path, const ProductQuantizer* pq, std::vector<float>& out, size_t& rows, size_t& dim);
+}
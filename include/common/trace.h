@@ -0,0 +1,42 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <mutex>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+
+namespace dip {
+// Trace timestamps are steady-clock microseconds. Each machine has its own epoch, so spans from a
+// worker are shifted onto the master's clock before they are written.
+inline int64_t trace_us(std::chrono::steady_clock::time_point t) { return std::chrono::duration_cast<std::chrono::microseconds>(t.time_since_epoch()).count(); }
+inline int64_t trace_now_us() { return trace_us(std::chrono::steady_clock::now()); }
+
+struct TraceSpan { std::string name; int64_t start_us = 0; int64_t dur_us = 0; };
+
+// Collects spans and writes them as Chrome trace-event JSON (chrome://tracing, ui.perfetto.dev).
+// Every machine is a process and every traced task a row in it, so one task lines up across the
+// master and the worker that ran it. Thread-safe.
+class TraceWriter {
+public:
+    // Spans past this many are dropped (and counted) so a long run cannot grow without bound.
+    explicit TraceWriter(size_t max_spans = 1000000) : max_spans_(max_spans) {}
+    // Returns the pid for a new process row group.
+    int add_process(const std::string& name);
+    void name_row(int pid, uint64_t row, const std::string& name);
+    void span(int pid, uint64_t row, const std::string& name, int64_t start_us, int64_t dur_us);
+    size_t spans() const;
+    size_t dropped() const;
+    // Timestamps are rebased to the earliest span.
+    bool write(const std::string& path) const;
+private:
+    struct Row { int pid; uint64_t row; std::string name; };
+    struct Event { int pid; uint64_t row; std::string name; int64_t start_us, dur_us; };
+    size_t max_spans_;
+    mutable std::mutex mtx_;
+    std::vector<std::string> processes_;
+    std::vector<Row> rows_;
+    std::vector<Event> events_;
+    size_t dropped_ = 0;
+};
+}
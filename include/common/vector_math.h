@@ -0,0 +1,12 @@
+#pragma once
+#include <cstddef>
+
+namespace dip {
+// Kernels for similarity search over embeddings. AVX2+FMA when the build enables it (USE_AVX2),
+// SSE2 on other x86-64 builds, scalar elsewhere; results differ from each other only by rounding.
+float dot_product(const float* a, const float* b, size_t n);
+// out[i] = dot_product(q, rows + i * dim, dim) for `count` contiguous rows.
+void dot_products(const float* q, const float* rows, size_t count, size_t dim, float* out);
+// Scales v to unit length; an all-zero vector is left as is.
+void l2_normalize(float* v, size_t n);
+}
@@ -0,0 +1,142 @@
+#pragma once
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+
+namespace dip {
+// Bounded lock-free MPMC ring (Vyukov). T must be default-constructible and move-assignable.
+template <typename T>
+class MpmcRing {
+public:
+    explicit MpmcRing(size_t capacity) {
+        size_t n = 2;
+        while (n < capacity) n <<= 1;
+        mask_ = n - 1;
+        cells_.reset(new Cell[n]);
+        for (size_t i=0; i<n; ++i) cells_[i].seq.store(i, std::memory_order_relaxed);
+    }
+    bool try_push(T& item) {
+        size_t pos = head_.load(std::memory_order_relaxed);
+        Cell* c;
+        while (true) {
+            c = &cells_[pos & mask_];
+            size_t seq = c->seq.load(std::memory_order_acquire);
+            intptr_t dif = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+            if (dif == 0) { if (head_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break; }
+            else if (dif < 0) return false;
+            else pos = head_.load(std::memory_order_relaxed);
+        }
+        c->value = std::move(item);
+        c->seq.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+    bool try_pop(T& out) {
+        size_t pos = tail_.load(std::memory_order_relaxed);
+        Cell* c;
+        while (true) {
+            c = &cells_[pos & mask_];
+            size_t seq = c->seq.load(std::memory_order_acquire);
+            intptr_t dif = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+            if (dif == 0) { if (tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break; }
+            else if (dif < 0) return false;
+            else pos = tail_.load(std::memory_order_relaxed);
+        }
+        out = std::move(c->value);
+        c->seq.store(pos + mask_ + 1, std::memory_order_release);
+        return true;
+    }
+    // Approximate under concurrent use.
+    size_t size() const {
+        size_t h = head_.load(std::memory_order_relaxed), t = tail_.load(std::memory_order_relaxed);
+        return h > t ? h - t : 0;
+    }
+private:
+    struct Cell { std::atomic<size_t> seq{0}; T value{}; };
+    std::unique_ptr<Cell[]> cells_;
+    size_t mask_ = 0;
+    alignas(64) std::atomic<size_t> head_{0};
+    alignas(64) std::atomic<size_t> tail_{0};
+};
+
+// Work-stealing queue for a fixed set of consumers: push() deals items round-robin onto one ring
+// per worker, pop(w) takes from worker w's ring and steals from the others once it runs dry.
+// The fast paths are lock-free; the mutex is only taken to sleep on a full or empty queue, so
+// workers do not convoy on a shared lock. Blocking semantics match BoundedQueue.
+template <typename T>
+class WorkStealingQueue {
+public:
+    WorkStealingQueue(size_t workers, size_t capacity) {
+        if (workers < 1) workers = 1;
+        size_t per = (capacity + workers - 1) / workers;
+        for (size_t i=0; i<workers; ++i) rings_.emplace_back(new MpmcRing<T>(per < 2 ? 2 : per));
+    }
+    // Blocks while every ring is full; false (item dropped) once closed.
+    bool push(T item) {
+        if (closed_.load(std::memory_order_acquire)) return false;
+        if (!try_push_any(item)) {
+            std::unique_lock<std::mutex> lk(mtx_);
+            push_waiters_.fetch_add(1);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            while (!try_push_any(item)) {
+                if (closed_.load()) { push_waiters_.fetch_sub(1); return false; }
+                not_full_.wait(lk);
+            }
+            push_waiters_.fetch_sub(1);
+        }
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (pop_waiters_.load() > 0) { std::lock_guard<std::mutex> lk(mtx_); not_empty_.notify_one(); }
+        return true;
+    }
+    // Returns false once closed and drained.
+    bool pop(size_t worker, T& out) {
+        if (!try_pop_any(worker, out)) {
+            std::unique_lock<std::mutex> lk(mtx_);
+            pop_waiters_.fetch_add(1);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            while (!try_pop_any(worker, out)) {
+                if (closed_.load()) { pop_waiters_.fetch_sub(1); return false; }
+                not_empty_.wait(lk);
+            }
+            pop_waiters_.fetch_sub(1);
+        }
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (push_waiters_.load() > 0) { std::lock_guard<std::mutex> lk(mtx_); not_full_.notify_all(); }
+        return true;
+    }
+    void close() {
+        { std::lock_guard<std::mutex> lk(mtx_); closed_.store(true); }
+        not_empty_.notify_all();
+        not_full_.notify_all();
+    }
+    size_t size() const { size_t n = 0; for (auto& r : rings_) n += r->size(); return n; }
+    size_t steals() const { return steals_.load(std::memory_order_relaxed); }
+private:
+    bool try_push_any(T& item) {
+        size_t n = rings_.size();
+        size_t start = next_.fetch_add(1, std::memory_order_relaxed);
+        for (size_t i=0; i<n; ++i) if (rings_[(start + i) % n]->try_push(item)) return true;
+        return false;
+    }
+    bool try_pop_any(size_t worker, T& out) {
+        size_t n = rings_.size();
+        worker %= n;
+        if (rings_[worker]->try_pop(out)) return true;
+        for (size_t i=1; i<n; ++i) {
+            if (rings_[(worker + i) % n]->try_pop(out)) { steals_.fetch_add(1, std::memory_order_relaxed); return true; }
+        }
+        return false;
+    }
+    std::vector<std::unique_ptr<MpmcRing<T>>> rings_;
+    std::atomic<size_t> next_{0};
+    std::atomic<size_t> steals_{0};
+    std::atomic<bool> closed_{false};
+    std::atomic<int> push_waiters_{0};
+    std::atomic<int> pop_waiters_{0};
+    std::mutex mtx_;
+    std::condition_variable not_full_, not_empty_;
+};
+}
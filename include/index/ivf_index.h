@@ -0,0 +1,84 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <vector>
+#include <fstream>
+#include <random>
+#include <cstdint>
+#include <cstddef>
+#include "common/mapped_file.h"
+
+namespace dip {
+// Inverted-file (IVF-Flat) index over L2-normalized embeddings, searched by inner product (cosine).
+// Vectors are grouped into `lists` clusters by spherical k-means; a query scans only the `nprobe`
+// lists whose centroids are most similar to it. The file is memory-mapped as is, little-endian,
+// every section 64-byte aligned:
+//   header (128 B): "DIPIVF1\0", u32 dim, u32 lists, u64 rows, then u64 offsets of the sections
+//   centroids  f32 [lists][dim]
+//   list_start u64 [lists + 1]    positions of each list's vectors
+//   vectors    f32 [rows][dim]    in list order
+//   row_ids    u64 [rows]         the writer's row number of each position
+//   str_start  u64 [rows + 1]     into the string blob; position p is "label\0path"
+//   strings    blob
+struct IvfBuildOptions {
+    // 0 picks about sqrt(rows): a query then scores as many centroids as one list has vectors.
+    size_t lists = 0;
+    // k-means runs on a uniform reservoir sample of this many rows.
+    size_t train_rows = 65536;
+    int iterations = 10;
+};
+
+// Streams rows to two spill files next to `path` as they are added (only a training sample and a
+// string offset per row stay in memory), then clusters, sorts by list and writes the index in
+// finish(). k-means and list assignment run on all hardware threads.
+class IvfIndexBuilder {
+public:
+    IvfIndexBuilder(const std::string& path, size_t dim, const IvfBuildOptions& opts = IvfBuildOptions());
+    ~IvfIndexBuilder();
+    bool good() const { return vec_.good() && str_.good(); }
+    // Zero-padded or truncated to dim, then normalized.
+    void add(std::string_view label, std::string_view path, const float* v, size_t n);
+    size_t rows() const { return rows_; }
+    // Writes the index and removes the spill files; false if nothing was added or a write failed.
+    bool finish();
+private:
+    std::string path_;
+    size_t dim_;
+    IvfBuildOptions opts_;
+    std::ofstream vec_, str_;
+    size_t rows_ = 0;
+    std::vector<uint64_t> str_start_{0};
+    std::vector<float> sample_, row_;
+    std::mt19937_64 rng_{42};
+    bool finished_ = false;
+};
+
+class IvfIndex {
+public:
+    struct Hit { float score; uint64_t pos; };
+    bool open(const std::string& path);
+    size_t dim() const { return dim_; }
+    size_t lists() const { return lists_; }
+    size_t rows() const { return rows_; }
+    // Top k by inner product with `q` (dim() floats, normalized), best first, from the nprobe most
+    // similar lists.
+    void search(const float* q, size_t k, size_t nprobe, std::vector<Hit>& out) const;
+    // Scans every vector: the recall baseline.
+    void search_exact(const float* q, size_t k, std::vector<Hit>& out) const;
+    const float* vector(uint64_t pos) const { return vectors_ + pos * dim_; }
+    uint64_t row(uint64_t pos) const { return row_ids_[pos]; }
+    std::string_view label(uint64_t pos) const;
+    std::string_view path(uint64_t pos) const;
+private:
+    MappedFile file_;
+    size_t dim_ = 0, lists_ = 0, rows_ = 0;
+    const float* centroids_ = nullptr;
+    const uint64_t* list_start_ = nullptr;
+    const float* vectors_ = nullptr;
+    const uint64_t* row_ids_ = nullptr;
+    const uint64_t* str_start_ = nullptr;
+    const char* strings_ = nullptr;
+    size_t strings_size_ = 0;
+    void scan(const float* q, uint64_t begin, uint64_t end, size_t k, std::vector<Hit>& heap) const;
+};
+}
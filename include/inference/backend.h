@@ -5,6 +5,12 @@
 
 namespace dip {
 struct FaceBox { int x; int y; int w; int h; float confidence; };
+// Encoded image bytes owned by the caller, e.g. a slice of a received task frame. `rgb8` marks an
+// image the master already decoded and resized (see decode_to_rgb8), so decoding is skipped.
+struct ImageView { const unsigned char* data = nullptr; size_t size = 0; bool rgb8 = false; };
+// One preprocessed kModelSide x kModelSide x 3 float tensor (see inference/preprocess.h);
+// width/height are the original image size.
+struct TensorView { const float* data = nullptr; int width = 0; int height = 0; };
 struct InferenceResult {
     std::vector<FaceBox> faces;
     std::vector<float> embedding;
@@ -16,5 +22,17 @@ public:
     virtual ~IInferenceBackend() = default;
     virtual bool init(const std::string& model_path) = 0;
     virtual std::optional<InferenceResult> infer(const std::vector<unsigned char>& image_bytes) = 0;
+    // One result slot per input, in order; an empty slot means that image failed to decode or run.
+    virtual std::vector<std::optional<InferenceResult>> infer_batch(const std::vector<ImageView>& images) {
+        std::vector<std::optional<InferenceResult>> out;
+        out.reserve(images.size());
+        for (auto& img : images) out.push_back(infer(std::vector<unsigned char>(img.data, img.data + img.size)));
+        return out;
+    }
+    // Same as infer_batch for tensors already decoded by a preprocessing stage. Backends that only
+    // take encoded images leave every slot empty.
+    virtual std::vector<std::optional<InferenceResult>> infer_tensors(const std::vector<TensorView>& tensors) {
+        return std::vector<std::optional<InferenceResult>>(tensors.size());
+    }
 };
 }
\ No newline at end of file
@@ -0,0 +1,81 @@
+#pragma once
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <algorithm>
+#include <cstddef>
+
+namespace dip {
+struct BatchPolicy {
+    size_t min_batch = 1;
+    size_t max_batch = 1;
+    std::chrono::microseconds max_wait{2000};
+};
+
+// Collects items into batches for IInferenceBackend::infer_batch. A consumer waits until `target`
+// items are queued or max_wait has elapsed since it saw the first one, then takes up to max_batch.
+// The target starts at min_batch, doubles while batches fill before the deadline and halves back
+// toward min_batch when they don't, so light load keeps latency low and heavy load fills batches.
+// With a non-zero capacity (at least twice max_batch), push blocks while that many items are queued.
+template <typename T>
+class DynamicBatcher {
+public:
+    explicit DynamicBatcher(BatchPolicy policy, size_t capacity = 0) : policy_(policy), capacity_(capacity) {
+        if (policy_.min_batch < 1) policy_.min_batch = 1;
+        if (policy_.max_batch < policy_.min_batch) policy_.max_batch = policy_.min_batch;
+        target_ = policy_.min_batch;
+        // A bound below max_batch would keep the queue from ever holding a full batch, so every
+        // batch past it would wait out max_wait; room for two keeps the next one filling.
+        if (capacity_ && capacity_ < 2 * policy_.max_batch) capacity_ = 2 * policy_.max_batch;
+    }
+    void push(T item) {
+        {
+            std::unique_lock<std::mutex> lk(mtx_);
+            if (capacity_) space_cv_.wait(lk, [&]{ return q_.size() < capacity_ || closed_; });
+            q_.push_back(std::move(item));
+        }
+        cv_.notify_one();
+    }
+    void close() {
+        { std::lock_guard<std::mutex> lk(mtx_); closed_ = true; }
+        cv_.notify_all();
+        space_cv_.notify_all();
+    }
+    size_t size() const { std::lock_guard<std::mutex> lk(mtx_); return q_.size(); }
+    const BatchPolicy& policy() const { return policy_; }
+    // Returns false once closed and drained.
+    bool next(std::vector<T>& batch) {
+        batch.clear();
+        std::unique_lock<std::mutex> lk(mtx_);
+        while (true) {
+            cv_.wait(lk, [&]{ return !q_.empty() || closed_; });
+            if (q_.empty()) return false;
+            auto deadline = std::chrono::steady_clock::now() + policy_.max_wait;
+            bool filled = cv_.wait_until(lk, deadline, [&]{ return q_.size() >= target_ || closed_; });
+            if (q_.empty()) continue;
+            if (filled && q_.size() >= target_) target_ = std::min(target_ * 2, policy_.max_batch);
+            else if (!filled) target_ = std::max(policy_.min_batch, target_ / 2);
+            size_t n = std::min(q_.size(), policy_.max_batch);
+            batch.reserve(n);
+            for (size_t i = 0; i < n; ++i) { batch.push_back(std::move(q_.front())); q_.pop_front(); }
+            break;
+        }
+        bool more = !q_.empty();
+        lk.unlock();
+        if (more) cv_.notify_one();
+        if (capacity_) space_cv_.notify_all();
+        return true;
+    }
+private:
+    BatchPolicy policy_;
+    size_t capacity_ = 0;
+    size_t target_ = 1;
+    bool closed_ = false;
+    std::deque<T> q_;
+    mutable std::mutex mtx_;
+    std::condition_variable cv_;
+    std::condition_variable space_cv_;
+};
+}
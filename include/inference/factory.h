@@ -1,9 +1,24 @@
 #pragma once
 #include <memory>
+#include <cstddef>
+#include <cstdint>
 #include "inference/backend.h"
 
 namespace dip {
 #if defined(DIP_HAS_ONNX)
 std::unique_ptr<IInferenceBackend> make_onnx_backend();
 #endif
+
+// Stand-in for a model in scale tests: no ONNX Runtime, GPU or model file needed.
+struct SyntheticBackendOptions {
+    size_t dim = 512;
+    int latency_us = 0;    // per call (one batch), slept like a device wait
+    int per_image_us = 0;  // added per image in the call, also slept
+    int jitter_us = 0;     // uniform +-jitter on each call's total
+    int decode_us = 0;     // per encoded image, busy CPU like a JPEG decode; not charged for tensors
+    uint64_t seed = 1;     // jitter only; embeddings do not depend on it
+};
+// Embeddings are unit vectors derived from a hash of the input bytes (or tensor), so the same
+// image always gets the same embedding and different images almost surely differ.
+std::unique_ptr<IInferenceBackend> make_synthetic_backend(const SyntheticBackendOptions& opts = SyntheticBackendOptions());
 }
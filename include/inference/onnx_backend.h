@@ -6,14 +6,36 @@
 #include "inference/backend.h"
 
 namespace dip {
+// Model files exported by `onnx converter/convert_to_onnx.py` next to the FP32 model:
+// <name>.fp16.onnx has float16 weights (for CUDA) and <name>.int8.onnx dynamically quantized INT8
+// weights (for CPU nodes). Both keep float32 inputs and outputs, so tensors and embeddings are
+// unchanged for the caller.
+enum class ModelPrecision { FP32, FP16, INT8 };
+const char* model_precision_name(ModelPrecision p);
+bool parse_model_precision(const std::string& name, ModelPrecision& out);
+// models/x.onnx -> models/x.int8.onnx; FP32 returns the path unchanged.
+std::string model_variant_path(const std::string& fp32_path, ModelPrecision p);
+
+// Thread settings are per session; 0 keeps the ONNX Runtime default. Backends with equal model,
+// provider and settings share `sessions` loaded instances round-robin, so N worker threads no
+// longer load N copies of the model.
+struct OnnxSessionOptions {
+    int intra_op_threads = 0;
+    int inter_op_threads = 0;
+    int sessions = 1;
+    // init() loads model_variant_path(model_path, precision) and fails if that file is missing.
+    ModelPrecision precision = ModelPrecision::FP32;
+};
 #if defined(DIP_HAS_ONNX)
 enum class ProviderPref { CPU, CUDA };
 class OnnxRuntimeBackend : public IInferenceBackend {
 public:
-    explicit OnnxRuntimeBackend(ProviderPref pref);
+    explicit OnnxRuntimeBackend(ProviderPref pref, const OnnxSessionOptions& opts = OnnxSessionOptions());
     ~OnnxRuntimeBackend() override;
     bool init(const std::string& model_path) override;
     std::optional<InferenceResult> infer(const std::vector<unsigned char>& image_bytes) override;
+    std::vector<std::optional<InferenceResult>> infer_batch(const std::vector<ImageView>& images) override;
+    std::vector<std::optional<InferenceResult>> infer_tensors(const std::vector<TensorView>& tensors) override;
 private:
     struct Impl;
     std::unique_ptr<Impl> impl;
@@ -0,0 +1,175 @@
+#pragma once
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <optional>
+#include <functional>
+#include <chrono>
+#include <type_traits>
+#include <utility>
+#include <cstddef>
+#include "common/work_stealing_queue.h"
+#include "common/metrics.h"
+#include "inference/backend.h"
+#include "inference/batcher.h"
+#include "inference/preprocess.h"
+
+namespace dip {
+struct PipelineOptions {
+    int decode_threads = 2;
+    size_t decode_queue = 64;   // encoded images waiting for a decode thread
+    size_t infer_queue = 32;    // preprocessed tensors waiting for an inference thread; at least 2 x batch.max_batch
+    BatchPolicy batch;
+};
+
+// Snapshot of how much work sits in front of and inside each stage; whichever queue stays full
+// is in front of the bottleneck.
+struct PipelineDepths {
+    size_t decode_queue = 0;
+    size_t decoding = 0;
+    size_t infer_queue = 0;
+    size_t inferring = 0;
+};
+
+namespace detail {
+template <typename M, typename = void> struct has_on_stage : std::false_type {};
+template <typename M> struct has_on_stage<M, std::void_t<decltype(std::declval<M&>().on_stage(Stage::Decode, std::chrono::steady_clock::time_point(), std::chrono::steady_clock::time_point()))>> : std::true_type {};
+}
+
+// Decode + preprocess pool feeding inference threads through bounded queues:
+//   push (caller's I/O) -> decode_queue -> decode threads -> infer_queue (batched) -> inference -> on_result
+// Inference threads only see float tensors, so JPEG decode no longer serializes with the model and
+// the two pools can be sized independently. The decode queue is a WorkStealingQueue, so decode
+// threads do not contend on one lock. `Meta` must be default-constructible and provide
+// `ImageView image() const` and `void release_image()`, which is called right after decoding to
+// drop the encoded bytes. on_result gets a whole inference batch at once (one item for an image
+// that fails to decode, on the decode thread) so results can be handed off in bulk. A Meta with
+// `void on_stage(Stage, time_point begin, time_point end)` is also told when it waited and ran in
+// each stage (DecodeQueueWait, Decode for decode + preprocess, InferQueueWait, SessionRun for its
+// batch), e.g. for per-task tracing.
+template <typename Meta>
+class InferencePipeline {
+public:
+    using OnResult = std::function<void(std::vector<Meta>&, std::vector<std::optional<InferenceResult>>&)>;
+    using MakeBackend = std::function<std::unique_ptr<IInferenceBackend>()>;
+
+    InferencePipeline(PipelineOptions opts, OnResult on_result)
+        : opts_(opts), on_result_(std::move(on_result)), decode_q_(opts.decode_threads < 1 ? 1 : opts.decode_threads, opts.decode_queue), infer_q_(opts.batch, opts.infer_queue) {
+        int n = opts_.decode_threads < 1 ? 1 : opts_.decode_threads;
+        decoders_left_ = n;
+        for (int i=0; i<n; ++i) threads_.emplace_back([this, i]{ decode_loop(static_cast<size_t>(i)); });
+    }
+    ~InferencePipeline() { close(); join(); }
+    InferencePipeline(const InferencePipeline&) = delete;
+    InferencePipeline& operator=(const InferencePipeline&) = delete;
+
+    // Starts one inference thread; `make` runs on that thread so model loads overlap. A thread whose
+    // backend fails to load exits, and the last one standing fails the remaining work instead of
+    // leaving it queued forever.
+    void add_inference(MakeBackend make) {
+        ++inferers_left_;
+        threads_.emplace_back([this, make]{ infer_loop(make); });
+    }
+    // Blocks while the decode queue is full; false once closed.
+    bool push(Meta item) { return decode_q_.push(Pending{std::move(item), std::chrono::steady_clock::now()}); }
+    // No more input; queued work still drains.
+    void close() { decode_q_.close(); }
+    void join() { for (auto& t : threads_) if (t.joinable()) t.join(); }
+    PipelineDepths depths() const {
+        PipelineDepths d;
+        d.decode_queue = decode_q_.size();
+        d.decoding = decoding_.load();
+        d.infer_queue = infer_q_.size();
+        d.inferring = inferring_.load();
+        return d;
+    }
+
+private:
+    // Enqueue times feed the DecodeQueueWait / InferQueueWait histograms.
+    struct Pending { Meta meta; std::chrono::steady_clock::time_point queued; };
+    struct Decoded { Meta meta; std::vector<float> tensor; int width = 0; int height = 0; std::chrono::steady_clock::time_point queued; };
+
+    static void notify(Meta& m, Stage s, std::chrono::steady_clock::time_point begin, std::chrono::steady_clock::time_point end) {
+        if constexpr (detail::has_on_stage<Meta>::value) m.on_stage(s, begin, end);
+        else { (void)m; (void)s; (void)begin; (void)end; }
+    }
+
+    std::vector<float> acquire_tensor() {
+        std::lock_guard<std::mutex> lk(pool_mtx_);
+        if (pool_.empty()) return std::vector<float>(kTensorSize);
+        auto t = std::move(pool_.back());
+        pool_.pop_back();
+        return t;
+    }
+    void release_tensor(std::vector<float> t) { std::lock_guard<std::mutex> lk(pool_mtx_); pool_.push_back(std::move(t)); }
+
+    void decode_loop(size_t worker) {
+        Pending item;
+        std::vector<Meta> failed(1);
+        std::vector<std::optional<InferenceResult>> none(1);
+        while (decode_q_.pop(worker, item)) {
+            ++decoding_;
+            auto t0 = std::chrono::steady_clock::now();
+            record_stage(Stage::DecodeQueueWait, t0 - item.queued);
+            Decoded d{std::move(item.meta), acquire_tensor(), 0, 0, {}};
+            notify(d.meta, Stage::DecodeQueueWait, item.queued, t0);
+            ImageView img = d.meta.image();
+            bool ok = img.rgb8 ? rgb8_to_tensor(img.data, img.size, d.tensor.data()) : decode_to_tensor(img.data, img.size, d.tensor.data(), d.width, d.height);
+            // The original size stays on the master; the pre-resized image is all the worker has.
+            if (img.rgb8) d.width = d.height = kModelSide;
+            d.meta.release_image();
+            notify(d.meta, Stage::Decode, t0, std::chrono::steady_clock::now());
+            --decoding_;
+            if (ok) { d.queued = std::chrono::steady_clock::now(); infer_q_.push(std::move(d)); continue; }
+            release_tensor(std::move(d.tensor));
+            failed[0] = std::move(d.meta);
+            none[0].reset();
+            on_result_(failed, none);
+        }
+        if (--decoders_left_ == 0) infer_q_.close();
+    }
+
+    void infer_loop(const MakeBackend& make) {
+        std::unique_ptr<IInferenceBackend> backend = make();
+        if (!backend && --inferers_left_ > 0) return;
+        std::vector<Decoded> batch;
+        std::vector<TensorView> views;
+        std::vector<Meta> metas;
+        while (infer_q_.next(batch)) {
+            size_t n = batch.size();
+            inferring_ += n;
+            auto taken = std::chrono::steady_clock::now();
+            for (auto& d : batch) { record_stage(Stage::InferQueueWait, taken - d.queued); notify(d.meta, Stage::InferQueueWait, d.queued, taken); }
+            std::vector<std::optional<InferenceResult>> res(n);
+            if (backend) {
+                views.clear();
+                for (auto& d : batch) views.push_back(TensorView{d.tensor.data(), d.width, d.height});
+                res = backend->infer_tensors(views);
+                auto done = std::chrono::steady_clock::now();
+                for (auto& d : batch) notify(d.meta, Stage::SessionRun, taken, done);
+            }
+            metas.clear();
+            for (auto& d : batch) {
+                release_tensor(std::move(d.tensor));
+                metas.push_back(std::move(d.meta));
+            }
+            on_result_(metas, res);
+            inferring_ -= n;
+        }
+    }
+
+    PipelineOptions opts_;
+    OnResult on_result_;
+    WorkStealingQueue<Pending> decode_q_;
+    DynamicBatcher<Decoded> infer_q_;
+    std::mutex pool_mtx_;
+    std::vector<std::vector<float>> pool_;
+    std::atomic<size_t> decoding_{0};
+    std::atomic<size_t> inferring_{0};
+    std::atomic<int> decoders_left_{0};
+    std::atomic<int> inferers_left_{0};
+    std::vector<std::thread> threads_;
+};
+}
@@ -0,0 +1,27 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <optional>
+#include "inference/onnx_backend.h"
+
+namespace dip {
+struct PrecisionSample { std::string label; std::vector<unsigned char> bytes; };
+
+// How far a reduced-precision model's embeddings drift from the FP32 model on the same images.
+struct PrecisionReport {
+    size_t images = 0;
+    double fp32_images_per_s = 0, variant_images_per_s = 0;
+    // Cosine similarity between the two embeddings of each image.
+    double cos_mean = 0, cos_p01 = 0, cos_min = 0;
+    // Share of images whose nearest other sample is the same image under both models, and the
+    // share whose nearest other sample has the same label, per model.
+    double nn_agreement = 0, label_nn_fp32 = 0, label_nn_variant = 0;
+};
+
+#if defined(DIP_HAS_ONNX)
+// Decodes the samples once, then runs them through the FP32 model and its `variant` in batches of
+// `batch` with the same provider and session settings (after one warm-up batch each). Samples that
+// fail to decode are skipped; nullopt if either model cannot be loaded or nothing decodes.
+std::optional<PrecisionReport> check_precision(const std::string& fp32_model, ModelPrecision variant, ProviderPref provider, const OnnxSessionOptions& opts, const std::vector<PrecisionSample>& samples, size_t batch);
+#endif
+}
@@ -0,0 +1,46 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace dip {
+const int kModelSide = 224;
+const size_t kTensorSize = size_t(kModelSide) * kModelSide * 3;
+
+// Fused bilinear resize (cv::resize INTER_LINEAR pixel mapping) + BGR->RGB + uint8->float32 from
+// an interleaved BGR image into an NHWC float tensor of dst_w x dst_h x 3. Uses AVX2 or SSE2 when
+// the build enables them and a scalar path otherwise; scratch tables are cached per thread, so
+// steady-state calls do not allocate.
+void resize_bgr_to_rgb_f32(const uint8_t* src, int src_w, int src_h, size_t src_stride, float* dst, int dst_w, int dst_h);
+
+// The original three-pass path (cv::resize, cv::cvtColor, per-pixel copy), kept as the benchmark
+// baseline. Falls back to the fused kernel when built without OpenCV.
+void resize_bgr_to_rgb_f32_reference(const uint8_t* src, int src_w, int src_h, size_t src_stride, float* dst, int dst_w, int dst_h);
+
+// Reads width/height from a JPEG SOF or PNG IHDR header without decoding.
+bool image_dimensions(const unsigned char* data, size_t size, int& width, int& height);
+
+// Largest JPEG DCT scale-down (1, 2, 4 or 8) that still leaves both sides >= `target`; always 1
+// for non-JPEG input.
+int reduced_decode_factor(const unsigned char* data, size_t size, int target);
+
+// Decodes a JPEG/PNG (at the reduced JPEG scale above) and preprocesses it into one kTensorSize
+// tensor at `out`; width/height receive the original image size. The decode buffer is reused per
+// thread, so this is safe to call from a pool. Without OpenCV it writes zeros.
+bool decode_to_tensor(const unsigned char* data, size_t size, float* out, int& width, int& height);
+
+// Pre-resize for shipping: the same reduced decode and resize as decode_to_tensor, rounded to a
+// kModelSide x kModelSide RGB uint8 image (kTensorSize bytes at `out`), a fraction of a large
+// source file. False if it cannot be decoded or the build has no OpenCV.
+bool decode_to_rgb8(const unsigned char* data, size_t size, unsigned char* out);
+// JPEG of a decode_to_rgb8 image at `quality` (1-100). False without OpenCV.
+bool encode_rgb8_jpeg(const unsigned char* rgb, int quality, std::vector<unsigned char>& out);
+// Worker side of a pre-resized image: widens it to the float tensor, no decode or resize. False
+// unless `size` is kTensorSize.
+bool rgb8_to_tensor(const unsigned char* data, size_t size, float* out);
+
+// 64-bit difference hash of a 9x8 grayscale thumbnail taken from a reduced-scale decode.
+// Re-encoded or slightly resized copies of an image land within a few bits of each other.
+// Returns false if the image cannot be decoded or the build has no OpenCV.
+bool perceptual_hash(const unsigned char* data, size_t size, uint64_t& out);
+}
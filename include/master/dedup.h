@@ -0,0 +1,51 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <mutex>
+#include <cstdint>
+#include <cstddef>
+#include "common/embedding_cache.h"
+
+namespace dip {
+struct DedupOptions {
+    // Also match images whose perceptual hashes differ in at most max_distance bits (0..3).
+    bool near = false;
+    int max_distance = 3;
+    // Completed canonical embeddings kept for later duplicates; older ones are forgotten, and a
+    // duplicate arriving after that is simply inferred again. Bounds memory on huge datasets.
+    size_t window = 65536;
+};
+
+// Tracks the canonical image for each distinct content (exact: ContentKey; near: perceptual hash)
+// seen in this run, so duplicates reuse its embedding instead of being inferred. Thread-safe.
+class Deduper {
+public:
+    struct Item { std::string label; std::string path; };
+    enum class Verdict {
+        Unique,     // new canonical: infer it and report complete() or fail() with its key
+        Parked,     // duplicate of a canonical still in flight; returned by its complete()/fail()
+        Ready       // duplicate of a finished canonical; `emb` holds the embedding
+    };
+    explicit Deduper(DedupOptions opts);
+    Verdict check(const ContentKey& key, const uint64_t* phash, Item item, std::vector<float>& emb);
+    // Returns the duplicates parked on `key`.
+    std::vector<Item> complete(const ContentKey& key, const std::vector<float>& emb);
+    std::vector<Item> fail(const ContentKey& key);
+    size_t exact() const { std::lock_guard<std::mutex> lk(mtx_); return exact_; }
+    size_t near() const { std::lock_guard<std::mutex> lk(mtx_); return near_; }
+private:
+    struct Canon { bool done = false; bool has_phash = false; uint64_t phash = 0; std::vector<float> emb; std::vector<Item> waiters; };
+    DedupOptions opts_;
+    std::unordered_map<ContentKey, Canon, ContentKeyHash> canon_;
+    // Perceptual hashes split into four 16-bit bands: two hashes within 3 bits share at least one
+    // band exactly, so candidates are found by band lookup instead of a scan.
+    std::unordered_map<uint32_t, std::vector<ContentKey>> bands_;
+    std::deque<ContentKey> done_order_;
+    size_t exact_ = 0;
+    size_t near_ = 0;
+    mutable std::mutex mtx_;
+    void forget(const ContentKey& key);
+};
+}
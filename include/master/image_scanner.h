@@ -0,0 +1,72 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <cstdint>
+#include "common/bounded_queue.h"
+
+namespace dip {
+// One image found under the root; the label is the top-level directory name without "pin_".
+struct ScannedImage { std::string label; std::string path; uint64_t size = 0; };
+struct ScanOptions {
+    // Top-level (label) directories are walked in parallel, one per thread at a time.
+    int threads = 8;
+    // Found images wait here for the consumer; a full queue pauses the scan.
+    size_t queue = 4096;
+    // Manifest of every directory's mtime and its images' sizes and mtimes, read before the scan
+    // and rewritten after a complete one; empty disables it.
+    std::string manifest;
+};
+struct ScanStats {
+    size_t dirs = 0, dirs_reused = 0;    // reused: mtime unchanged, entries taken from the manifest
+    size_t images = 0, images_reused = 0;
+    double seconds = 0;
+    bool manifest_written = false;
+};
+bool is_image_name(std::string_view name);
+
+// Streams the images under `root` to next() as the scanner threads find them, so dispatch starts
+// with the first directory instead of after a full walk. With a manifest, a directory whose mtime
+// is unchanged is not listed again and its files are not stat'ed: adding, removing or renaming
+// entries changes a directory's mtime, but rewriting a file in place does not, so such edits are
+// only seen when the directory changes (image contents are still read fresh at processing time).
+class ImageScanner {
+public:
+    ImageScanner(const std::string& root, const ScanOptions& opts = ScanOptions());
+    ~ImageScanner();
+    ImageScanner(const ImageScanner&) = delete;
+    ImageScanner& operator=(const ImageScanner&) = delete;
+    void start();
+    // Blocks for the next image; false once the scan is finished (or stopped) and drained.
+    bool next(ScannedImage& out);
+    // Abandons the scan; the manifest is not rewritten.
+    void stop();
+    // Complete once next() has returned false.
+    ScanStats stats() const;
+private:
+    struct FileRec { std::string name; uint64_t size; int64_t mtime; };
+    struct DirRec { int64_t mtime = 0; std::string label; std::vector<FileRec> files; std::vector<std::string> subdirs; };
+    std::string root_;
+    ScanOptions opts_;
+    BoundedQueue<ScannedImage> queue_;
+    std::unordered_map<std::string, DirRec> old_, new_;  // by path relative to root, '/'-separated
+    std::vector<std::string> shards_;
+    std::atomic<size_t> next_shard_{0};
+    std::atomic<int> running_{0};
+    std::atomic<bool> stopped_{false};
+    std::vector<std::thread> threads_;
+    mutable std::mutex mtx_;
+    ScanStats stats_;
+    std::chrono::steady_clock::time_point t0_;
+    void load_manifest();
+    bool save_manifest() const;
+    void walk(const std::filesystem::path& dir, const std::string& rel, const std::string& label, ScanStats& local);
+    void worker();
+};
+}
@@ -1,28 +1,162 @@
 #pragma once
 #include <string>
+#include <string_view>
 #include <vector>
 #include <functional>
 #include <unordered_map>
-#include <queue>
+#include <deque>
 #include <mutex>
-#include <winsock2.h>
+#include <condition_variable>
+#include <memory>
+#include <chrono>
+#include <thread>
 #include "networking/tcp_server.h"
+#include "common/bounded_queue.h"
+#include "common/trace.h"
+#include "common/embedding_codec.h"
+#include "networking/protocol.h"
 
 namespace dip {
-struct NetJob { std::string label; std::string id; std::string base64; std::string path; };
+// `id` must be unique among jobs in flight: results, retries and speculative copies are matched by it.
+struct NetJob { std::string label; std::string id; std::string path; };
+struct NetMasterOptions {
+    int io_threads = 1;
+    // Upper bound on the credit window a worker may ask for in type=hello.
+    int max_credits = 64;
+    // Send image bytes in binary task frames to workers that list task_modes=data, instead of a
+    // path they must open on a shared filesystem.
+    bool ship_bytes = false;
+    // enqueue blocks while this many jobs wait for a worker, so scanning a huge directory cannot
+    // outrun dispatch; 0 means unbounded.
+    size_t max_queued_jobs = 0;
+    // Each worker is kept about this far ahead at its measured rate (within its advertised
+    // credits), so slow workers hold few tasks and fast ones get deeper batches.
+    int lookahead_ms = 500;
+    // Weight of the newest sample in the per-worker throughput and latency averages.
+    double ewma_alpha = 0.3;
+    // A task not answered within its lease is queued again for another worker; the late copy keeps
+    // running (and its slot) and the first result wins. The lease is this long, or four times the worker's average latency if
+    // that is longer. Tasks held by a worker that disconnects are queued again at once.
+    int lease_ms = 30000;
+    // A task is reported through on_failed once this many dispatches have all been lost (expired,
+    // disconnected, or answered type=failed by a worker that could not decode or infer it).
+    int max_attempts = 3;
+    // Once the queue is empty, workers with spare window run backup copies of stragglers: tasks
+    // out for more than twice the usual latency of both their holder and the idle worker.
+    bool speculate = true;
+    // With set_trace, one dispatch in this many (to workers that send trace=1 in hello) is traced
+    // end to end; 0 traces nothing.
+    int trace_every = 100;
+    // Result encoding asked of workers that offer it (f32 otherwise). BinPQ also needs `pq`, and is
+    // only picked for workers whose codebook fingerprint matches it; results arrive decoded.
+    ResultFormat result_format = ResultFormat::BinF32;
+    std::shared_ptr<const ProductQuantizer> pq;
+    // With ship_bytes, files at least this many times the size of the model's 224x224x3 uint8 input
+    // are decoded and resized on the master and sent as that image (RGB8 frames, to workers that
+    // list task_modes=rgb8), or as a JPEG of it with preresize_jpeg_quality (to any data worker).
+    // Smaller files, and workers that take neither, get the file as is. 0 disables.
+    double preresize_ratio = 0;
+    int preresize_jpeg_quality = 0;
+    // Threads doing the decode and resize, so the I/O threads never block on it.
+    int preresize_threads = 2;
+};
+struct NetTaskStats {
+    size_t requeued = 0;     // queued again after a disconnect or an expired lease
+    size_t expired = 0;      // leases that ran out
+    size_t speculative = 0;  // backup copies of stragglers
+    size_t duplicates = 0;   // results dropped because another copy answered first
+    size_t worker_failed = 0;  // copies a worker reported it could not decode or infer
+    size_t preresized = 0;   // tasks sent pre-resized instead of as the file
+    uint64_t preresize_file_bytes = 0, preresize_sent_bytes = 0;  // their files' sizes and what went out instead
+};
+// Per-worker scheduling state as seen by the master.
+struct NetWorkerStats {
+    std::string worker_id;
+    std::string provider;
+    size_t completed = 0;
+    double rate = 0.0;        // tasks/s, EWMA over busy time; 0 until the first sample
+    double latency_ms = 0.0;  // task sent -> result received, EWMA
+    int window = 0;           // tasks the master currently keeps in flight
+    int in_flight = 0;
+};
 class NetMaster {
 public:
     using OnResult = std::function<void(const std::string&, const std::string&, const std::vector<float>&)>;
-    NetMaster(const std::string& bind_addr, uint16_t port, OnResult on_result);
-    void enqueue(const NetJob& job);
+    using OnFailed = std::function<void(const NetJob&)>;
+    NetMaster(const std::string& bind_addr, uint16_t port, OnResult on_result, const NetMasterOptions& opts = NetMasterOptions());
+    ~NetMaster();
+    // Called for jobs the master could not dispatch, e.g. an unreadable file in ship_bytes mode.
+    void set_on_failed(OnFailed on_failed);
+    // Records sampled tasks into `trace`: queue wait and round trip on the master, and the worker's
+    // own spans shifted onto the master's clock. Call before run(); `trace` must outlive the master.
+    void set_trace(TraceWriter* trace);
+    // Blocks while max_queued_jobs are already waiting; returns false if the master was stopped.
+    bool enqueue(const NetJob& job);
+    size_t queued() const;
+    std::vector<NetWorkerStats> worker_stats() const;
+    NetTaskStats task_stats() const;
     void run();
+    void stop();
 private:
+    using Clock = std::chrono::steady_clock;
+    // A worker advertises up to `credits` tasks at once; the master keeps `window` (<= credits) in
+    // flight, sized from `rate`. `parked` means it is waiting in idle_ for jobs.
+    struct WorkerState {
+        std::string worker_id, provider;
+        int credits = 1; int window = 1; int in_flight = 0; bool parked = false; bool accepts_data = false, accepts_rgb8 = false;
+        double rate = 0.0, latency = 0.0;
+        size_t completed = 0;
+        int done_since_mark = 0;
+        Clock::time_point mark;
+        std::unordered_map<std::string, Clock::time_point> sent;
+        // Tracing: the worker's process in the trace, its clock minus ours from the round trip
+        // with the least unexplained delay so far, and traced tasks waiting for its spans.
+        bool traces = false; int trace_pid = 0;
+        int64_t clock_offset_us = 0, best_rtt_us = -1;
+        struct Traced { uint64_t row; int64_t sent_us, received_us; };
+        std::unordered_map<std::string, Traced> traced;
+    };
+    // Every enqueued task until its first result; `holders` are the workers running a copy.
+    struct TaskState { NetJob job; std::vector<ConnId> holders; int attempts = 0; bool queued = true; Clock::time_point lease; Clock::time_point queued_at; };
     OnResult on_result_;
-    TcpServer* server_ = nullptr;
-    std::unordered_map<SOCKET, int> workers_;
-    std::queue<NetJob> jobs_;
-    std::mutex mtx_;
-    void on_message(const std::string& msg, SOCKET sock);
-    void send_next(SOCKET sock);
+    OnFailed on_failed_;
+    NetMasterOptions opts_;
+    std::unique_ptr<TcpServer> server_;
+    std::unordered_map<ConnId, WorkerState> workers_;
+    std::deque<ConnId> idle_;
+    std::unordered_map<std::string, TaskState> tasks_;
+    // Ids of tasks waiting for a worker; retries go to the front. Ids of tasks that finished while
+    // queued are skipped when popped.
+    std::deque<std::string> jobs_;
+    NetTaskStats task_stats_;
+    TraceWriter* trace_ = nullptr;
+    int trace_pid_ = 0;
+    uint64_t trace_dispatches_ = 0, trace_rows_ = 0;
+    bool stopping_ = false;
+    mutable std::mutex mtx_;
+    std::condition_variable space_cv_;
+    std::condition_variable reap_cv_;
+    std::thread reaper_;
+    struct Preresize { ConnId conn; NetJob job; bool traced; bool rgb8; };
+    std::unique_ptr<BoundedQueue<Preresize>> preresize_q_;
+    std::vector<std::thread> preresizers_;
+    void on_message(std::string_view msg, ConnId conn);
+    void on_result_done(ConnId conn, std::string_view id);
+    void on_task_failed(ConnId conn, std::string_view id);
+    void release_locked(ConnId conn, const std::string& id);
+    void record_result(WorkerState& w, std::string_view id, Clock::time_point now);
+    ConnId tail_handoff(ConnId conn, const WorkerState& w) const;
+    bool claim_result(std::string_view id);
+    void requeue_locked(std::unordered_map<std::string, TaskState>::iterator t, std::vector<NetJob>& failed);
+    const std::string* pick_straggler(ConnId conn, const WorkerState& w, Clock::time_point now) const;
+    std::vector<ConnId> unpark_all_locked();
+    void reap_loop();
+    void on_close(ConnId conn);
+    void send_next(ConnId conn);
+    bool send_task_data(ConnId conn, const NetJob& job, bool traced);
+    bool queue_preresize(ConnId conn, const NetJob& job, bool traced, bool rgb8);
+    void preresize_loop();
+    void drop_unsent(ConnId conn, const std::vector<const NetJob*>& unsent);
+    void on_trace(std::string_view msg, ConnId conn);
 };
 }
@@ -0,0 +1,29 @@
+#pragma once
+#include <string>
+#include <thread>
+#include <atomic>
+#include <cstdint>
+#include "networking/socket.h"
+
+namespace dip {
+// Minimal HTTP endpoint for scrapers: GET /metrics serves metrics_prometheus(), GET /metrics.json
+// serves metrics_json(). Requests are answered one at a time on a single thread, so a scrape never
+// touches the data path.
+class MetricsServer {
+public:
+    MetricsServer(const std::string& bind_addr, uint16_t port);
+    ~MetricsServer();
+    MetricsServer(const MetricsServer&) = delete;
+    MetricsServer& operator=(const MetricsServer&) = delete;
+    // False if the port cannot be bound.
+    bool start();
+    void stop();
+private:
+    std::string bind_addr_;
+    uint16_t port_;
+    socket_t listen_ = kInvalidSocket;
+    std::atomic<bool> stop_{false};
+    std::thread thr_;
+    void serve();
+};
+}
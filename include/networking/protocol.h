@@ -1,10 +1,71 @@
 #pragma once
 #include <string>
+#include <string_view>
 #include <vector>
 #include <cstdint>
+#include "common/trace.h"
+#include "common/embedding_codec.h"
 
 namespace dip {
 std::string encode_length_prefixed(const std::string& payload);
+void append_length_prefixed(std::string& out, const std::string& payload);
 bool decode_length_prefixed(const std::vector<uint8_t>& buf, size_t& offset, std::string& out);
-}
+// Same as decode_length_prefixed but returns a view into `buf` instead of copying.
+bool peek_length_prefixed(const std::vector<uint8_t>& buf, size_t& offset, std::string_view& out);
+
+// Binary frames share the length-prefixed transport with the key=value text messages and are told
+// apart by their first byte (text messages always start with "type="). Layout, little-endian:
+//   u8 magic 0xDB | u8 version | u8 MsgType | u8 ElemType | u32 dim
+//   u16 label_len | u16 path_len | u16 id_len | u16 flags | label | path | id | dim elements
+// Result frames carry an embedding (F32/F16/I8/PQ); task frames carry the encoded image file (U8)
+// or, for workers that list task_modes=rgb8, the master's pre-resized 224x224 RGB image (RGB8).
+// I8 elements are a f32 scale followed by `dim` int8 codes; PQ elements are `dim` one-byte codes
+// (one per subspace), decoded with the product quantizer both sides negotiated.
+// Unknown flag bits are ignored, so older peers (which always sent 0) still interoperate.
+const uint8_t kBinMagic = 0xDB;
+const uint8_t kBinVersion = 1;
+const size_t kBinHeaderSize = 16;
+// Task frame flag: the master samples this task for tracing and wants a type=trace message back.
+const uint16_t kFrameTraced = 1;
+enum class MsgType : uint8_t { Result = 1, Task = 2 };
+enum class ElemType : uint8_t { F32 = 1, F16 = 2, U8 = 3, I8 = 4, PQ = 5, RGB8 = 6 };
+// Negotiated per connection in type=hello (worker lists result_formats) and type=welcome (master
+// picks). Workers only list pq with a codebook, whose fingerprint they send as pq_codebook=<hex>.
+enum class ResultFormat { Text, BinF32, BinF16, BinI8, BinPQ };
+const char* result_format_name(ResultFormat f);
+bool parse_result_format(std::string_view name, ResultFormat& out);
 
+struct FrameView {
+    MsgType type = MsgType::Result;
+    std::string_view label;
+    std::string_view path;
+    std::string_view id;
+    ElemType elem = ElemType::F32;
+    uint32_t dim = 0;
+    uint16_t flags = 0;
+    const uint8_t* data = nullptr;
+};
+bool is_binary_frame(std::string_view msg);
+size_t elem_size(ElemType e);
+// Bytes of element data after the strings for `dim` elements of `e`.
+size_t payload_size(ElemType e, uint32_t dim);
+// Header and strings only; the caller appends (or streams) `count` elements after it.
+std::string encode_frame_header(MsgType type, ElemType elem, const std::string& label, const std::string& path, const std::string& id, uint32_t count, uint16_t flags = 0);
+// PQ needs `pq`, and the embedding must have pq->dim() values.
+std::string encode_result_frame(const std::string& label, const std::string& path, const std::string& id, const std::vector<float>& embedding, ElemType elem, const ProductQuantizer* pq = nullptr);
+// Validates the header and points the view's fields into `msg`; no allocation.
+bool parse_frame(std::string_view msg, FrameView& out);
+bool parse_result_frame(std::string_view msg, FrameView& out);
+// False for PQ codes without a matching codebook.
+bool decode_embedding(const FrameView& v, std::vector<float>& out, const ProductQuantizer* pq = nullptr);
+
+// Value of `key=` in a newline-separated text message, or empty.
+std::string_view get_text_field(std::string_view msg, std::string_view key);
+// type=result text message (embedding as comma-separated decimals), for peers without binary frames.
+std::string encode_text_result(const std::string& label, const std::string& path, const std::string& id, const std::vector<float>& embedding);
+bool parse_text_result(std::string_view msg, std::string& label, std::string& path, std::vector<float>& embedding);
+// type=trace message a worker sends after the result of a sampled task: when it received the task
+// and sent the result, and its spans, all on the worker's clock (spans=name:start:dur,...).
+std::string encode_trace_message(const std::string& id, int64_t recv_us, int64_t sent_us, const std::vector<TraceSpan>& spans);
+bool parse_trace_message(std::string_view msg, std::string& id, int64_t& recv_us, int64_t& sent_us, std::vector<TraceSpan>& spans);
+}
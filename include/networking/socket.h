@@ -0,0 +1,32 @@
+#pragma once
+#include <cstdint>
+#if defined(_WIN32)
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#pragma comment(lib, "ws2_32.lib")
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/time.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#endif
+
+namespace dip {
+#if defined(_WIN32)
+using socket_t = SOCKET;
+const socket_t kInvalidSocket = INVALID_SOCKET;
+#else
+using socket_t = int;
+const socket_t kInvalidSocket = -1;
+#endif
+void net_init();
+void close_socket(socket_t s);
+void set_nodelay(socket_t s);
+// Blocking recv/send on `s` give up after `ms` milliseconds.
+void set_io_timeout(socket_t s, int ms);
+// OutputDebugStringA on Windows; stderr on POSIX when DIP_NET_DEBUG is set.
+void net_log(const char* msg);
+}
@@ -1,16 +1,25 @@
 #pragma once
 #include <string>
-#include <winsock2.h>
-#include <ws2tcpip.h>
+#include <vector>
+#include <cstdint>
+#include "networking/socket.h"
 
 namespace dip {
 class TcpClient {
 public:
     TcpClient();
+    ~TcpClient();
+    TcpClient(const TcpClient&) = delete;
+    TcpClient& operator=(const TcpClient&) = delete;
     bool connect(const std::string& host, uint16_t port);
     bool send(const std::string& payload);
+    // Blocks until one whole frame is buffered; extra bytes stay queued for the next call.
     bool read(std::string& out);
+    void close();
 private:
-    SOCKET sock_ = INVALID_SOCKET;
+    socket_t sock_ = kInvalidSocket;
+    std::vector<uint8_t> rbuf_;
+    size_t rpos_ = 0;
+    bool send_all(const char* data, size_t len);
 };
 }
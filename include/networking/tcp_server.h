@@ -1,22 +1,62 @@
 #pragma once
 #include <string>
+#include <string_view>
 #include <functional>
 #include <memory>
-#include <winsock2.h>
-#include <ws2tcpip.h>
-#pragma comment(lib, "ws2_32.lib")
+#include <mutex>
+#include <atomic>
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+#include "networking/socket.h"
 
 namespace dip {
+using ConnId = uint64_t;
+
+// On Linux, `io_threads` epoll loops share the listening socket and each owns the connections it
+// accepts: per-connection read buffers reassemble frames, and writes never block — whatever the
+// kernel does not take is buffered and flushed on EPOLLOUT. Elsewhere it falls back to one
+// blocking thread per connection. Callbacks run on the thread that owns the connection; the
+// message view points into the connection's read buffer and is only valid during the callback.
 class TcpServer {
 public:
-    using OnMessage = std::function<void(const std::string&, SOCKET)>;
-    TcpServer(const std::string& bind_addr, uint16_t port, OnMessage on_message);
+    using OnMessage = std::function<void(std::string_view, ConnId)>;
+    using OnClose = std::function<void(ConnId)>;
+    TcpServer(const std::string& bind_addr, uint16_t port, OnMessage on_message, int io_threads = 1);
+    ~TcpServer();
+    void set_on_close(OnClose on_close);
     void start();
+    void stop();
+    // Frames and queues the payload; safe from any thread.
+    bool send(ConnId conn, const std::string& payload);
+    // Sends one frame made of `prefix` followed by the file's bytes. On Linux the file is streamed
+    // with sendfile from the page cache; `size` must match the file or nothing is queued.
+    bool send_file(ConnId conn, const std::string& prefix, const std::string& path, uint64_t size);
+    size_t connection_count() const;
 private:
-    SOCKET listen_ = INVALID_SOCKET;
+    struct Connection;
+    struct Loop;
+    socket_t listen_ = kInvalidSocket;
     OnMessage on_message_;
+    OnClose on_close_;
+    int io_threads_ = 1;
+    std::atomic<bool> stop_{false};
+    std::atomic<ConnId> next_id_{1};
+    std::vector<std::unique_ptr<Loop>> loops_;
+    std::unordered_map<ConnId, std::shared_ptr<Connection>> conns_;
+    mutable std::mutex conns_mtx_;
+    std::shared_ptr<Connection> add_connection(socket_t sock, Loop* loop);
+    void remove_connection(const std::shared_ptr<Connection>& conn);
+#if defined(_WIN32)
     void do_accept();
-    static bool read_exact(SOCKET sock, char* buf, size_t len);
-    void connection_loop(SOCKET sock);
+    static bool read_exact(socket_t sock, char* buf, size_t len);
+    void connection_loop(std::shared_ptr<Connection> conn);
+#else
+    void run_loop(Loop& loop);
+    void on_accept(Loop& loop);
+    bool on_readable(Connection& conn);
+    bool on_writable(Connection& conn);
+    bool flush_locked(Connection& conn);
+#endif
 };
 }
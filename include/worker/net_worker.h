@@ -0,0 +1,38 @@
+#pragma once
+#include <string>
+#include <cstdint>
+#include "common/async_file_reader.h"
+#include "inference/batcher.h"
+#include "inference/onnx_backend.h"
+#include "networking/protocol.h"
+
+namespace dip {
+struct NetWorkerOptions {
+    std::string host = "127.0.0.1";
+    uint16_t port = 5555;
+    std::string model_path = "models/vggface2_resnet50.onnx";
+    std::string name_prefix;
+    BatchPolicy batch;
+    ResultFormat result_format = ResultFormat::BinF32;
+    // Tasks each connection asks the master to keep in flight; 0 picks enough to fill a batch.
+    int credits = 0;
+    // Threads decoding and preprocessing images ahead of the group's inference thread.
+    int decode_threads = 2;
+    // Prints the group's per-stage queue depths this often; 0 disables.
+    int stats_interval_s = 0;
+    OnnxSessionOptions onnx;
+    // Path tasks' files are prefetched as they arrive, while earlier tasks decode and infer; a
+    // decode thread only blocks if its file is still being read. depth 0 reads each file on the
+    // connection thread before queueing the task.
+    AsyncReadOptions read_ahead;
+    // Product-quantizer codebook; when it loads, pq is offered as a result format and the master
+    // picks it if it holds the same codebook.
+    std::string pq_codebook;
+};
+
+// Opens `connections` connections to the master for one provider group. Connection threads fetch
+// tasks and start their file reads, a decode pool turns them into tensors, and a single backend infers them in
+// batches (see InferencePipeline), so tasks in flight across the group are inferred together.
+// All threads are detached.
+void start_net_worker_group(const NetWorkerOptions& opts, bool prefer_cuda, int connections);
+}
@@ -1,20 +1,27 @@
+import argparse
 import os
 import sys
 
 # Make sure we can import model.py and resnet.py from this folder
 sys.path.append(os.path.dirname(os.path.abspath(__file__)))
 
-import tensorflow as tf
-import keras
-
-from model import Vggface2_ResNet50
-import resnet  # just to ensure it's registered
-
 WEIGHTS_PATH = "weights.h5"
 OUTPUT_ONNX = "vggface2_resnet50.onnx"
 
 
-def main():
+def variant_path(fp32_path, precision):
+    # Must match model_variant_path() in include/inference/onnx_backend.h
+    root, ext = os.path.splitext(fp32_path)
+    return f"{root}.{precision}{ext}"
+
+
+def export_fp32(output_path):
+    import tensorflow as tf
+    import keras
+
+    from model import Vggface2_ResNet50
+    import resnet  # just to ensure it's registered
+
     print("Building training model (with classifier)...")
 
     # Build model in TRAIN mode so its architecture matches the saved weights
@@ -50,20 +57,84 @@ def main():
     except ImportError:
         print("ERROR: tf2onnx is not installed. Please run:")
         print("    pip install tf2onnx")
-        return
+        return False
 
-    # Input: batch of RGB images 224x224x3
-    spec = (tf.TensorSpec((1, 224, 224, 3), tf.float32, name="input"),)
+    # Input: batch of RGB images 224x224x3 (dynamic batch dim so workers can run batched inference)
+    spec = (tf.TensorSpec((None, 224, 224, 3), tf.float32, name="input"),)
 
     model_proto, _ = tf2onnx.convert.from_keras(
         feature_model,
         input_signature=spec,
         opset=13,
-        output_path=OUTPUT_ONNX,
+        output_path=output_path,
     )
 
-    print(f"✅ Successfully saved ONNX model to: {OUTPUT_ONNX}")
+    print(f"✅ Successfully saved ONNX model to: {output_path}")
+    return True
+
+
+def export_fp16(fp32_path):
+    # Float16 weights and activations for CUDA; inputs and outputs stay float32, which is what the
+    # C++ backend feeds and reads. On CPU this variant is usually slower than FP32.
+    try:
+        import onnx
+        from onnxconverter_common import float16
+    except ImportError:
+        print("ERROR: FP16 export needs onnx and onnxconverter-common:")
+        print("    pip install onnx onnxconverter-common")
+        return False
+    out = variant_path(fp32_path, "fp16")
+    model = onnx.load(fp32_path)
+    model = float16.convert_float_to_float16(model, keep_io_types=True)
+    onnx.save(model, out)
+    print(f"✅ Saved FP16 model to: {out}")
+    return True
+
+
+def export_int8(fp32_path):
+    # Dynamic quantization: INT8 weights, activation ranges computed per batch at run time, so no
+    # calibration set is needed. Meant for the CPU provider; check the drift with
+    #     master --validate-precision int8
+    try:
+        from onnxruntime.quantization import quantize_dynamic, QuantType
+        from onnxruntime.quantization.shape_inference import quant_pre_process
+    except ImportError:
+        print("ERROR: INT8 export needs onnxruntime:")
+        print("    pip install onnxruntime")
+        return False
+    out = variant_path(fp32_path, "int8")
+    prepared = variant_path(fp32_path, "prep")
+    # Shape inference and graph cleanup first, as recommended before quantizing.
+    quant_pre_process(fp32_path, prepared)
+    try:
+        # uint8 weights: the CPU provider's ConvInteger kernel has no int8-weight variant.
+        quantize_dynamic(prepared, out, weight_type=QuantType.QUInt8, per_channel=False)
+    finally:
+        os.remove(prepared)
+    print(f"✅ Saved INT8 model to: {out}")
+    return True
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Export the VGGFace2 ResNet50 feature model to ONNX, plus optional reduced-precision variants.")
+    parser.add_argument("--output", default=OUTPUT_ONNX, help="FP32 model path (variants are written next to it)")
+    parser.add_argument("--fp16", action="store_true", help="also write <name>.fp16.onnx")
+    parser.add_argument("--int8", action="store_true", help="also write <name>.int8.onnx")
+    parser.add_argument("--variants-only", action="store_true", help="derive the variants from an existing FP32 model without TensorFlow")
+    args = parser.parse_args()
+
+    if not args.variants_only and not export_fp32(args.output):
+        return 1
+    if not os.path.exists(args.output):
+        print(f"ERROR: no FP32 model at {args.output}")
+        return 1
+    ok = True
+    if args.fp16:
+        ok = export_fp16(args.output) and ok
+    if args.int8:
+        ok = export_int8(args.output) and ok
+    return 0 if ok else 1
 
 
 if __name__ == "__main__":
-    main()
+    sys.exit(main())
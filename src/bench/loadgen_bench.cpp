@@ -0,0 +1,179 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <algorithm>
+#include <charconv>
+#if !defined(_WIN32)
+#include <sys/resource.h>
+#endif
+#include "master/net_master.h"
+#include "networking/tcp_client.h"
+#include "networking/protocol.h"
+#include "inference/factory.h"
+
+using namespace dip;
+
+// NetMaster scale test over loopback: an in-process master and N simulated workers, one connection
+// each, speaking the worker protocol (hello with credits, welcome, text tasks, binary f32 results)
+// and answering with the synthetic backend. For each worker count it reports the rate tasks reach
+// workers (dispatch), the rate the master delivers results (ingest), time tasks wait in the master
+// queue, and the per-task round trip from a worker receiving a task to the master delivering its
+// result. Each simulated worker is one thread.
+// With --hung N the first N workers take tasks and never answer: every task must still complete
+// on the others through lease expiry, and the tool exits non-zero if any is reported failed.
+// Usage: bench_loadgen [--workers 16,64,256,1024] [--tasks N] [--credits N] [--latency-us N]
+//                      [--jitter-us N] [--decode-us N] [--io-threads N] [--port N]
+//                      [--hung N] [--lease-ms N]
+// Output: workers,tasks,seconds,dispatch_per_s,ingest_per_s,queue_p50_ms,queue_p99_ms,rtt_p50_ms,rtt_p90_ms,rtt_p99_ms,rtt_max_ms
+namespace {
+using Clock = std::chrono::steady_clock;
+
+struct Config {
+    std::vector<int> workers{16, 64, 256, 1024};
+    size_t tasks = 100000;
+    int credits = 4;
+    int io_threads = 2;
+    uint16_t port = 47500;
+    int hung = 0;
+    int lease_ms = 300;  // only with --hung
+    SyntheticBackendOptions backend;
+};
+
+std::vector<int> parse_list(const std::string& s) {
+    std::vector<int> out;
+    for (size_t pos = 0; pos < s.size();) {
+        size_t comma = s.find(',', pos);
+        if (comma == std::string::npos) comma = s.size();
+        out.push_back(std::stoi(s.substr(pos, comma - pos)));
+        pos = comma + 1;
+    }
+    return out;
+}
+
+size_t parse_index(std::string_view id) {
+    size_t v = 0;
+    std::from_chars(id.data(), id.data() + id.size(), v);
+    return v;
+}
+
+double percentile_ms(std::vector<int64_t>& ns, double q) {
+    if (ns.empty()) return 0;
+    size_t k = std::min(ns.size() - 1, static_cast<size_t>(q * double(ns.size())));
+    std::nth_element(ns.begin(), ns.begin() + static_cast<std::ptrdiff_t>(k), ns.end());
+    return double(ns[k]) / 1e6;
+}
+
+bool run_round(const Config& cfg, int workers, uint16_t port) {
+    size_t n = cfg.tasks;
+    // Nanoseconds since t0 per task id; 0 = not yet.
+    std::unique_ptr<std::atomic<int64_t>[]> t_enq(new std::atomic<int64_t>[n]), t_recv(new std::atomic<int64_t>[n]), t_res(new std::atomic<int64_t>[n]);
+    for (size_t i=0; i<n; ++i) { t_enq[i] = 0; t_recv[i] = 0; t_res[i] = 0; }
+    std::atomic<size_t> received{0}, results{0}, failed{0}, hung_received{0};
+    auto t0 = Clock::now();
+    auto since = [&]{ return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - t0).count(); };
+
+    NetMasterOptions mo;
+    mo.io_threads = cfg.io_threads;
+    mo.max_queued_jobs = 4096;
+    mo.max_credits = std::max(64, cfg.credits);
+    // Measure dispatch, not recovery: no lease expiry or backup copies during the run, unless hung
+    // workers are what is being tested.
+    mo.lease_ms = cfg.hung ? cfg.lease_ms : 600000;
+    mo.speculate = false;
+    std::unique_ptr<NetMaster> nm(new NetMaster("127.0.0.1", port, [&](const std::string&, const std::string& path, const std::vector<float>&){
+        size_t i = parse_index(path);
+        if (i < n) t_res[i] = since();
+        results++;
+    }, mo));
+    nm->set_on_failed([&](const NetJob&){ failed++; });
+    std::thread server([&]{ nm->run(); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    std::atomic<int> connected{0};
+    std::vector<std::thread> sims;
+    for (int w=0; w<workers; ++w) {
+        sims.emplace_back([&, w]{
+            TcpClient c;
+            bool ok = false;
+            for (int attempt=0; attempt<50 && !(ok = c.connect("127.0.0.1", port)); ++attempt) std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            if (!ok) { std::cerr << "sim " << w << ": cannot connect" << std::endl; return; }
+            auto backend = make_synthetic_backend([&]{ auto o = cfg.backend; o.seed += static_cast<uint64_t>(w); return o; }());
+            c.send("type=hello\nworker_id=sim-" + std::to_string(w) + "\nprovider=cpu\nresult_formats=f32\ncredits=" + std::to_string(cfg.credits) + "\ntask_modes=path\n");
+            connected++;
+            std::string msg;
+            while (c.read(msg)) {
+                if (get_text_field(msg, "type") != "task") continue;
+                std::string label(get_text_field(msg, "label")), id(get_text_field(msg, "id"));
+                size_t i = parse_index(id);
+                if (w < cfg.hung) { hung_received++; continue; }
+                if (i < n) t_recv[i] = since();
+                received++;
+                auto r = backend->infer(std::vector<unsigned char>(id.begin(), id.end()));
+                if (!r || !c.send(encode_result_frame(label, id, id, r->embedding, ElemType::F32))) break;
+            }
+        });
+    }
+    while (connected.load() < workers && since() < 30'000'000'000LL) std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+    auto start = since();
+    for (size_t i=0; i<n; ++i) {
+        std::string id = std::to_string(i);
+        t_enq[i] = since();
+        if (!nm->enqueue(NetJob{"load", id, id})) break;
+    }
+    while (results.load() + failed.load() < n && since() - start < 300'000'000'000LL) std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    double secs = double(since() - start) / 1e9;
+    auto ts = nm->task_stats();
+
+    nm->stop();
+    server.join();
+    std::vector<int64_t> queue, rtt;
+    for (size_t i=0; i<n; ++i) {
+        int64_t e = t_enq[i], r = t_recv[i], d = t_res[i];
+        if (r && e) queue.push_back(r - e);
+        if (d && r) rtt.push_back(d - r);
+    }
+    std::cout << workers << "," << n << "," << secs << "," << double(received.load()) / secs << "," << double(results.load()) / secs << ","
+              << percentile_ms(queue, 0.5) << "," << percentile_ms(queue, 0.99) << ","
+              << percentile_ms(rtt, 0.5) << "," << percentile_ms(rtt, 0.9) << "," << percentile_ms(rtt, 0.99) << ","
+              << (rtt.empty() ? 0.0 : double(*std::max_element(rtt.begin(), rtt.end())) / 1e6) << std::endl;
+    if (cfg.hung) std::cerr << "round with " << workers << " workers: " << cfg.hung << " hung received " << hung_received.load() << " tasks, expired=" << ts.expired << " failed=" << failed.load() << std::endl;
+    bool ok = results.load() == n;
+    if (!ok) std::cerr << "round with " << workers << " workers ended at " << results.load() << "/" << n << " results (" << failed.load() << " failed)" << std::endl;
+    // Destroying the master closes the server side of every connection, which ends the sims.
+    nm.reset();
+    for (auto& t : sims) t.join();
+    return ok;
+}
+}
+
+int main(int argc, char** argv) {
+    Config cfg;
+    for (int i=1; i<argc; ++i) {
+        std::string a = argv[i];
+        if (a == "--workers" && i+1 < argc) cfg.workers = parse_list(argv[++i]);
+        else if (a == "--tasks" && i+1 < argc) cfg.tasks = static_cast<size_t>(std::stoll(argv[++i]));
+        else if (a == "--credits" && i+1 < argc) cfg.credits = std::stoi(argv[++i]);
+        else if (a == "--latency-us" && i+1 < argc) cfg.backend.latency_us = std::stoi(argv[++i]);
+        else if (a == "--jitter-us" && i+1 < argc) cfg.backend.jitter_us = std::stoi(argv[++i]);
+        else if (a == "--decode-us" && i+1 < argc) cfg.backend.decode_us = std::stoi(argv[++i]);
+        else if (a == "--io-threads" && i+1 < argc) cfg.io_threads = std::stoi(argv[++i]);
+        else if (a == "--port" && i+1 < argc) cfg.port = static_cast<uint16_t>(std::stoi(argv[++i]));
+        else if (a == "--hung" && i+1 < argc) cfg.hung = std::stoi(argv[++i]);
+        else if (a == "--lease-ms" && i+1 < argc) cfg.lease_ms = std::stoi(argv[++i]);
+    }
+#if !defined(_WIN32)
+    // Two descriptors per simulated worker (client and server side) over loopback.
+    rlimit rl{};
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) { rl.rlim_cur = rl.rlim_max; setrlimit(RLIMIT_NOFILE, &rl); }
+#endif
+    std::cout << "workers,tasks,seconds,dispatch_per_s,ingest_per_s,queue_p50_ms,queue_p99_ms,rtt_p50_ms,rtt_p90_ms,rtt_p99_ms,rtt_max_ms" << std::endl;
+    uint16_t port = cfg.port;
+    bool ok = true;
+    for (int w : cfg.workers) ok = run_round(cfg, w, port++) && ok;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,232 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <functional>
+#include <algorithm>
+#include <filesystem>
+#include <memory>
+#include <cstdint>
+#include "common/base64.h"
+#include "common/csv_writer.h"
+#include "common/vector_math.h"
+#include "inference/preprocess.h"
+#if defined(DIP_HAS_NETWORKING)
+#include "networking/protocol.h"
+#endif
+#if defined(DIP_HAS_ONNX)
+#include "inference/onnx_backend.h"
+#endif
+
+using namespace dip;
+
+// Microbenchmarks for the per-image hot paths, for tracking regressions between releases. Each case
+// is calibrated to about --min-time-ms per repetition and reports the median and best of --reps.
+// Runs on a CPU-only box; inference cases are skipped when the build has no ONNX Runtime or the
+// model file is missing.
+// Usage: bench_micro [--json] [--out FILE] [--filter SUBSTR] [--min-time-ms N] [--reps N]
+//                    [--model PATH] [--batches 1,4,16]
+// Output (CSV): bench,param,iters,ns_per_op,ns_per_op_min,mb_per_s
+//   --json writes the same fields as one JSON array.
+namespace {
+using Clock = std::chrono::steady_clock;
+volatile size_t g_sink = 0;
+
+struct Options {
+    bool json = false;
+    std::string out, filter;
+    std::string model = "models/vggface2_resnet50.onnx";
+    std::vector<int> batches{1, 4, 8, 16, 32};
+    double min_time_ms = 200;
+    int reps = 5;
+};
+struct Row { std::string bench, param; size_t iters = 0; double ns = 0, ns_min = 0, mb_per_s = 0; };
+
+class Runner {
+public:
+    explicit Runner(const Options& o) : o_(o) {}
+    // `bytes` is the payload one call processes (embedding floats for the result and CSV cases),
+    // for mb_per_s; 0 reports 0.
+    void run(const std::string& bench, const std::string& param, size_t bytes, const std::function<void()>& fn) {
+        if (!o_.filter.empty() && (bench + "/" + param).find(o_.filter) == std::string::npos) return;
+        fn();
+        size_t iters = 1;
+        double rep_ns = o_.min_time_ms * 1e6;
+        for (;;) {
+            double ns = time_ns(iters, fn);
+            if (ns >= rep_ns / 10 || iters >= (size_t(1) << 30)) { iters = std::max<size_t>(1, static_cast<size_t>(double(iters) * rep_ns / std::max(ns, 1.0))); break; }
+            iters *= 10;
+        }
+        std::vector<double> per_op;
+        for (int r=0; r<std::max(1, o_.reps); ++r) per_op.push_back(time_ns(iters, fn) / double(iters));
+        std::sort(per_op.begin(), per_op.end());
+        Row row{bench, param, iters, per_op[per_op.size() / 2], per_op.front(), 0};
+        if (bytes) row.mb_per_s = double(bytes) / row.ns * 1e3;
+        std::cerr << bench << "/" << param << ": " << row.ns << " ns/op" << std::endl;
+        rows_.push_back(row);
+    }
+    void write(std::ostream& os) const {
+        if (!o_.json) {
+            os << "bench,param,iters,ns_per_op,ns_per_op_min,mb_per_s\n";
+            for (auto& r : rows_) os << r.bench << "," << r.param << "," << r.iters << "," << r.ns << "," << r.ns_min << "," << r.mb_per_s << "\n";
+            return;
+        }
+        os << "[\n";
+        for (size_t i=0; i<rows_.size(); ++i) {
+            auto& r = rows_[i];
+            os << "  {\"bench\":\"" << r.bench << "\",\"param\":\"" << r.param << "\",\"iters\":" << r.iters << ",\"ns_per_op\":" << r.ns
+               << ",\"ns_per_op_min\":" << r.ns_min << ",\"mb_per_s\":" << r.mb_per_s << "}" << (i + 1 < rows_.size() ? "," : "") << "\n";
+        }
+        os << "]\n";
+    }
+private:
+    static double time_ns(size_t iters, const std::function<void()>& fn) {
+        auto t0 = Clock::now();
+        for (size_t i=0; i<iters; ++i) fn();
+        return std::chrono::duration<double, std::nano>(Clock::now() - t0).count();
+    }
+    const Options& o_;
+    std::vector<Row> rows_;
+};
+
+std::vector<float> make_embedding(size_t dim) {
+    std::vector<float> v(dim);
+    for (size_t i=0; i<dim; ++i) v[i] = static_cast<float>((static_cast<int>(i * 2654435761u >> 20) % 2000) - 1000) / 997.0f;
+    return v;
+}
+
+#if defined(DIP_HAS_NETWORKING)
+void bench_protocol(Runner& r) {
+    for (size_t n : {64, 2048, 65536}) {
+        std::string payload(n, 'x');
+        r.run("encode_length_prefixed", std::to_string(n), n, [&]{ g_sink = g_sink + encode_length_prefixed(payload).size(); });
+        std::string framed = encode_length_prefixed(payload);
+        std::vector<uint8_t> buf(framed.begin(), framed.end());
+        std::string out;
+        r.run("decode_length_prefixed", std::to_string(n), n, [&]{ size_t off = 0; decode_length_prefixed(buf, off, out); g_sink = g_sink + out.size(); });
+    }
+    auto emb = make_embedding(512);
+    std::string label = "person_0042", path = "images/person_0042/IMG_20240101_000123.jpg", id = path;
+    std::vector<float> back;
+    std::string text = encode_text_result(label, path, id, emb);
+    r.run("encode_result", "text_512", emb.size() * sizeof(float), [&]{ g_sink = g_sink + encode_text_result(label, path, id, emb).size(); });
+    r.run("parse_result", "text_512", text.size(), [&]{ std::string l, p; parse_text_result(text, l, p, back); g_sink = g_sink + back.size(); });
+    for (auto e : {ElemType::F32, ElemType::F16, ElemType::I8}) {
+        std::string name = e == ElemType::F32 ? "f32_512" : e == ElemType::F16 ? "f16_512" : "i8_512";
+        std::string frame = encode_result_frame(label, path, id, emb, e);
+        r.run("encode_result", name, emb.size() * sizeof(float), [&]{ g_sink = g_sink + encode_result_frame(label, path, id, emb, e).size(); });
+        r.run("parse_result", name, frame.size(), [&]{ FrameView v; parse_result_frame(frame, v); decode_embedding(v, back); g_sink = g_sink + back.size(); });
+    }
+}
+#endif
+
+void bench_base64(Runner& r) {
+    for (size_t n : {4096, 262144}) {
+        std::vector<unsigned char> data(n);
+        for (size_t i=0; i<n; ++i) data[i] = static_cast<unsigned char>(i * 131);
+        r.run("base64_encode", std::to_string(n), n, [&]{ g_sink = g_sink + base64_encode(data).size(); });
+    }
+}
+
+// One query against a block of 1024 rows: the inner loop of an index list scan.
+void bench_dot(Runner& r) {
+    auto q = make_embedding(512);
+    std::vector<float> rows;
+    for (size_t i=0; i<1024; ++i) { auto e = make_embedding(512); rows.insert(rows.end(), e.begin(), e.end()); }
+    std::vector<float> out(1024);
+    r.run("dot_products", "1024x512", rows.size() * sizeof(float), [&]{ dot_products(q.data(), rows.data(), 1024, 512, out.data()); g_sink = g_sink + size_t(out[0] > 0); });
+}
+
+// write_row is timed with the per-float std::to_string the caller has to do for it.
+void bench_csv(Runner& r) {
+    auto path = (std::filesystem::temp_directory_path() / "dip_bench_micro.csv").string();
+    auto emb = make_embedding(512);
+    {
+        CsvWriter csv(path);
+        std::vector<std::string> cols;
+        r.run("csv_write_row", "512", emb.size() * sizeof(float), [&]{
+            cols.clear();
+            cols.push_back("person_0042");
+            cols.push_back("images/person_0042/IMG_20240101_000123.jpg");
+            for (float v : emb) cols.push_back(std::to_string(v));
+            csv.write_row(cols);
+        });
+    }
+    {
+        CsvWriter csv(path);
+        r.run("csv_write_embedding_row", "512", emb.size() * sizeof(float), [&]{ csv.write_embedding_row("person_0042", "images/person_0042/IMG_20240101_000123.jpg", emb.data(), emb.size(), 512); });
+    }
+    std::error_code ec;
+    std::filesystem::remove(path, ec);
+}
+
+void bench_preprocess(Runner& r) {
+    std::vector<float> tensor(kTensorSize);
+    for (auto wh : {std::pair<int,int>{250, 250}, {640, 480}, {1920, 1080}}) {
+        int w = wh.first, h = wh.second;
+        std::vector<uint8_t> img(size_t(w) * h * 3);
+        for (size_t i=0; i<img.size(); ++i) img[i] = static_cast<uint8_t>((i * 2654435761u) >> 24);
+        r.run("resize_bgr_to_rgb_f32", std::to_string(w) + "x" + std::to_string(h), img.size(), [&]{
+            resize_bgr_to_rgb_f32(img.data(), w, h, size_t(w) * 3, tensor.data(), kModelSide, kModelSide);
+            g_sink = g_sink + static_cast<size_t>(tensor[0]);
+        });
+    }
+}
+
+// ns_per_op is per batch; divide by the batch size for per-image cost.
+void bench_infer(Runner& r, const Options& o) {
+#if defined(DIP_HAS_ONNX)
+    if (!std::filesystem::exists(o.model)) { std::cerr << "skipping infer: no model at " << o.model << std::endl; return; }
+    OnnxRuntimeBackend backend(ProviderPref::CPU);
+    if (!backend.init(o.model)) { std::cerr << "skipping infer: cannot load " << o.model << std::endl; return; }
+    for (int b : o.batches) {
+        if (b < 1) continue;
+        std::vector<std::vector<float>> tensors(static_cast<size_t>(b), std::vector<float>(kTensorSize));
+        for (size_t t=0; t<tensors.size(); ++t) for (size_t i=0; i<kTensorSize; ++i) tensors[t][i] = static_cast<float>((i + t * 7) % 255);
+        std::vector<TensorView> views;
+        for (auto& t : tensors) views.push_back(TensorView{t.data(), kModelSide, kModelSide});
+        r.run("onnx_infer_cpu", "batch_" + std::to_string(b), kTensorSize * sizeof(float) * static_cast<size_t>(b), [&]{ g_sink = g_sink + backend.infer_tensors(views).size(); });
+    }
+#else
+    (void)r; (void)o;
+    std::cerr << "skipping infer: built without ONNX Runtime" << std::endl;
+#endif
+}
+}
+
+int main(int argc, char** argv) {
+    Options o;
+    for (int i=1; i<argc; ++i) {
+        std::string a = argv[i];
+        if (a == "--json") o.json = true;
+        else if (a == "--out" && i+1 < argc) o.out = argv[++i];
+        else if (a == "--filter" && i+1 < argc) o.filter = argv[++i];
+        else if (a == "--min-time-ms" && i+1 < argc) o.min_time_ms = std::stod(argv[++i]);
+        else if (a == "--reps" && i+1 < argc) o.reps = std::stoi(argv[++i]);
+        else if (a == "--model" && i+1 < argc) o.model = argv[++i];
+        else if (a == "--batches" && i+1 < argc) {
+            o.batches.clear();
+            std::string list = argv[++i];
+            for (size_t pos = 0; pos < list.size();) {
+                size_t comma = list.find(',', pos);
+                if (comma == std::string::npos) comma = list.size();
+                o.batches.push_back(std::stoi(list.substr(pos, comma - pos)));
+                pos = comma + 1;
+            }
+        }
+    }
+    Runner r(o);
+#if defined(DIP_HAS_NETWORKING)
+    bench_protocol(r);
+#endif
+    bench_base64(r);
+    bench_dot(r);
+    bench_csv(r);
+    bench_preprocess(r);
+    bench_infer(r, o);
+    if (o.out.empty()) { r.write(std::cout); return 0; }
+    std::ofstream out(o.out);
+    r.write(out);
+    return out.good() ? 0 : 1;
+}
@@ -0,0 +1,82 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <functional>
+#include <cstdint>
+#if defined(DIP_HAS_OPENCV)
+#include <opencv2/core.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc.hpp>
+#endif
+#include "inference/preprocess.h"
+
+using namespace dip;
+
+// Per-image preprocessing cost: the original decode + resize + cvtColor + per-pixel copy against
+// the fused kernel, with and without reduced-resolution JPEG decode.
+// Usage: bench_preprocess [--iters N] [image.jpg ...]; synthetic JPEGs are used when no files are given.
+static double time_us(int iters, const std::function<void()>& fn) {
+    fn();
+    auto t0 = std::chrono::steady_clock::now();
+    for (int i=0; i<iters; ++i) fn();
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - t0).count() / iters;
+}
+
+int main(int argc, char** argv) {
+    int iters = 50;
+    std::vector<std::string> files;
+    for (int i=1; i<argc; ++i) {
+        std::string a = argv[i];
+        if (a == "--iters" && i+1 < argc) iters = std::stoi(argv[++i]);
+        else files.push_back(a);
+    }
+    std::vector<float> tensor(kTensorSize);
+    std::cout << "case,width,height,us_per_image" << std::endl;
+#if defined(DIP_HAS_OPENCV)
+    struct Input { std::string name; std::vector<unsigned char> bytes; };
+    std::vector<Input> inputs;
+    for (auto& f : files) {
+        std::ifstream in(f, std::ios::binary);
+        std::stringstream ss; ss << in.rdbuf(); std::string s = ss.str();
+        inputs.push_back({f, std::vector<unsigned char>(s.begin(), s.end())});
+    }
+    if (inputs.empty()) {
+        for (auto wh : {std::pair<int,int>{640,480}, {1920,1080}, {4000,3000}}) {
+            cv::Mat img(wh.second, wh.first, CV_8UC3);
+            cv::RNG(42).fill(img, cv::RNG::UNIFORM, cv::Scalar(0,0,0), cv::Scalar(255,255,255));
+            cv::GaussianBlur(img, img, cv::Size(9,9), 3.0);
+            std::vector<unsigned char> jpg;
+            cv::imencode(".jpg", img, jpg, {cv::IMWRITE_JPEG_QUALITY, 90});
+            inputs.push_back({"synthetic", jpg});
+        }
+    }
+    for (auto& in : inputs) {
+        cv::Mat buf(1, static_cast<int>(in.bytes.size()), CV_8UC1, in.bytes.data());
+        cv::Mat full = cv::imdecode(buf, cv::IMREAD_COLOR);
+        if (full.empty()) { std::cerr << "cannot decode " << in.name << std::endl; continue; }
+        int w = full.cols, h = full.rows;
+        int factor = reduced_decode_factor(in.bytes.data(), in.bytes.size(), kModelSide);
+        int flag = factor == 8 ? cv::IMREAD_REDUCED_COLOR_8 : factor == 4 ? cv::IMREAD_REDUCED_COLOR_4 : factor == 2 ? cv::IMREAD_REDUCED_COLOR_2 : cv::IMREAD_COLOR;
+        cv::Mat scratch;
+        auto report = [&](const char* name, double us) { std::cout << name << "," << w << "," << h << "," << us << std::endl; };
+        report("preprocess_reference", time_us(iters, [&]{ resize_bgr_to_rgb_f32_reference(full.data, full.cols, full.rows, full.step, tensor.data(), kModelSide, kModelSide); }));
+        report("preprocess_fused", time_us(iters, [&]{ resize_bgr_to_rgb_f32(full.data, full.cols, full.rows, full.step, tensor.data(), kModelSide, kModelSide); }));
+        report("decode_full+reference", time_us(iters, [&]{ cv::Mat m = cv::imdecode(buf, cv::IMREAD_COLOR); resize_bgr_to_rgb_f32_reference(m.data, m.cols, m.rows, m.step, tensor.data(), kModelSide, kModelSide); }));
+        report("decode_full+fused", time_us(iters, [&]{ cv::imdecode(buf, cv::IMREAD_COLOR, &scratch); resize_bgr_to_rgb_f32(scratch.data, scratch.cols, scratch.rows, scratch.step, tensor.data(), kModelSide, kModelSide); }));
+        report("decode_reduced+fused", time_us(iters, [&]{ cv::imdecode(buf, flag, &scratch); resize_bgr_to_rgb_f32(scratch.data, scratch.cols, scratch.rows, scratch.step, tensor.data(), kModelSide, kModelSide); }));
+    }
+#else
+    (void)files;
+    for (auto wh : {std::pair<int,int>{640,480}, {1920,1080}, {4000,3000}}) {
+        int w = wh.first, h = wh.second;
+        std::vector<uint8_t> img(size_t(w) * h * 3);
+        for (size_t i=0; i<img.size(); ++i) img[i] = static_cast<uint8_t>((i * 2654435761u) >> 24);
+        double us = time_us(iters, [&]{ resize_bgr_to_rgb_f32(img.data(), w, h, size_t(w) * 3, tensor.data(), kModelSide, kModelSide); });
+        std::cout << "preprocess_fused," << w << "," << h << "," << us << std::endl;
+    }
+#endif
+    return 0;
+}
@@ -0,0 +1,143 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <memory>
+#include <optional>
+#include <algorithm>
+#if defined(DIP_HAS_OPENCV)
+#include <opencv2/core.hpp>
+#include <opencv2/imgcodecs.hpp>
+#endif
+#include "common/bounded_queue.h"
+#include "common/work_stealing_queue.h"
+#include "inference/pipeline.h"
+
+using namespace dip;
+
+// Scheduler contention with a stub backend, so only queueing and handoff costs are measured.
+//   queue: one producer feeding W workers that each spin `work_us` per item and hand results to
+//          a writer; a shared mutex queue with per-item handoff vs. the work-stealing queue with
+//          batched handoff.
+//   pipeline: InferencePipeline end to end with W decode threads and W stub backends (tiny images,
+//             fixed per-image cost).
+// Usage: bench_scheduler [--items N] [--max-workers N] [--work-us N]
+// Output: scheduler,mode,workers,items_per_s
+namespace {
+using Clock = std::chrono::steady_clock;
+
+void spin_us(int us) {
+    auto end = Clock::now() + std::chrono::microseconds(us);
+    while (Clock::now() < end) {}
+}
+
+struct Sink {
+    std::mutex mtx;
+    std::vector<size_t> rows;
+    void add(size_t v) { std::lock_guard<std::mutex> lk(mtx); rows.push_back(v); }
+    void add_all(std::vector<size_t>& vs) { std::lock_guard<std::mutex> lk(mtx); rows.insert(rows.end(), vs.begin(), vs.end()); vs.clear(); }
+};
+
+double run_mutex(size_t workers, size_t items, int work_us) {
+    BoundedQueue<size_t> q(256);
+    Sink sink;
+    std::vector<std::thread> ts;
+    auto t0 = Clock::now();
+    for (size_t w=0; w<workers; ++w) ts.emplace_back([&]{ size_t v; while (q.pop(v)) { spin_us(work_us); sink.add(v); } });
+    for (size_t i=0; i<items; ++i) q.push(i);
+    q.close();
+    for (auto& t : ts) t.join();
+    return double(items) / std::chrono::duration<double>(Clock::now() - t0).count();
+}
+
+double run_stealing(size_t workers, size_t items, int work_us) {
+    WorkStealingQueue<size_t> q(workers, 256);
+    Sink sink;
+    std::vector<std::thread> ts;
+    auto t0 = Clock::now();
+    for (size_t w=0; w<workers; ++w) ts.emplace_back([&, w]{
+        std::vector<size_t> local;
+        size_t v;
+        while (q.pop(w, v)) { spin_us(work_us); local.push_back(v); if (local.size() >= 32) sink.add_all(local); }
+        sink.add_all(local);
+    });
+    for (size_t i=0; i<items; ++i) q.push(i);
+    q.close();
+    for (auto& t : ts) t.join();
+    return double(items) / std::chrono::duration<double>(Clock::now() - t0).count();
+}
+
+class StubBackend : public IInferenceBackend {
+public:
+    explicit StubBackend(int us_per_image) : us_(us_per_image) {}
+    bool init(const std::string&) override { return true; }
+    std::optional<InferenceResult> infer(const std::vector<unsigned char>&) override { return InferenceResult{}; }
+    std::vector<std::optional<InferenceResult>> infer_tensors(const std::vector<TensorView>& t) override {
+        spin_us(us_ * static_cast<int>(t.size()));
+        std::vector<std::optional<InferenceResult>> out(t.size());
+        for (auto& r : out) { r = InferenceResult{}; r->embedding.assign(1, 0.0f); }
+        return out;
+    }
+private:
+    int us_;
+};
+
+struct BenchItem {
+    const std::vector<unsigned char>* bytes = nullptr;
+    ImageView image() const { return bytes ? ImageView{bytes->data(), bytes->size()} : ImageView{}; }
+    void release_image() {}
+};
+
+double run_pipeline(size_t decoders, size_t inferers, size_t items, int work_us, const std::vector<unsigned char>& image) {
+    PipelineOptions opts;
+    opts.decode_threads = static_cast<int>(decoders);
+    opts.batch.min_batch = 1;
+    opts.batch.max_batch = 16;
+    opts.batch.max_wait = std::chrono::microseconds(200);
+    std::atomic<size_t> done{0};
+    auto t0 = Clock::now();
+    {
+        InferencePipeline<BenchItem> p(opts, [&](std::vector<BenchItem>& b, std::vector<std::optional<InferenceResult>>&){ done += b.size(); });
+        for (size_t i=0; i<inferers; ++i) p.add_inference([work_us]{ return std::unique_ptr<IInferenceBackend>(new StubBackend(work_us)); });
+        for (size_t i=0; i<items; ++i) p.push(BenchItem{&image});
+        p.close();
+        p.join();
+    }
+    return double(done.load()) / std::chrono::duration<double>(Clock::now() - t0).count();
+}
+}
+
+int main(int argc, char** argv) {
+    size_t items = 200000;
+    size_t max_workers = std::max(1u, std::thread::hardware_concurrency());
+    int work_us = 2;
+    for (int i=1; i<argc; ++i) {
+        std::string a = argv[i];
+        if (a == "--items" && i+1 < argc) items = static_cast<size_t>(std::stoll(argv[++i]));
+        else if (a == "--max-workers" && i+1 < argc) max_workers = static_cast<size_t>(std::stoll(argv[++i]));
+        else if (a == "--work-us" && i+1 < argc) work_us = std::stoi(argv[++i]);
+    }
+    std::cout << "scheduler,mode,workers,items_per_s" << std::endl;
+    std::vector<size_t> counts;
+    for (size_t w=1; w<max_workers; w*=2) counts.push_back(w);
+    counts.push_back(max_workers);
+    for (size_t w : counts) {
+        std::cout << "queue,mutex," << w << "," << static_cast<long long>(run_mutex(w, items, work_us)) << std::endl;
+        std::cout << "queue,stealing," << w << "," << static_cast<long long>(run_stealing(w, items, work_us)) << std::endl;
+    }
+    std::vector<unsigned char> image;
+#if defined(DIP_HAS_OPENCV)
+    cv::Mat img(32, 32, CV_8UC3, cv::Scalar(90, 120, 200));
+    cv::imencode(".jpg", img, image);
+#else
+    image.assign(1, 0);
+#endif
+    size_t pipe_items = std::max<size_t>(1, items / 20);
+    for (size_t w : counts) {
+        std::cout << "pipeline,stub_backend," << w << "," << static_cast<long long>(run_pipeline(w, w, pipe_items, work_us * 10, image)) << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,336 @@
+#include <fstream>
+#include <algorithm>
+#include "common/async_file_reader.h"
+#include "common/metrics.h"
+#if defined(DIP_HAS_IO_URING)
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+
+namespace dip {
+namespace {
+// Larger buffers are freed rather than pooled, so one huge image does not pin its size forever.
+const size_t kMaxPooledBuffer = 32u << 20;
+
+uint64_t ns_between(std::chrono::steady_clock::time_point a, std::chrono::steady_clock::time_point b) {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(b - a).count());
+}
+}
+
+std::chrono::steady_clock::duration PendingRead::wait() {
+    auto t0 = std::chrono::steady_clock::now();
+    std::unique_lock<std::mutex> lk(mtx_);
+    if (done_) return {};
+    cv_.wait(lk, [&]{ return done_; });
+    return std::chrono::steady_clock::now() - t0;
+}
+
+void PendingRead::complete(bool success) {
+    {
+        std::lock_guard<std::mutex> lk(mtx_);
+        ok = success;
+        done_ = true;
+    }
+    cv_.notify_all();
+}
+
+#if defined(DIP_HAS_IO_URING)
+// A bare io_uring driven through the raw syscalls. Each read is three operations: openat and statx
+// go in together, and when both are back the completion thread submits the read (again for short
+// reads) into a buffer of the file's size. Completions carry the Op pointer with the operation in
+// its low bits; user_data 0 is the shutdown wake-up.
+struct AsyncFileReader::Ring {
+    enum Kind : uint64_t { Open = 0, Statx = 1, Read = 2 };
+    struct Op {
+        Request req;
+        int fd = -1;
+        int pending = 2;
+        bool failed = false;
+        struct statx stx;
+        size_t off = 0;
+    };
+    int fd = -1;
+    void* sq_map = MAP_FAILED; size_t sq_len = 0;
+    void* cq_map = MAP_FAILED; size_t cq_len = 0;
+    io_uring_sqe* sqes = nullptr; size_t sqes_len = 0;
+    unsigned *sq_head = nullptr, *sq_tail = nullptr, *sq_mask = nullptr, *sq_array = nullptr;
+    unsigned *cq_head = nullptr, *cq_tail = nullptr, *cq_mask = nullptr;
+    io_uring_cqe* cqes = nullptr;
+    std::mutex sq_mtx;
+    std::thread reaper;
+
+    static int enter(int fd, unsigned submit, unsigned wait, unsigned flags) {
+        return static_cast<int>(syscall(__NR_io_uring_enter, fd, submit, wait, flags, nullptr, 0));
+    }
+
+    bool init(unsigned entries) {
+        io_uring_params p;
+        std::memset(&p, 0, sizeof(p));
+        fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &p));
+        if (fd < 0) return false;
+        // Seccomp filters and old kernels leave out individual opcodes, so check the ones used.
+        std::vector<unsigned char> probe_mem(sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op), 0);
+        auto* probe = reinterpret_cast<io_uring_probe*>(probe_mem.data());
+        if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, 256) < 0) return false;
+        for (int op : {IORING_OP_OPENAT, IORING_OP_STATX, IORING_OP_READ, IORING_OP_NOP})
+            if (op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED)) return false;
+        sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+        cq_len = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+        if (p.features & IORING_FEAT_SINGLE_MMAP) sq_len = cq_len = std::max(sq_len, cq_len);
+        sq_map = mmap(nullptr, sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+        if (sq_map == MAP_FAILED) return false;
+        if (p.features & IORING_FEAT_SINGLE_MMAP) cq_map = sq_map;
+        else cq_map = mmap(nullptr, cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (cq_map == MAP_FAILED) return false;
+        sqes_len = p.sq_entries * sizeof(io_uring_sqe);
+        void* s = mmap(nullptr, sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+        if (s == MAP_FAILED) return false;
+        sqes = static_cast<io_uring_sqe*>(s);
+        auto* sq = static_cast<char*>(sq_map);
+        auto* cq = static_cast<char*>(cq_map);
+        sq_head = reinterpret_cast<unsigned*>(sq + p.sq_off.head);
+        sq_tail = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+        sq_mask = reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+        sq_array = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+        cq_head = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+        cq_tail = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+        cq_mask = reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+        cqes = reinterpret_cast<io_uring_cqe*>(cq + p.cq_off.cqes);
+        return true;
+    }
+
+    ~Ring() {
+        if (sqes) munmap(sqes, sqes_len);
+        if (cq_map != MAP_FAILED && cq_map != sq_map) munmap(cq_map, cq_len);
+        if (sq_map != MAP_FAILED) munmap(sq_map, sq_len);
+        if (fd >= 0) ::close(fd);
+    }
+
+    // Caller holds sq_mtx. The ring has room for two entries per read in flight, and entries are
+    // consumed by each submit, so it is never full here.
+    io_uring_sqe* next_sqe(uint64_t user_data) {
+        unsigned tail = *sq_tail;
+        unsigned idx = tail & *sq_mask;
+        io_uring_sqe* sqe = &sqes[idx];
+        std::memset(sqe, 0, sizeof(*sqe));
+        sqe->user_data = user_data;
+        sq_array[idx] = idx;
+        __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+        return sqe;
+    }
+    void submit(unsigned n) {
+        while (n > 0) {
+            int r = enter(fd, n, 0, 0);
+            // EAGAIN/EBUSY: the kernel is short of memory or completions; both clear up.
+            if (r < 0 && (errno == EAGAIN || errno == EBUSY)) std::this_thread::yield();
+            if (r < 0 && (errno == EINTR || errno == EAGAIN || errno == EBUSY)) continue;
+            if (r <= 0) break;
+            n -= static_cast<unsigned>(r);
+        }
+    }
+    void submit_read(Op* op) {
+        std::lock_guard<std::mutex> lk(sq_mtx);
+        auto* sqe = next_sqe(reinterpret_cast<uint64_t>(op) | Read);
+        sqe->opcode = IORING_OP_READ;
+        sqe->fd = op->fd;
+        sqe->addr = reinterpret_cast<uint64_t>(&op->req.out->buf[op->off]);
+        sqe->len = static_cast<uint32_t>(std::min<size_t>(op->req.out->buf.size() - op->off, 1u << 30));
+        sqe->off = op->off;
+        submit(1);
+    }
+};
+#else
+struct AsyncFileReader::Ring {};
+#endif
+
+AsyncFileReader::AsyncFileReader(const AsyncReadOptions& opts) : opts_(opts) {
+    opts_.depth = std::max(1, opts_.depth);
+#if defined(DIP_HAS_IO_URING)
+    if (opts_.io_uring) {
+        ring_.reset(new Ring());
+        unsigned entries = 1;
+        while (entries < static_cast<unsigned>(opts_.depth) * 2) entries <<= 1;
+        if (ring_->init(entries)) ring_->reaper = std::thread([this]{ ring_loop(); });
+        else ring_.reset();
+    }
+#endif
+    if (!ring_) for (int i=0; i<std::max(1, opts_.threads); ++i) threads_.emplace_back([this]{ thread_loop(); });
+}
+
+AsyncFileReader::~AsyncFileReader() {
+    {
+        std::unique_lock<std::mutex> lk(mtx_);
+        closing_ = true;
+        // Reads already handed out finish first; their buffers may still be waited on.
+        slot_cv_.wait(lk, [&]{ return in_flight_ == 0 || !threads_.empty(); });
+    }
+    cv_.notify_all();
+    for (auto& t : threads_) t.join();
+#if defined(DIP_HAS_IO_URING)
+    if (ring_) {
+        {
+            std::lock_guard<std::mutex> lk(ring_->sq_mtx);
+            ring_->next_sqe(0)->opcode = IORING_OP_NOP;
+            ring_->submit(1);
+        }
+        ring_->reaper.join();
+    }
+#endif
+}
+
+const char* AsyncFileReader::engine() const { return ring_ ? "io_uring" : "threads"; }
+
+AsyncReadStats AsyncFileReader::stats() const {
+    return AsyncReadStats{reads_.load(), failed_.load(), bytes_.load(), read_ns_.load(), wait_ns_.load()};
+}
+
+std::shared_ptr<PendingRead> AsyncFileReader::read(const std::string& path) {
+    auto r = std::make_shared<PendingRead>();
+    {
+        std::unique_lock<std::mutex> lk(mtx_);
+        slot_cv_.wait(lk, [&]{ return in_flight_ < opts_.depth; });
+        ++in_flight_;
+        r->submitted = std::chrono::steady_clock::now();
+        r->buf = buffer();
+        if (!ring_) {
+            queue_.push_back(Request{path, r});
+            lk.unlock();
+            cv_.notify_one();
+            return r;
+        }
+    }
+#if defined(DIP_HAS_IO_URING)
+    auto* op = new Ring::Op();
+    op->req = Request{path, r};
+    std::lock_guard<std::mutex> lk(ring_->sq_mtx);
+    auto* sqe = ring_->next_sqe(reinterpret_cast<uint64_t>(op) | Ring::Open);
+    sqe->opcode = IORING_OP_OPENAT;
+    sqe->fd = AT_FDCWD;
+    sqe->addr = reinterpret_cast<uint64_t>(op->req.path.c_str());
+    sqe->open_flags = O_RDONLY | O_CLOEXEC;
+    sqe = ring_->next_sqe(reinterpret_cast<uint64_t>(op) | Ring::Statx);
+    sqe->opcode = IORING_OP_STATX;
+    sqe->fd = AT_FDCWD;
+    sqe->addr = reinterpret_cast<uint64_t>(op->req.path.c_str());
+    sqe->len = STATX_SIZE;
+    sqe->off = reinterpret_cast<uint64_t>(&op->stx);
+    ring_->submit(2);
+#endif
+    return r;
+}
+
+void AsyncFileReader::wait_for(PendingRead& r) {
+    auto d = r.wait();
+    wait_ns_ += static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(d).count());
+    record_stage(Stage::FileReadWait, d);
+}
+
+std::string AsyncFileReader::buffer() {
+    std::lock_guard<std::mutex> lk(pool_mtx_);
+    if (pool_.empty()) return std::string();
+    std::string b = std::move(pool_.back());
+    pool_.pop_back();
+    return b;
+}
+
+void AsyncFileReader::recycle(std::string&& buf) {
+    if (buf.capacity() == 0 || buf.capacity() > kMaxPooledBuffer) { std::string().swap(buf); return; }
+    buf.clear();
+    std::lock_guard<std::mutex> lk(pool_mtx_);
+    if (pool_.size() < opts_.pool_buffers) pool_.push_back(std::move(buf));
+    else std::string().swap(buf);
+}
+
+void AsyncFileReader::finish(const std::shared_ptr<PendingRead>& r, bool ok) {
+    r->completed = std::chrono::steady_clock::now();
+    if (!ok) { r->buf.clear(); failed_++; }
+    reads_++;
+    bytes_ += r->buf.size();
+    read_ns_ += ns_between(r->submitted, r->completed);
+    record_stage(Stage::FileRead, r->completed - r->submitted);
+    r->complete(ok);
+    {
+        std::lock_guard<std::mutex> lk(mtx_);
+        --in_flight_;
+    }
+    slot_cv_.notify_all();
+}
+
+void AsyncFileReader::thread_loop() {
+    while (true) {
+        Request req;
+        {
+            std::unique_lock<std::mutex> lk(mtx_);
+            cv_.wait(lk, [&]{ return !queue_.empty() || closing_; });
+            if (queue_.empty()) return;
+            req = std::move(queue_.front());
+            queue_.pop_front();
+        }
+        auto& buf = req.out->buf;
+        std::ifstream f(req.path, std::ios::binary);
+        bool ok = f.good();
+        if (ok) {
+            f.seekg(0, std::ios::end);
+            std::streampos szpos = f.tellg();
+            size_t sz = szpos > 0 ? static_cast<size_t>(szpos) : 0;
+            f.seekg(0, std::ios::beg);
+            buf.resize(sz);
+            if (sz > 0) { f.read(&buf[0], static_cast<std::streamsize>(sz)); buf.resize(static_cast<size_t>(f.gcount())); }
+        }
+        finish(req.out, ok);
+    }
+}
+
+void AsyncFileReader::ring_loop() {
+#if defined(DIP_HAS_IO_URING)
+    Ring& ring = *ring_;
+    while (true) {
+        int r = Ring::enter(ring.fd, 0, 1, IORING_ENTER_GETEVENTS);
+        if (r < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) return;
+        unsigned head = *ring.cq_head;
+        unsigned tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+        bool quit = false;
+        for (; head != tail; ++head) {
+            io_uring_cqe cqe = ring.cqes[head & *ring.cq_mask];
+            if (cqe.user_data == 0) { quit = true; continue; }
+            auto* op = reinterpret_cast<Ring::Op*>(cqe.user_data & ~uint64_t(3));
+            auto kind = static_cast<Ring::Kind>(cqe.user_data & 3);
+            auto& buf = op->req.out->buf;
+            bool done = false, ok = false;
+            if (kind == Ring::Open || kind == Ring::Statx) {
+                if (kind == Ring::Open) op->fd = cqe.res;
+                if (cqe.res < 0) op->failed = true;
+                if (--op->pending > 0) continue;
+                if (op->failed) { done = true; }
+                else {
+                    buf.resize(static_cast<size_t>(op->stx.stx_size));
+                    if (buf.empty()) { done = true; ok = true; }
+                    else ring.submit_read(op);
+                }
+            } else if (cqe.res == -EINTR || cqe.res == -EAGAIN) {
+                ring.submit_read(op);
+            } else if (cqe.res < 0) {
+                done = true;
+            } else {
+                op->off += static_cast<size_t>(cqe.res);
+                // A zero-length read means the file shrank since statx; keep what was read.
+                if (cqe.res == 0 || op->off >= buf.size()) { buf.resize(op->off); done = true; ok = true; }
+                else ring.submit_read(op);
+            }
+            if (!done) continue;
+            if (op->fd >= 0) ::close(op->fd);
+            finish(op->req.out, ok);
+            delete op;
+        }
+        __atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+        if (quit) return;
+    }
+#endif
+}
+}
@@ -0,0 +1,93 @@
+#include <fstream>
+#include <sstream>
+#include <cctype>
+#include "common/config.h"
+
+namespace dip {
+static void skip_ws(const std::string& s, size_t& i) { while (i < s.size() && std::isspace(static_cast<unsigned char>(s[i]))) ++i; }
+
+static bool read_string(const std::string& s, size_t& i, std::string& out) {
+    if (i >= s.size() || s[i] != '"') return false;
+    ++i; out.clear();
+    while (i < s.size() && s[i] != '"') {
+        if (s[i] == '\\' && i + 1 < s.size()) { ++i; char c = s[i]; out.push_back(c == 'n' ? '\n' : c == 't' ? '\t' : c); }
+        else out.push_back(s[i]);
+        ++i;
+    }
+    if (i >= s.size()) return false;
+    ++i; return true;
+}
+
+static bool read_value(const std::string& s, size_t& i, std::string& out) {
+    if (i >= s.size()) return false;
+    if (s[i] == '"') return read_string(s, i, out);
+    size_t start = i;
+    if (s[i] == '[' || s[i] == '{') {
+        int depth = 0; bool in_str = false;
+        for (; i < s.size(); ++i) {
+            char c = s[i];
+            if (in_str) { if (c == '\\') ++i; else if (c == '"') in_str = false; continue; }
+            if (c == '"') in_str = true;
+            else if (c == '[' || c == '{') ++depth;
+            else if ((c == ']' || c == '}') && --depth == 0) { ++i; break; }
+        }
+    } else {
+        while (i < s.size() && s[i] != ',' && s[i] != '}' && !std::isspace(static_cast<unsigned char>(s[i]))) ++i;
+    }
+    out = s.substr(start, i - start);
+    return true;
+}
+
+bool Config::load(const std::string& path) {
+    std::ifstream f(path, std::ios::binary);
+    if (!f.good()) return false;
+    std::stringstream ss; ss << f.rdbuf();
+    std::string s = ss.str();
+    size_t i = 0;
+    skip_ws(s, i);
+    if (i >= s.size() || s[i] != '{') return false;
+    ++i;
+    while (true) {
+        skip_ws(s, i);
+        if (i < s.size() && s[i] == '}') return true;
+        std::string key, value;
+        if (!read_string(s, i, key)) return false;
+        skip_ws(s, i);
+        if (i >= s.size() || s[i] != ':') return false;
+        ++i; skip_ws(s, i);
+        if (!read_value(s, i, value)) return false;
+        values_[key] = value;
+        skip_ws(s, i);
+        if (i < s.size() && s[i] == ',') ++i;
+        else if (i < s.size() && s[i] == '}') return true;
+        else return false;
+    }
+}
+
+bool Config::has(const std::string& key) const { return values_.count(key) != 0; }
+
+std::string Config::get_string(const std::string& key, const std::string& def) const {
+    auto it = values_.find(key);
+    return it == values_.end() ? def : it->second;
+}
+
+long long Config::get_int(const std::string& key, long long def) const {
+    auto it = values_.find(key);
+    if (it == values_.end()) return def;
+    try { return std::stoll(it->second); } catch (...) { return def; }
+}
+
+double Config::get_double(const std::string& key, double def) const {
+    auto it = values_.find(key);
+    if (it == values_.end()) return def;
+    try { return std::stod(it->second); } catch (...) { return def; }
+}
+
+bool Config::get_bool(const std::string& key, bool def) const {
+    auto it = values_.find(key);
+    if (it == values_.end()) return def;
+    if (it->second == "true") return true;
+    if (it->second == "false") return false;
+    return def;
+}
+}
@@ -1,3 +1,4 @@
+#include <charconv>
 #include "common/csv_writer.h"
 
 namespace dip {
@@ -5,16 +6,20 @@ CsvWriter::CsvWriter(const std::string& path) : out_(path, std::ios::binary) {}
 bool CsvWriter::good() const { return out_.good(); }
 
 std::string CsvWriter::escape(const std::string& s) {
-    bool need_quotes = false;
-    for (char c : s) { if (c == ',' || c == '"' || c == '\n' || c=='\r') { need_quotes = true; break; } }
-    if (!need_quotes && !s.empty()) return s;
-    std::string t; t.reserve(s.size()+2);
-    t.push_back('"');
-    for (char c : s) { if (c == '"') t.push_back('"'), t.push_back('"'); else t.push_back(c); }
-    t.push_back('"');
+    std::string t;
+    append_escaped(t, s);
     return t;
 }
 
+void CsvWriter::append_escaped(std::string& out, std::string_view s) {
+    bool need_quotes = s.empty();
+    for (char c : s) { if (c == ',' || c == '"' || c == '\n' || c=='\r') { need_quotes = true; break; } }
+    if (!need_quotes) { out.append(s.data(), s.size()); return; }
+    out.push_back('"');
+    for (char c : s) { if (c == '"') out.push_back('"'), out.push_back('"'); else out.push_back(c); }
+    out.push_back('"');
+}
+
 void CsvWriter::write_header(const std::vector<std::string>& cols) {
     bool first = true;
     for (auto& c : cols) { if (!first) out_ << ","; first = false; out_ << escape(c); }
@@ -26,5 +31,26 @@ void CsvWriter::write_row(const std::vector<std::string>& cols) {
     for (auto& c : cols) { if (!first) out_ << ","; first = false; out_ << escape(c); }
     out_ << "\n";
 }
+
+void CsvWriter::write_embedding_row(std::string_view label, std::string_view path, const float* v, size_t n, size_t dim) {
+    line_.clear();
+    append_escaped(line_, label);
+    line_.push_back(',');
+    append_escaped(line_, path);
+    // "-" + up to 39 integer digits + "." + 6 decimals fits any finite float.
+    const size_t kCell = 56;
+    size_t pos = line_.size();
+    line_.resize(pos + dim * kCell + 1);
+    char* p = &line_[pos];
+    for (size_t i=0; i<dim; ++i) {
+        *p++ = ',';
+        float x = i < n ? v[i] : 0.0f;
+        p = std::to_chars(p, p + kCell - 1, x, std::chars_format::fixed, 6).ptr;
+    }
+    *p++ = '\n';
+    line_.resize(static_cast<size_t>(p - line_.data()));
+    out_.write(line_.data(), static_cast<std::streamsize>(line_.size()));
 }
 
+void CsvWriter::flush() { out_.flush(); }
+}
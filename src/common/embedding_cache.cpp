@@ -0,0 +1,93 @@
+#include <cstring>
+#include <filesystem>
+#include <algorithm>
+#include "common/embedding_cache.h"
+#include "common/hash.h"
+
+namespace fs = std::filesystem;
+
+namespace dip {
+namespace {
+const char kMagic[8] = {'D','I','P','E','M','B','C','1'};
+}
+
+ContentKey content_key(const unsigned char* data, size_t size) { return ContentKey{hash64(data, size), size}; }
+
+uint64_t file_fingerprint(const std::string& path) {
+    MappedFile f;
+    if (!f.open(path) || f.size() == 0) return 0;
+    return hash64(f.data(), f.size(), f.size());
+}
+
+// Header: magic[8], u64 model fingerprint, u32 dim, u32 reserved. Record: u64 hash, u64 size, f32[dim].
+bool EmbeddingCache::open(const std::string& path, uint64_t model_fingerprint, size_t dim) {
+    dim_ = dim;
+    index_.clear();
+    map_.close();
+    std::error_code ec;
+    if (fs::path(path).has_parent_path()) fs::create_directories(fs::path(path).parent_path(), ec);
+    size_t valid = 0;
+    if (map_.open(path) && map_.size() >= kHeaderSize) {
+        const unsigned char* p = map_.data();
+        uint64_t fp; uint32_t d;
+        std::memcpy(&fp, p + 8, 8);
+        std::memcpy(&d, p + 16, 4);
+        if (std::memcmp(p, kMagic, 8) == 0 && fp == model_fingerprint && d == dim) {
+            size_t n = (map_.size() - kHeaderSize) / record_size();
+            index_.reserve(n);
+            for (size_t i=0; i<n; ++i) {
+                size_t off = kHeaderSize + i * record_size();
+                ContentKey k;
+                std::memcpy(&k.hash, p + off, 8);
+                std::memcpy(&k.size, p + off + 8, 8);
+                index_[k] = off + 16;
+            }
+            valid = kHeaderSize + n * record_size();
+        }
+    }
+    if (valid == 0) {
+        map_.close();
+        out_.open(path, std::ios::binary | std::ios::trunc);
+        if (!out_) return false;
+        uint32_t d = static_cast<uint32_t>(dim), reserved = 0;
+        out_.write(kMagic, 8);
+        out_.write(reinterpret_cast<const char*>(&model_fingerprint), 8);
+        out_.write(reinterpret_cast<const char*>(&d), 4);
+        out_.write(reinterpret_cast<const char*>(&reserved), 4);
+        out_.flush();
+        return out_.good();
+    }
+    // Drop a partial record left by an interrupted run before appending; offsets stay valid.
+    if (valid < map_.size()) {
+        map_.close();
+        fs::resize_file(path, valid, ec);
+        if (ec || !map_.open(path)) { index_.clear(); map_.close(); }
+    }
+    out_.open(path, std::ios::binary | std::ios::app);
+    return out_.good();
+}
+
+bool EmbeddingCache::lookup(const ContentKey& key, std::vector<float>& out) const {
+    auto it = index_.find(key);
+    if (it == index_.end()) return false;
+    out.resize(dim_);
+    std::memcpy(out.data(), map_.data() + it->second, dim_ * sizeof(float));
+    return true;
+}
+
+void EmbeddingCache::insert(const ContentKey& key, const float* v, size_t n) {
+    std::lock_guard<std::mutex> lk(mtx_);
+    if (!out_.is_open()) return;
+    size_t k = std::min(n, dim_);
+    out_.write(reinterpret_cast<const char*>(&key.hash), 8);
+    out_.write(reinterpret_cast<const char*>(&key.size), 8);
+    out_.write(reinterpret_cast<const char*>(v), static_cast<std::streamsize>(k * sizeof(float)));
+    if (k < dim_) {
+        pad_.assign(dim_ - k, 0.0f);
+        out_.write(reinterpret_cast<const char*>(pad_.data()), static_cast<std::streamsize>(pad_.size() * sizeof(float)));
+    }
+    inserted_++;
+}
+
+void EmbeddingCache::flush() { std::lock_guard<std::mutex> lk(mtx_); out_.flush(); }
+}
@@ -0,0 +1,278 @@
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <algorithm>
+#include <limits>
+#include <charconv>
+#include "common/embedding_codec.h"
+#include "common/npy_writer.h"
+#include "common/float16.h"
+#include "common/hash.h"
+
+namespace dip {
+const char* embedding_encoding_name(EmbeddingEncoding e) {
+    switch (e) {
+    case EmbeddingEncoding::F16: return "f16";
+    case EmbeddingEncoding::I8: return "i8";
+    case EmbeddingEncoding::PQ: return "pq";
+    default: return "f32";
+    }
+}
+
+bool parse_embedding_encoding(std::string_view name, EmbeddingEncoding& out) {
+    if (name == "f32") out = EmbeddingEncoding::F32;
+    else if (name == "f16") out = EmbeddingEncoding::F16;
+    else if (name == "i8") out = EmbeddingEncoding::I8;
+    else if (name == "pq") out = EmbeddingEncoding::PQ;
+    else return false;
+    return true;
+}
+
+float encode_i8(const float* v, size_t n, int8_t* q) {
+    float amax = 0;
+    for (size_t i=0; i<n; ++i) amax = std::max(amax, std::fabs(v[i]));
+    if (!(amax > 0) || !std::isfinite(amax)) { std::memset(q, 0, n); return 0; }
+    float scale = amax / 127.0f, inv = 127.0f / amax;
+    for (size_t i=0; i<n; ++i) q[i] = static_cast<int8_t>(std::lrint(std::min(127.0f, std::max(-127.0f, v[i] * inv))));
+    return scale;
+}
+
+void decode_i8(const int8_t* q, size_t n, float scale, float* out) {
+    for (size_t i=0; i<n; ++i) out[i] = float(q[i]) * scale;
+}
+
+namespace {
+float dist2(const float* a, const float* b, size_t n) {
+    float d = 0;
+    for (size_t i=0; i<n; ++i) { float t = a[i] - b[i]; d += t * t; }
+    return d;
+}
+}
+
+size_t ProductQuantizer::nearest(size_t s, const float* x) const {
+    const float* c = centroids_.data() + s * kCentroids * sub_;
+    size_t best = 0;
+    float best_d = std::numeric_limits<float>::max();
+    for (size_t k=0; k<kCentroids; ++k, c += sub_) {
+        float d = dist2(x, c, sub_);
+        if (d < best_d) { best_d = d; best = k; }
+    }
+    return best;
+}
+
+void ProductQuantizer::finish() {
+    uint32_t head[3] = {uint32_t(dim_), uint32_t(m_), uint32_t(kCentroids)};
+    fingerprint_ = hash64(centroids_.data(), centroids_.size() * sizeof(float), hash64(head, sizeof(head)));
+}
+
+// Lloyd's k-means per subspace, seeded with evenly spaced training rows. A centroid that loses all
+// its points is reseeded from the point currently worst served, so no code is wasted.
+bool ProductQuantizer::train(const float* data, size_t rows, size_t dim, size_t m, int iterations, size_t max_rows) {
+    if (m == 0 || dim % m != 0 || rows < kCentroids) return false;
+    size_t n = std::min(rows, std::max(max_rows, kCentroids));
+    dim_ = dim; m_ = m; sub_ = dim / m;
+    centroids_.assign(m_ * kCentroids * sub_, 0.0f);
+    std::vector<float> x(n * sub_), sums(kCentroids * sub_);
+    std::vector<uint32_t> assign(n);
+    std::vector<size_t> counts(kCentroids);
+    std::vector<float> err(n);
+    for (size_t s=0; s<m_; ++s) {
+        for (size_t i=0; i<n; ++i) std::memcpy(&x[i * sub_], data + (i * rows / n) * dim + s * sub_, sub_ * sizeof(float));
+        float* c = centroids_.data() + s * kCentroids * sub_;
+        for (size_t k=0; k<kCentroids; ++k) std::memcpy(c + k * sub_, &x[(k * n / kCentroids) * sub_], sub_ * sizeof(float));
+        for (int it=0; it<iterations; ++it) {
+            std::fill(sums.begin(), sums.end(), 0.0f);
+            std::fill(counts.begin(), counts.end(), 0);
+            bool moved = false;
+            for (size_t i=0; i<n; ++i) {
+                const float* xi = &x[i * sub_];
+                uint32_t k = static_cast<uint32_t>(nearest(s, xi));
+                moved |= it == 0 || assign[i] != k;
+                assign[i] = k;
+                err[i] = dist2(xi, c + k * sub_, sub_);
+                counts[k]++;
+                for (size_t j=0; j<sub_; ++j) sums[k * sub_ + j] += xi[j];
+            }
+            if (!moved) break;
+            for (size_t k=0; k<kCentroids; ++k) {
+                if (counts[k]) { for (size_t j=0; j<sub_; ++j) c[k * sub_ + j] = sums[k * sub_ + j] / float(counts[k]); continue; }
+                size_t worst = size_t(std::max_element(err.begin(), err.end()) - err.begin());
+                std::memcpy(c + k * sub_, &x[worst * sub_], sub_ * sizeof(float));
+                err[worst] = 0;
+            }
+        }
+    }
+    finish();
+    return true;
+}
+
+void ProductQuantizer::encode(const float* v, uint8_t* codes) const {
+    for (size_t s=0; s<m_; ++s) codes[s] = static_cast<uint8_t>(nearest(s, v + s * sub_));
+}
+
+void ProductQuantizer::decode(const uint8_t* codes, float* out) const {
+    for (size_t s=0; s<m_; ++s) std::memcpy(out + s * sub_, centroids_.data() + (s * kCentroids + codes[s]) * sub_, sub_ * sizeof(float));
+}
+
+static const char kPqMagic[8] = {'D', 'I', 'P', 'P', 'Q', '1', 0, 0};
+
+bool ProductQuantizer::save(const std::string& path) const {
+    if (empty()) return false;
+    std::ofstream f(path, std::ios::binary | std::ios::trunc);
+    uint32_t head[3] = {uint32_t(dim_), uint32_t(m_), uint32_t(kCentroids)};
+    f.write(kPqMagic, sizeof(kPqMagic));
+    f.write(reinterpret_cast<const char*>(head), sizeof(head));
+    f.write(reinterpret_cast<const char*>(centroids_.data()), static_cast<std::streamsize>(centroids_.size() * sizeof(float)));
+    return f.good();
+}
+
+bool ProductQuantizer::load(const std::string& path) {
+    std::ifstream f(path, std::ios::binary);
+    char magic[8];
+    uint32_t head[3];
+    if (!f.read(magic, sizeof(magic)) || std::memcmp(magic, kPqMagic, sizeof(magic)) != 0) return false;
+    if (!f.read(reinterpret_cast<char*>(head), sizeof(head))) return false;
+    if (head[1] == 0 || head[0] % head[1] != 0 || head[2] != kCentroids) return false;
+    std::vector<float> c(size_t(head[0]) * kCentroids);
+    if (!f.read(reinterpret_cast<char*>(c.data()), static_cast<std::streamsize>(c.size() * sizeof(float)))) return false;
+    dim_ = head[0]; m_ = head[1]; sub_ = dim_ / m_;
+    centroids_.swap(c);
+    finish();
+    return true;
+}
+
+namespace {
+// Splits one CSV line as written by CsvWriter (fields quoted when they contain , " or newlines;
+// embedded newlines are not supported here).
+void split_csv(const std::string& line, std::vector<std::string>& cols) {
+    cols.clear();
+    std::string cur;
+    bool quoted = false;
+    for (size_t i=0; i<line.size(); ++i) {
+        char c = line[i];
+        if (quoted) {
+            if (c != '"') cur.push_back(c);
+            else if (i + 1 < line.size() && line[i+1] == '"') { cur.push_back('"'); ++i; }
+            else quoted = false;
+        } else if (c == '"') quoted = true;
+        else if (c == ',') { cols.push_back(std::move(cur)); cur.clear(); }
+        else if (c != '\r') cur.push_back(c);
+    }
+    cols.push_back(std::move(cur));
+}
+
+// embeddings.csv: label,path,e0..e{dim-1}.
+bool load_csv(const std::string& path, LabeledEmbeddings& out) {
+    std::ifstream f(path, std::ios::binary);
+    std::string line;
+    std::vector<std::string> cols;
+    if (!std::getline(f, line)) return false;
+    split_csv(line, cols);
+    if (cols.size() < 3 || cols[0] != "label") return false;
+    out.dim = cols.size() - 2;
+    while (std::getline(f, line)) {
+        if (line.empty()) continue;
+        split_csv(line, cols);
+        if (cols.size() != out.dim + 2) return false;
+        out.labels.push_back(cols[0]);
+        out.paths.push_back(cols[1]);
+        for (size_t i=0; i<out.dim; ++i) {
+            float v = 0;
+            auto& s = cols[i + 2];
+            std::from_chars(s.data(), s.data() + s.size(), v);
+            out.data.push_back(v);
+        }
+    }
+    return true;
+}
+}
+
+bool load_labeled_embeddings(const std::string& path, const ProductQuantizer* pq, LabeledEmbeddings& out) {
+    out = LabeledEmbeddings{};
+    if (path.size() < 4 || path.compare(path.size() - 4, 4, ".npy") != 0) return load_csv(path, out);
+    size_t rows = 0;
+    if (!read_npy_embeddings(path, pq, out.data, rows, out.dim)) return false;
+    // The index sits next to the .npy: embeddings.npy -> embeddings.index.csv.
+    std::ifstream f(path.substr(0, path.size() - 4) + ".index.csv", std::ios::binary);
+    std::string line;
+    std::vector<std::string> cols;
+    std::getline(f, line);
+    out.labels.assign(rows, std::string());
+    out.paths.assign(rows, std::string());
+    while (std::getline(f, line)) {
+        split_csv(line, cols);
+        size_t row = 0;
+        if (cols.size() < 3 || std::from_chars(cols[0].data(), cols[0].data() + cols[0].size(), row).ec != std::errc() || row >= rows) continue;
+        out.labels[row] = cols[1];
+        out.paths[row] = cols[2];
+    }
+    return true;
+}
+
+namespace {
+void round_trip(const float* v, size_t dim, EmbeddingEncoding e, const ProductQuantizer* pq, float* out) {
+    if (e == EmbeddingEncoding::F16) {
+        for (size_t i=0; i<dim; ++i) out[i] = half_to_float(float_to_half(v[i]));
+    } else if (e == EmbeddingEncoding::I8) {
+        std::vector<int8_t> q(dim);
+        decode_i8(q.data(), dim, encode_i8(v, dim, q.data()), out);
+    } else if (e == EmbeddingEncoding::PQ) {
+        std::vector<uint8_t> codes(pq->m());
+        pq->encode(v, codes.data());
+        pq->decode(codes.data(), out);
+    } else {
+        std::memcpy(out, v, dim * sizeof(float));
+    }
+}
+
+float dot(const float* a, const float* b, size_t n) {
+    float d = 0;
+    for (size_t i=0; i<n; ++i) d += a[i] * b[i];
+    return d;
+}
+
+// Indices of the k rows with the highest inner product with `q`, best first, excluding `self`.
+void top_k(const std::vector<float>& db, size_t rows, size_t dim, const float* q, size_t self, size_t k, std::vector<std::pair<float, size_t>>& out) {
+    out.clear();
+    for (size_t r=0; r<rows; ++r) if (r != self) out.emplace_back(dot(q, db.data() + r * dim, dim), r);
+    k = std::min(k, out.size());
+    std::partial_sort(out.begin(), out.begin() + static_cast<std::ptrdiff_t>(k), out.end(), [](auto& a, auto& b){ return a.first > b.first; });
+    out.resize(k);
+}
+}
+
+EncodingReport evaluate_encoding(const LabeledEmbeddings& set, EmbeddingEncoding e, const ProductQuantizer* pq, size_t queries) {
+    EncodingReport r;
+    r.encoding = e;
+    size_t dim = set.dim, rows = set.rows();
+    if (e == EmbeddingEncoding::PQ && (!pq || pq->dim() != dim)) return r;
+    r.bytes_per_embedding = e == EmbeddingEncoding::F32 ? dim * 4 : e == EmbeddingEncoding::F16 ? dim * 2 : e == EmbeddingEncoding::I8 ? dim + 4 : pq->m();
+    if (rows < 2) return r;
+    std::vector<float> dec(set.data.size());
+    double cos_sum = 0;
+    for (size_t i=0; i<rows; ++i) {
+        const float* v = set.data.data() + i * dim;
+        float* d = dec.data() + i * dim;
+        round_trip(v, dim, e, pq, d);
+        double n = std::sqrt(double(dot(v, v, dim)) * dot(d, d, dim));
+        cos_sum += n > 0 ? dot(v, d, dim) / n : 0.0;
+    }
+    r.cos_mean = cos_sum / double(rows);
+    queries = std::max<size_t>(1, std::min(queries, rows));
+    size_t hits = 0, wanted = 0, same = 0;
+    std::vector<std::pair<float, size_t>> exact, approx;
+    for (size_t qi=0; qi<queries; ++qi) {
+        size_t q = qi * rows / queries;
+        // Queries stay float32, as they would at search time; only the stored rows are encoded.
+        const float* v = set.data.data() + q * dim;
+        top_k(set.data, rows, dim, v, q, 10, exact);
+        top_k(dec, rows, dim, v, q, 10, approx);
+        for (auto& a : approx) for (auto& x : exact) if (a.second == x.second) { hits++; break; }
+        wanted += exact.size();
+        if (!approx.empty() && set.labels[approx[0].second] == set.labels[q]) same++;
+    }
+    r.recall_at_10 = wanted ? double(hits) / double(wanted) : 0;
+    r.label_nn = double(same) / double(queries);
+    return r;
+}
+}
@@ -0,0 +1,43 @@
+#include <cstring>
+#include "common/hash.h"
+
+namespace dip {
+namespace {
+const uint64_t P1 = 11400714785074694791ULL;
+const uint64_t P2 = 14029467366897019727ULL;
+const uint64_t P3 = 1609587929392839161ULL;
+const uint64_t P4 = 9650029242287828579ULL;
+const uint64_t P5 = 2870177450012600261ULL;
+
+inline uint64_t rotl(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+inline uint64_t read64(const unsigned char* p) { uint64_t v; std::memcpy(&v, p, 8); return v; }
+inline uint32_t read32(const unsigned char* p) { uint32_t v; std::memcpy(&v, p, 4); return v; }
+inline uint64_t round64(uint64_t acc, uint64_t input) { acc += input * P2; acc = rotl(acc, 31); return acc * P1; }
+inline uint64_t merge64(uint64_t acc, uint64_t val) { acc ^= round64(0, val); return acc * P1 + P4; }
+}
+
+uint64_t hash64(const void* data, size_t size, uint64_t seed) {
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    const unsigned char* end = p + size;
+    uint64_t h;
+    if (size >= 32) {
+        uint64_t v1 = seed + P1 + P2, v2 = seed + P2, v3 = seed, v4 = seed - P1;
+        const unsigned char* limit = end - 32;
+        do {
+            v1 = round64(v1, read64(p)); v2 = round64(v2, read64(p + 8));
+            v3 = round64(v3, read64(p + 16)); v4 = round64(v4, read64(p + 24));
+            p += 32;
+        } while (p <= limit);
+        h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+        h = merge64(h, v1); h = merge64(h, v2); h = merge64(h, v3); h = merge64(h, v4);
+    } else {
+        h = seed + P5;
+    }
+    h += static_cast<uint64_t>(size);
+    for (; p + 8 <= end; p += 8) { h ^= round64(0, read64(p)); h = rotl(h, 27) * P1 + P4; }
+    if (p + 4 <= end) { h ^= static_cast<uint64_t>(read32(p)) * P1; h = rotl(h, 23) * P2 + P3; p += 4; }
+    for (; p < end; ++p) { h ^= static_cast<uint64_t>(*p) * P5; h = rotl(h, 11) * P1; }
+    h ^= h >> 33; h *= P2; h ^= h >> 29; h *= P3; h ^= h >> 32;
+    return h;
+}
+}
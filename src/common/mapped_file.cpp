@@ -0,0 +1,65 @@
+#include <utility>
+#include <filesystem>
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#include "common/mapped_file.h"
+
+namespace dip {
+MappedFile::~MappedFile() { close(); }
+MappedFile::MappedFile(MappedFile&& o) noexcept : data_(std::exchange(o.data_, nullptr)), size_(std::exchange(o.size_, 0)) {}
+MappedFile& MappedFile::operator=(MappedFile&& o) noexcept {
+    if (this != &o) { close(); data_ = std::exchange(o.data_, nullptr); size_ = std::exchange(o.size_, 0); }
+    return *this;
+}
+
+bool MappedFile::open(const std::string& path) {
+    close();
+#if defined(_WIN32)
+    std::wstring wpath = std::filesystem::path(path).wstring();
+    HANDLE f = CreateFileW(wpath.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (f == INVALID_HANDLE_VALUE) return false;
+    LARGE_INTEGER sz;
+    if (!GetFileSizeEx(f, &sz)) { CloseHandle(f); return false; }
+    if (sz.QuadPart == 0) { CloseHandle(f); return true; }
+    HANDLE m = CreateFileMappingW(f, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    CloseHandle(f);
+    if (!m) return false;
+    void* p = MapViewOfFile(m, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(m);
+    if (!p) return false;
+    data_ = static_cast<const unsigned char*>(p);
+    size_ = static_cast<size_t>(sz.QuadPart);
+#else
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0) { ::close(fd); return false; }
+    if (st.st_size == 0) { ::close(fd); return true; }
+    void* p = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED) return false;
+    madvise(p, static_cast<size_t>(st.st_size), MADV_SEQUENTIAL);
+    data_ = static_cast<const unsigned char*>(p);
+    size_ = static_cast<size_t>(st.st_size);
+#endif
+    return true;
+}
+
+void MappedFile::close() {
+    if (!data_) { size_ = 0; return; }
+#if defined(_WIN32)
+    UnmapViewOfFile(data_);
+#else
+    munmap(const_cast<unsigned char*>(data_), size_);
+#endif
+    data_ = nullptr;
+    size_ = 0;
+}
+}
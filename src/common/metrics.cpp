@@ -0,0 +1,192 @@
+#include <string>
+#include <vector>
+#include <mutex>
+#include <map>
+#include <algorithm>
+#include <limits>
+#include <cstdio>
+#include <fstream>
+#include <filesystem>
+#include "common/metrics.h"
+
+namespace dip {
+namespace {
+LatencyHistogram g_stages[static_cast<int>(Stage::Count)];
+std::atomic<uint64_t> g_counters[static_cast<int>(Counter::Count)] = {};
+std::mutex g_collectors_mtx;
+std::map<int, MetricsCollector> g_collectors;
+int g_next_collector = 1;
+
+std::vector<MetricSample> collect() {
+    std::vector<MetricSample> out;
+    std::lock_guard<std::mutex> lk(g_collectors_mtx);
+    for (auto& [id, c] : g_collectors) c(out);
+    return out;
+}
+void append_number(std::string& out, double v) {
+    char buf[32];
+    if (v == std::numeric_limits<double>::infinity()) { out += "+Inf"; return; }
+    std::snprintf(buf, sizeof(buf), "%.9g", v);
+    out += buf;
+}
+void append_json_string(std::string& out, const std::string& s) {
+    out += '"';
+    for (char c : s) {
+        if (c == '"' || c == '\\') { out += '\\'; out += c; }
+        else if (static_cast<unsigned char>(c) < 0x20) { char buf[8]; std::snprintf(buf, sizeof(buf), "\\u%04x", c); out += buf; }
+        else out += c;
+    }
+    out += '"';
+}
+}
+
+const char* stage_name(Stage s) {
+    switch (s) {
+    case Stage::FileRead: return "file_read";
+    case Stage::FileReadWait: return "file_read_wait";
+    case Stage::Decode: return "decode";
+    case Stage::Preprocess: return "preprocess";
+    case Stage::SessionRun: return "session_run";
+    case Stage::Serialize: return "serialize";
+    case Stage::Deserialize: return "deserialize";
+    case Stage::NetSend: return "net_send";
+    case Stage::NetRecv: return "net_recv";
+    case Stage::DecodeQueueWait: return "decode_queue_wait";
+    case Stage::InferQueueWait: return "infer_queue_wait";
+    case Stage::DispatchQueueWait: return "dispatch_queue_wait";
+    case Stage::CsvWrite: return "csv_write";
+    default: return "unknown";
+    }
+}
+const char* counter_name(Counter c) {
+    switch (c) {
+    case Counter::BytesSent: return "net_sent_bytes";
+    case Counter::BytesReceived: return "net_received_bytes";
+    default: return "unknown";
+    }
+}
+
+double LatencyHistogram::bucket_le(int i) {
+    if (i >= kBuckets - 1) return std::numeric_limits<double>::infinity();
+    return double(uint64_t(1) << i) * 1e-6;
+}
+LatencyHistogram::Snapshot LatencyHistogram::snapshot() const {
+    Snapshot s;
+    for (int i=0; i<kBuckets; ++i) { s.counts[i] = counts_[i].load(std::memory_order_relaxed); s.count += s.counts[i]; }
+    s.sum_ns = sum_ns_.load(std::memory_order_relaxed);
+    return s;
+}
+double LatencyHistogram::Snapshot::quantile(double q) const {
+    if (count == 0) return 0;
+    double rank = q * double(count);
+    uint64_t seen = 0;
+    for (int i=0; i<kBuckets; ++i) {
+        if (counts[i] == 0) continue;
+        if (double(seen + counts[i]) >= rank) {
+            double lo = i == 0 ? 0.0 : bucket_le(i - 1);
+            double hi = i == kBuckets - 1 ? lo * 2 : bucket_le(i);
+            return lo + (hi - lo) * (rank - double(seen)) / double(counts[i]);
+        }
+        seen += counts[i];
+    }
+    return bucket_le(kBuckets - 2);
+}
+
+LatencyHistogram& stage_histogram(Stage s) { return g_stages[static_cast<int>(s)]; }
+void add_counter(Counter c, uint64_t n) { g_counters[static_cast<int>(c)].fetch_add(n, std::memory_order_relaxed); }
+
+int add_metrics_collector(MetricsCollector c) {
+    std::lock_guard<std::mutex> lk(g_collectors_mtx);
+    int id = g_next_collector++;
+    g_collectors[id] = std::move(c);
+    return id;
+}
+void remove_metrics_collector(int id) {
+    std::lock_guard<std::mutex> lk(g_collectors_mtx);
+    g_collectors.erase(id);
+}
+
+std::string metrics_prometheus() {
+    std::string out;
+    out += "# HELP dip_stage_seconds Time spent per pipeline stage.\n# TYPE dip_stage_seconds histogram\n";
+    for (int s=0; s<static_cast<int>(Stage::Count); ++s) {
+        auto snap = g_stages[s].snapshot();
+        std::string label = std::string("stage=\"") + stage_name(static_cast<Stage>(s)) + "\"";
+        uint64_t cum = 0;
+        for (int i=0; i<LatencyHistogram::kBuckets; ++i) {
+            cum += snap.counts[i];
+            out += "dip_stage_seconds_bucket{" + label + ",le=\"";
+            append_number(out, LatencyHistogram::bucket_le(i));
+            out += "\"} " + std::to_string(cum) + "\n";
+        }
+        out += "dip_stage_seconds_sum{" + label + "} ";
+        append_number(out, double(snap.sum_ns) * 1e-9);
+        out += "\ndip_stage_seconds_count{" + label + "} " + std::to_string(snap.count) + "\n";
+    }
+    for (int c=0; c<static_cast<int>(Counter::Count); ++c) {
+        std::string name = std::string("dip_") + counter_name(static_cast<Counter>(c)) + "_total";
+        out += "# TYPE " + name + " counter\n" + name + " " + std::to_string(g_counters[c].load(std::memory_order_relaxed)) + "\n";
+    }
+    // Families must be contiguous in the exposition format.
+    auto samples = collect();
+    std::stable_sort(samples.begin(), samples.end(), [](const MetricSample& a, const MetricSample& b){ return a.name < b.name; });
+    std::string last;
+    for (auto& m : samples) {
+        if (m.name != last) { out += "# TYPE " + m.name + (m.name.size() > 6 && m.name.compare(m.name.size() - 6, 6, "_total") == 0 ? " counter\n" : " gauge\n"); last = m.name; }
+        out += m.name;
+        if (!m.labels.empty()) out += "{" + m.labels + "}";
+        out += " ";
+        append_number(out, m.value);
+        out += "\n";
+    }
+    return out;
+}
+
+std::string metrics_json() {
+    std::string out = "{\"stages\":{";
+    for (int s=0; s<static_cast<int>(Stage::Count); ++s) {
+        auto snap = g_stages[s].snapshot();
+        if (s) out += ",";
+        out += std::string("\"") + stage_name(static_cast<Stage>(s)) + "\":{\"count\":" + std::to_string(snap.count) + ",\"mean_ms\":";
+        append_number(out, snap.count ? double(snap.sum_ns) / double(snap.count) * 1e-6 : 0.0);
+        out += ",\"p50_ms\":"; append_number(out, snap.quantile(0.5) * 1e3);
+        out += ",\"p90_ms\":"; append_number(out, snap.quantile(0.9) * 1e3);
+        out += ",\"p99_ms\":"; append_number(out, snap.quantile(0.99) * 1e3);
+        out += ",\"total_s\":"; append_number(out, double(snap.sum_ns) * 1e-9);
+        out += "}";
+    }
+    out += "},\"counters\":{";
+    for (int c=0; c<static_cast<int>(Counter::Count); ++c) {
+        if (c) out += ",";
+        out += std::string("\"") + counter_name(static_cast<Counter>(c)) + "\":" + std::to_string(g_counters[c].load(std::memory_order_relaxed));
+    }
+    out += "},\"samples\":[";
+    bool first = true;
+    for (auto& m : collect()) {
+        if (!first) out += ",";
+        first = false;
+        out += "{\"name\":";
+        append_json_string(out, m.name);
+        out += ",\"labels\":";
+        append_json_string(out, m.labels);
+        out += ",\"value\":";
+        append_number(out, m.value);
+        out += "}";
+    }
+    out += "]}\n";
+    return out;
+}
+
+bool write_metrics_snapshot(const std::string& path) {
+    std::string tmp = path + ".tmp";
+    {
+        std::ofstream f(tmp, std::ios::binary | std::ios::trunc);
+        if (!f) return false;
+        f << metrics_json();
+        if (!f.good()) return false;
+    }
+    std::error_code ec;
+    std::filesystem::rename(tmp, path, ec);
+    return !ec;
+}
+}
@@ -0,0 +1,126 @@
+#include <cstring>
+#include <cstdint>
+#include <charconv>
+#include "common/npy_writer.h"
+#include "common/float16.h"
+
+namespace dip {
+NpyEmbeddingWriter::NpyEmbeddingWriter(const std::string& npy_path, const std::string& index_path, size_t dim, EmbeddingEncoding encoding, const ProductQuantizer* pq)
+    : out_(npy_path, std::ios::binary | std::ios::trunc), index_(index_path.empty() ? nullptr : new CsvWriter(index_path)), dim_(dim), encoding_(encoding), pq_(pq) {
+    if (encoding_ == EmbeddingEncoding::PQ && (!pq_ || pq_->dim() != dim_)) { out_.close(); return; }
+    write_header();
+    if (index_) index_->write_header({"row", "label", "path"});
+}
+NpyEmbeddingWriter::~NpyEmbeddingWriter() { close(); }
+bool NpyEmbeddingWriter::good() const { return out_.good() && out_.is_open() && (!index_ || index_->good()); }
+
+size_t NpyEmbeddingWriter::row_bytes() const {
+    switch (encoding_) {
+    case EmbeddingEncoding::F16: return dim_ * 2;
+    case EmbeddingEncoding::I8: return 4 + dim_;
+    case EmbeddingEncoding::PQ: return pq_->m();
+    default: return dim_ * 4;
+    }
+}
+
+// NPY v1.0: magic, version, u16 LE header length, then a Python dict literal padded with spaces
+// and a newline so the data starts 64-byte aligned.
+void NpyEmbeddingWriter::write_header() {
+    const uint16_t probe = 1;
+    bool little = *reinterpret_cast<const uint8_t*>(&probe) == 1;
+    std::string e = little ? "<" : ">", rows = std::to_string(rows_), dim = std::to_string(dim_);
+    std::string dict;
+    switch (encoding_) {
+    case EmbeddingEncoding::F16: dict = "{'descr': '" + e + "f2', 'fortran_order': False, 'shape': (" + rows + ", " + dim + "), }"; break;
+    case EmbeddingEncoding::I8: dict = "{'descr': [('scale', '" + e + "f4'), ('q', '|i1', (" + dim + ",))], 'fortran_order': False, 'shape': (" + rows + ",), }"; break;
+    case EmbeddingEncoding::PQ: dict = "{'descr': '|u1', 'fortran_order': False, 'shape': (" + rows + ", " + std::to_string(pq_->m()) + "), }"; break;
+    default: dict = "{'descr': '" + e + "f4', 'fortran_order': False, 'shape': (" + rows + ", " + dim + "), }"; break;
+    }
+    std::string h("\x93NUMPY\x01\x00", 8);
+    uint16_t len = static_cast<uint16_t>(kHeaderSize - 10);
+    h.push_back(static_cast<char>(len & 0xFF));
+    h.push_back(static_cast<char>(len >> 8));
+    h += dict;
+    h.append(kHeaderSize - 1 - h.size(), ' ');
+    h.push_back('\n');
+    auto end = out_.tellp();
+    out_.seekp(0);
+    out_.write(h.data(), static_cast<std::streamsize>(h.size()));
+    if (rows_) out_.seekp(end);
+}
+
+void NpyEmbeddingWriter::append(std::string_view label, std::string_view path, const float* v, size_t n) {
+    if (!out_.is_open()) return;
+    size_t k = n < dim_ ? n : dim_;
+    if (encoding_ == EmbeddingEncoding::F32 && k == dim_) {
+        out_.write(reinterpret_cast<const char*>(v), static_cast<std::streamsize>(k * sizeof(float)));
+    } else {
+        row_.assign(v, v + k);
+        row_.resize(dim_, 0.0f);
+        buf_.resize(row_bytes());
+        char* p = &buf_[0];
+        switch (encoding_) {
+        case EmbeddingEncoding::F16: for (size_t i=0; i<dim_; ++i) { uint16_t h = float_to_half(row_[i]); std::memcpy(p + 2*i, &h, 2); } break;
+        case EmbeddingEncoding::I8: { float s = encode_i8(row_.data(), dim_, reinterpret_cast<int8_t*>(p + 4)); std::memcpy(p, &s, 4); break; }
+        case EmbeddingEncoding::PQ: pq_->encode(row_.data(), reinterpret_cast<uint8_t*>(p)); break;
+        default: std::memcpy(p, row_.data(), dim_ * sizeof(float)); break;
+        }
+        out_.write(buf_.data(), static_cast<std::streamsize>(buf_.size()));
+    }
+    if (index_) index_->write_row({std::to_string(rows_), std::string(label), std::string(path)});
+    if (++rows_ % kSyncRows == 0) { write_header(); out_.flush(); if (index_) index_->flush(); }
+}
+
+void NpyEmbeddingWriter::close() {
+    if (!out_.is_open()) return;
+    write_header();
+    out_.close();
+    index_.reset();
+}
+
+namespace {
+// First integer after `key` in the header dict, e.g. the row count after "'shape': (".
+bool dict_int(const std::string& dict, const std::string& key, size_t& out) {
+    size_t p = dict.find(key);
+    if (p == std::string::npos) return false;
+    p += key.size();
+    return std::from_chars(dict.data() + p, dict.data() + dict.size(), out).ec == std::errc();
+}
+}
+
+bool read_npy_embeddings(const std::string& path, const ProductQuantizer* pq, std::vector<float>& out, size_t& rows, size_t& dim) {
+    std::ifstream f(path, std::ios::binary);
+    char pre[10];
+    if (!f.read(pre, sizeof(pre)) || std::memcmp(pre, "\x93NUMPY\x01", 7) != 0) return false;
+    std::string dict(size_t(uint8_t(pre[8])) | (size_t(uint8_t(pre[9])) << 8), '\0');
+    if (!f.read(&dict[0], static_cast<std::streamsize>(dict.size()))) return false;
+    const uint16_t probe = 1;
+    std::string e = *reinterpret_cast<const uint8_t*>(&probe) == 1 ? "<" : ">";
+    EmbeddingEncoding enc;
+    size_t width = 0;
+    if (dict.find("'descr': '" + e + "f4'") != std::string::npos) enc = EmbeddingEncoding::F32;
+    else if (dict.find("'descr': '" + e + "f2'") != std::string::npos) enc = EmbeddingEncoding::F16;
+    else if (dict.find("('scale', '" + e + "f4')") != std::string::npos) enc = EmbeddingEncoding::I8;
+    else if (dict.find("'descr': '|u1'") != std::string::npos) enc = EmbeddingEncoding::PQ;
+    else return false;
+    if (!dict_int(dict, "'shape': (", rows)) return false;
+    if (enc == EmbeddingEncoding::I8 ? !dict_int(dict, "'|i1', (", width) : !dict_int(dict, "'shape': (" + std::to_string(rows) + ", ", width)) return false;
+    if (enc == EmbeddingEncoding::PQ && (!pq || pq->m() != width)) return false;
+    dim = enc == EmbeddingEncoding::PQ ? pq->dim() : width;
+    size_t row_bytes = enc == EmbeddingEncoding::F32 ? dim * 4 : enc == EmbeddingEncoding::F16 ? dim * 2 : enc == EmbeddingEncoding::I8 ? dim + 4 : width;
+    out.resize(rows * dim);
+    std::string buf(row_bytes, '\0');
+    for (size_t r=0; r<rows; ++r) {
+        float* dst = out.data() + r * dim;
+        if (!f.read(&buf[0], static_cast<std::streamsize>(row_bytes))) return false;
+        const char* p = buf.data();
+        switch (enc) {
+        case EmbeddingEncoding::F16: for (size_t i=0; i<dim; ++i) { uint16_t h; std::memcpy(&h, p + 2*i, 2); dst[i] = half_to_float(h); } break;
+        case EmbeddingEncoding::I8: { float s; std::memcpy(&s, p, 4); decode_i8(reinterpret_cast<const int8_t*>(p + 4), dim, s, dst); break; }
+        case EmbeddingEncoding::PQ: pq->decode(reinterpret_cast<const uint8_t*>(p), dst); break;
+        default: std::memcpy(dst, p, dim * sizeof(float)); break;
+        }
+    }
+    return true;
+}
+}
@@ -0,0 +1,70 @@
+#include <string>
+#include <vector>
+#include <fstream>
+#include <algorithm>
+#include <limits>
+#include <cstdio>
+#include "common/trace.h"
+
+namespace dip {
+static void write_json_string(std::ostream& os, const std::string& s) {
+    os << '"';
+    for (char c : s) {
+        if (c == '"' || c == '\\') os << '\\' << c;
+        else if (static_cast<unsigned char>(c) < 0x20) { char buf[8]; std::snprintf(buf, sizeof(buf), "\\u%04x", c); os << buf; }
+        else os << c;
+    }
+    os << '"';
+}
+
+int TraceWriter::add_process(const std::string& name) {
+    std::lock_guard<std::mutex> lk(mtx_);
+    processes_.push_back(name);
+    return static_cast<int>(processes_.size());
+}
+void TraceWriter::name_row(int pid, uint64_t row, const std::string& name) {
+    std::lock_guard<std::mutex> lk(mtx_);
+    rows_.push_back(Row{pid, row, name});
+}
+void TraceWriter::span(int pid, uint64_t row, const std::string& name, int64_t start_us, int64_t dur_us) {
+    std::lock_guard<std::mutex> lk(mtx_);
+    if (events_.size() >= max_spans_) { dropped_++; return; }
+    events_.push_back(Event{pid, row, name, start_us, std::max<int64_t>(0, dur_us)});
+}
+size_t TraceWriter::spans() const { std::lock_guard<std::mutex> lk(mtx_); return events_.size(); }
+size_t TraceWriter::dropped() const { std::lock_guard<std::mutex> lk(mtx_); return dropped_; }
+
+bool TraceWriter::write(const std::string& path) const {
+    std::lock_guard<std::mutex> lk(mtx_);
+    std::ofstream os(path, std::ios::binary | std::ios::trunc);
+    if (!os) return false;
+    int64_t base = std::numeric_limits<int64_t>::max();
+    for (auto& e : events_) base = std::min(base, e.start_us);
+    if (events_.empty()) base = 0;
+    os << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    bool first = true;
+    auto sep = [&]{ if (!first) os << ",\n"; first = false; };
+    for (size_t i=0; i<processes_.size(); ++i) {
+        sep();
+        os << "{\"ph\":\"M\",\"name\":\"process_name\",\"pid\":" << i + 1 << ",\"args\":{\"name\":";
+        write_json_string(os, processes_[i]);
+        os << "}}";
+        sep();
+        os << "{\"ph\":\"M\",\"name\":\"process_sort_index\",\"pid\":" << i + 1 << ",\"args\":{\"sort_index\":" << i << "}}";
+    }
+    for (auto& r : rows_) {
+        sep();
+        os << "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":" << r.pid << ",\"tid\":" << r.row << ",\"args\":{\"name\":";
+        write_json_string(os, r.name);
+        os << "}}";
+    }
+    for (auto& e : events_) {
+        sep();
+        os << "{\"ph\":\"X\",\"name\":";
+        write_json_string(os, e.name);
+        os << ",\"pid\":" << e.pid << ",\"tid\":" << e.row << ",\"ts\":" << e.start_us - base << ",\"dur\":" << e.dur_us << "}";
+    }
+    os << "\n]}\n";
+    return os.good();
+}
+}
@@ -0,0 +1,51 @@
+#include <cmath>
+#include "common/vector_math.h"
+#if defined(__AVX2__) && defined(__FMA__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+namespace dip {
+float dot_product(const float* a, const float* b, size_t n) {
+    size_t i = 0;
+    float sum = 0;
+#if defined(__AVX2__) && defined(__FMA__)
+    // Two accumulators hide the FMA latency; 512-d embeddings are 32 iterations of 16 floats.
+    __m256 s0 = _mm256_setzero_ps(), s1 = _mm256_setzero_ps();
+    for (; i + 16 <= n; i += 16) {
+        s0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), s0);
+        s1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8), s1);
+    }
+    __m256 s = _mm256_add_ps(s0, s1);
+    __m128 h = _mm_add_ps(_mm256_castps256_ps128(s), _mm256_extractf128_ps(s, 1));
+    h = _mm_add_ps(h, _mm_movehl_ps(h, h));
+    h = _mm_add_ss(h, _mm_shuffle_ps(h, h, 1));
+    sum = _mm_cvtss_f32(h);
+#elif defined(__SSE2__) || defined(_M_X64)
+    __m128 s0 = _mm_setzero_ps(), s1 = _mm_setzero_ps();
+    for (; i + 8 <= n; i += 8) {
+        s0 = _mm_add_ps(s0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+        s1 = _mm_add_ps(s1, _mm_mul_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+    }
+    __m128 h = _mm_add_ps(s0, s1);
+    h = _mm_add_ps(h, _mm_movehl_ps(h, h));
+    h = _mm_add_ss(h, _mm_shuffle_ps(h, h, 1));
+    sum = _mm_cvtss_f32(h);
+#endif
+    for (; i < n; ++i) sum += a[i] * b[i];
+    return sum;
+}
+
+void dot_products(const float* q, const float* rows, size_t count, size_t dim, float* out) {
+    for (size_t r=0; r<count; ++r) out[r] = dot_product(q, rows + r * dim, dim);
+}
+
+void l2_normalize(float* v, size_t n) {
+    double s = 0;
+    for (size_t i=0; i<n; ++i) s += double(v[i]) * v[i];
+    if (s <= 0) return;
+    float inv = static_cast<float>(1.0 / std::sqrt(s));
+    for (size_t i=0; i<n; ++i) v[i] *= inv;
+}
+}
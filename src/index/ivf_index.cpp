@@ -0,0 +1,220 @@
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <thread>
+#include <filesystem>
+#include "index/ivf_index.h"
+#include "common/vector_math.h"
+
+namespace dip {
+namespace {
+const char kMagic[8] = {'D', 'I', 'P', 'I', 'V', 'F', '1', 0};
+const size_t kHeaderSize = 128;
+struct Header {
+    char magic[8]; uint32_t dim, lists; uint64_t rows;
+    uint64_t centroids, list_start, vectors, row_ids, str_start, strings, strings_size;
+};
+static_assert(sizeof(Header) <= kHeaderSize, "IVF header must fit its slot");
+
+size_t align64(size_t x) { return (x + 63) & ~size_t(63); }
+
+// Index of the most similar centroid for each of `n` rows, split across hardware threads.
+void assign_rows(const float* data, size_t n, const float* centroids, size_t lists, size_t dim, uint32_t* out) {
+    size_t threads = std::max<size_t>(1, std::min<size_t>(std::thread::hardware_concurrency(), n / 256 + 1));
+    auto work = [&](size_t begin, size_t end) {
+        std::vector<float> scores(lists);
+        for (size_t r=begin; r<end; ++r) {
+            dot_products(data + r * dim, centroids, lists, dim, scores.data());
+            out[r] = static_cast<uint32_t>(std::max_element(scores.begin(), scores.end()) - scores.begin());
+        }
+    };
+    std::vector<std::thread> pool;
+    for (size_t t=1; t<threads; ++t) pool.emplace_back(work, t * n / threads, (t + 1) * n / threads);
+    work(0, n / threads);
+    for (auto& th : pool) th.join();
+}
+
+// Keeps the k best hits as a min-heap on score, so the worst kept hit is at the front.
+bool worse(const IvfIndex::Hit& a, const IvfIndex::Hit& b) { return a.score > b.score; }
+void offer(std::vector<IvfIndex::Hit>& heap, size_t k, float score, uint64_t pos) {
+    if (heap.size() < k) { heap.push_back({score, pos}); std::push_heap(heap.begin(), heap.end(), worse); }
+    else if (score > heap.front().score) { std::pop_heap(heap.begin(), heap.end(), worse); heap.back() = {score, pos}; std::push_heap(heap.begin(), heap.end(), worse); }
+}
+}
+
+IvfIndexBuilder::IvfIndexBuilder(const std::string& path, size_t dim, const IvfBuildOptions& opts)
+    : path_(path), dim_(dim), opts_(opts), vec_(path + ".vec.tmp", std::ios::binary | std::ios::trunc), str_(path + ".str.tmp", std::ios::binary | std::ios::trunc) {}
+
+IvfIndexBuilder::~IvfIndexBuilder() {
+    if (finished_) return;
+    vec_.close(); str_.close();
+    std::error_code ec;
+    std::filesystem::remove(path_ + ".vec.tmp", ec);
+    std::filesystem::remove(path_ + ".str.tmp", ec);
+}
+
+void IvfIndexBuilder::add(std::string_view label, std::string_view path, const float* v, size_t n) {
+    size_t k = std::min(n, dim_);
+    row_.assign(v, v + k);
+    row_.resize(dim_, 0.0f);
+    l2_normalize(row_.data(), dim_);
+    vec_.write(reinterpret_cast<const char*>(row_.data()), static_cast<std::streamsize>(dim_ * sizeof(float)));
+    str_.write(label.data(), static_cast<std::streamsize>(label.size()));
+    str_.put('\0');
+    str_.write(path.data(), static_cast<std::streamsize>(path.size()));
+    str_start_.push_back(str_start_.back() + label.size() + 1 + path.size());
+    // Reservoir sampling keeps every row equally likely to be in the training set.
+    size_t cap = std::max<size_t>(1, opts_.train_rows);
+    if (rows_ < cap) sample_.insert(sample_.end(), row_.begin(), row_.end());
+    else { size_t j = static_cast<size_t>(rng_() % (rows_ + 1)); if (j < cap) std::copy(row_.begin(), row_.end(), sample_.begin() + static_cast<std::ptrdiff_t>(j * dim_)); }
+    rows_++;
+}
+
+bool IvfIndexBuilder::finish() {
+    if (finished_) return false;
+    vec_.close(); str_.close();
+    std::error_code ec;
+    size_t n_sample = sample_.size() / dim_;
+    if (rows_ == 0 || n_sample == 0) {
+        // Nothing to cluster: no seeds for k-means and no index to write.
+        std::filesystem::remove(path_ + ".vec.tmp", ec);
+        std::filesystem::remove(path_ + ".str.tmp", ec);
+        finished_ = true;
+        return false;
+    }
+    MappedFile vm, sm;
+    bool ok = vm.open(path_ + ".vec.tmp") && sm.open(path_ + ".str.tmp") && vm.size() == rows_ * dim_ * sizeof(float);
+    size_t lists = opts_.lists ? opts_.lists : static_cast<size_t>(std::lround(std::sqrt(double(rows_))));
+    lists = std::max<size_t>(1, std::min(lists, n_sample));
+
+    // Spherical k-means on the sample: centroids are renormalized means, so the most similar
+    // centroid by inner product is also the nearest by cosine.
+    std::vector<float> cent(lists * dim_), sums(lists * dim_);
+    std::vector<size_t> counts(lists);
+    std::vector<uint32_t> assign(std::max(n_sample, ok ? rows_ : 0));
+    for (size_t c=0; c<lists; ++c) std::memcpy(&cent[c * dim_], &sample_[(c * n_sample / lists) * dim_], dim_ * sizeof(float));
+    for (int it=0; ok && it<opts_.iterations; ++it) {
+        assign_rows(sample_.data(), n_sample, cent.data(), lists, dim_, assign.data());
+        std::fill(sums.begin(), sums.end(), 0.0f);
+        std::fill(counts.begin(), counts.end(), 0);
+        for (size_t i=0; i<n_sample; ++i) {
+            float* s = &sums[assign[i] * dim_];
+            const float* x = &sample_[i * dim_];
+            for (size_t j=0; j<dim_; ++j) s[j] += x[j];
+            counts[assign[i]]++;
+        }
+        for (size_t c=0; c<lists; ++c) {
+            // An empty cluster restarts from a random sample row.
+            if (!counts[c]) std::memcpy(&sums[c * dim_], &sample_[static_cast<size_t>(rng_() % n_sample) * dim_], dim_ * sizeof(float));
+            l2_normalize(&sums[c * dim_], dim_);
+        }
+        cent.swap(sums);
+    }
+
+    std::ofstream out;
+    if (ok) {
+        const float* data = reinterpret_cast<const float*>(vm.data());
+        assign_rows(data, rows_, cent.data(), lists, dim_, assign.data());
+        std::vector<uint64_t> list_start(lists + 1, 0), order(rows_);
+        for (size_t r=0; r<rows_; ++r) list_start[assign[r] + 1]++;
+        for (size_t c=0; c<lists; ++c) list_start[c + 1] += list_start[c];
+        std::vector<uint64_t> fill(list_start.begin(), list_start.end() - 1);
+        for (size_t r=0; r<rows_; ++r) order[fill[assign[r]]++] = r;
+
+        Header h{};
+        std::memcpy(h.magic, kMagic, sizeof(kMagic));
+        h.dim = static_cast<uint32_t>(dim_); h.lists = static_cast<uint32_t>(lists); h.rows = rows_;
+        h.centroids = kHeaderSize;
+        h.list_start = align64(h.centroids + lists * dim_ * sizeof(float));
+        h.vectors = align64(h.list_start + (lists + 1) * sizeof(uint64_t));
+        h.row_ids = align64(h.vectors + rows_ * dim_ * sizeof(float));
+        h.str_start = align64(h.row_ids + rows_ * sizeof(uint64_t));
+        h.strings = align64(h.str_start + (rows_ + 1) * sizeof(uint64_t));
+        h.strings_size = str_start_.back();
+        out.open(path_, std::ios::binary | std::ios::trunc);
+        auto put = [&](const void* p, size_t n) { out.write(static_cast<const char*>(p), static_cast<std::streamsize>(n)); };
+        auto pad_to = [&](uint64_t off) { static const char zeros[64] = {}; size_t at = static_cast<size_t>(out.tellp()); if (off > at) put(zeros, off - at); };
+        std::string head(kHeaderSize, '\0');
+        std::memcpy(&head[0], &h, sizeof(h));
+        put(head.data(), head.size());
+        put(cent.data(), cent.size() * sizeof(float));
+        pad_to(h.list_start);
+        put(list_start.data(), list_start.size() * sizeof(uint64_t));
+        pad_to(h.vectors);
+        for (uint64_t r : order) put(data + r * dim_, dim_ * sizeof(float));
+        pad_to(h.row_ids);
+        put(order.data(), order.size() * sizeof(uint64_t));
+        pad_to(h.str_start);
+        uint64_t at = 0;
+        put(&at, sizeof(at));
+        for (uint64_t r : order) { at += str_start_[r + 1] - str_start_[r]; put(&at, sizeof(at)); }
+        pad_to(h.strings);
+        for (uint64_t r : order) put(sm.data() + str_start_[r], static_cast<size_t>(str_start_[r + 1] - str_start_[r]));
+        out.close();
+        ok = !out.fail();
+    }
+    vm.close(); sm.close();
+    std::filesystem::remove(path_ + ".vec.tmp", ec);
+    std::filesystem::remove(path_ + ".str.tmp", ec);
+    finished_ = true;
+    return ok;
+}
+
+bool IvfIndex::open(const std::string& path) {
+    if (!file_.open(path) || file_.size() < kHeaderSize) return false;
+    Header h;
+    std::memcpy(&h, file_.data(), sizeof(h));
+    if (std::memcmp(h.magic, kMagic, sizeof(kMagic)) != 0 || h.dim == 0 || h.lists == 0) return false;
+    size_t size = file_.size();
+    if (h.strings > size || h.strings_size > size - h.strings || h.str_start + (h.rows + 1) * sizeof(uint64_t) > h.strings
+        || h.row_ids + h.rows * sizeof(uint64_t) > h.str_start || h.vectors + h.rows * h.dim * sizeof(float) > h.row_ids
+        || h.list_start + (h.lists + 1) * sizeof(uint64_t) > h.vectors || h.centroids + size_t(h.lists) * h.dim * sizeof(float) > h.list_start) return false;
+    const unsigned char* base = file_.data();
+    dim_ = h.dim; lists_ = h.lists; rows_ = static_cast<size_t>(h.rows);
+    centroids_ = reinterpret_cast<const float*>(base + h.centroids);
+    list_start_ = reinterpret_cast<const uint64_t*>(base + h.list_start);
+    vectors_ = reinterpret_cast<const float*>(base + h.vectors);
+    row_ids_ = reinterpret_cast<const uint64_t*>(base + h.row_ids);
+    str_start_ = reinterpret_cast<const uint64_t*>(base + h.str_start);
+    strings_ = reinterpret_cast<const char*>(base + h.strings);
+    strings_size_ = static_cast<size_t>(h.strings_size);
+    return list_start_[lists_] == rows_ && str_start_[rows_] == strings_size_;
+}
+
+void IvfIndex::scan(const float* q, uint64_t begin, uint64_t end, size_t k, std::vector<Hit>& heap) const {
+    for (uint64_t p=begin; p<end; ++p) offer(heap, k, dot_product(q, vectors_ + p * dim_, dim_), p);
+}
+
+void IvfIndex::search(const float* q, size_t k, size_t nprobe, std::vector<Hit>& out) const {
+    out.clear();
+    if (!k || !rows_) return;
+    nprobe = std::max<size_t>(1, std::min(nprobe, lists_));
+    std::vector<float> scores(lists_);
+    dot_products(q, centroids_, lists_, dim_, scores.data());
+    std::vector<uint32_t> probe(lists_);
+    for (size_t c=0; c<lists_; ++c) probe[c] = static_cast<uint32_t>(c);
+    std::partial_sort(probe.begin(), probe.begin() + static_cast<std::ptrdiff_t>(nprobe), probe.end(), [&](uint32_t a, uint32_t b){ return scores[a] > scores[b]; });
+    for (size_t i=0; i<nprobe; ++i) scan(q, list_start_[probe[i]], list_start_[probe[i] + 1], k, out);
+    std::sort_heap(out.begin(), out.end(), worse);
+}
+
+void IvfIndex::search_exact(const float* q, size_t k, std::vector<Hit>& out) const {
+    out.clear();
+    if (!k) return;
+    scan(q, 0, rows_, k, out);
+    std::sort_heap(out.begin(), out.end(), worse);
+}
+
+std::string_view IvfIndex::label(uint64_t pos) const {
+    const char* s = strings_ + str_start_[pos];
+    size_t n = static_cast<size_t>(str_start_[pos + 1] - str_start_[pos]);
+    const void* z = std::memchr(s, '\0', n);
+    return std::string_view(s, z ? static_cast<size_t>(static_cast<const char*>(z) - s) : n);
+}
+
+std::string_view IvfIndex::path(uint64_t pos) const {
+    size_t n = static_cast<size_t>(str_start_[pos + 1] - str_start_[pos]);
+    size_t l = label(pos).size();
+    return l < n ? std::string_view(strings_ + str_start_[pos] + l + 1, n - l - 1) : std::string_view();
+}
+}
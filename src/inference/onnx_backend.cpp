@@ -6,106 +6,249 @@
 #include <cstring>
 #include <array>
 #include <filesystem>
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#elif defined(__linux__)
+#include <unistd.h>
+#endif
 #if defined(DIP_HAS_ONNX)
 #include "onnxruntime_cxx_api.h"
 #endif
-#if defined(DIP_HAS_OPENCV)
-#include <opencv2/imgcodecs.hpp>
-#include <opencv2/imgproc.hpp>
-#endif
 #include "inference/onnx_backend.h"
+#include "inference/preprocess.h"
+#include "common/metrics.h"
 
 namespace dip {
+const char* model_precision_name(ModelPrecision p) {
+    switch (p) {
+    case ModelPrecision::FP16: return "fp16";
+    case ModelPrecision::INT8: return "int8";
+    default: return "fp32";
+    }
+}
+bool parse_model_precision(const std::string& name, ModelPrecision& out) {
+    if (name == "fp32") out = ModelPrecision::FP32;
+    else if (name == "fp16") out = ModelPrecision::FP16;
+    else if (name == "int8") out = ModelPrecision::INT8;
+    else return false;
+    return true;
+}
+std::string model_variant_path(const std::string& fp32_path, ModelPrecision p) {
+    if (p == ModelPrecision::FP32) return fp32_path;
+    std::filesystem::path path(fp32_path);
+    return (path.parent_path() / (path.stem().string() + "." + model_precision_name(p) + path.extension().string())).string();
+}
+
 #if defined(DIP_HAS_ONNX)
-struct OnnxRuntimeBackend::Impl {
-    Ort::Env env{ORT_LOGGING_LEVEL_WARNING, "dip"};
-    Ort::SessionOptions opts;
+namespace {
+Ort::Env& shared_env() {
+    static Ort::Env env{ORT_LOGGING_LEVEL_WARNING, "dip"};
+    return env;
+}
+
+// A loaded model. Session::Run is thread-safe, so every backend asking for the same model,
+// provider and thread settings runs on the same instance instead of loading its own copy.
+struct SharedSession {
     std::unique_ptr<Ort::Session> session;
-    std::vector<const char*> input_names;
-    std::vector<const char*> output_names;
+    std::vector<std::string> input_storage, output_storage;
+    std::vector<const char*> input_names, output_names;
     bool use_cuda = false;
+    bool dynamic_batch = false;
 };
+struct SessionSlot { std::mutex mtx; std::weak_ptr<SharedSession> session; };
 
-OnnxRuntimeBackend::OnnxRuntimeBackend(ProviderPref pref) : impl(new Impl{}) { impl->use_cuda = (pref == ProviderPref::CUDA); }
-OnnxRuntimeBackend::~OnnxRuntimeBackend() {}
-
-static void to_nhwc_float_rgb(
-#if defined(DIP_HAS_OPENCV)
-    cv::Mat& img,
+size_t resident_bytes() {
+#if defined(_WIN32)
+    PROCESS_MEMORY_COUNTERS pmc;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc))) return pmc.WorkingSetSize;
+    return 0;
+#elif defined(__linux__)
+    std::ifstream f("/proc/self/statm");
+    size_t pages = 0, resident = 0;
+    if (!(f >> pages >> resident)) return 0;
+    return resident * static_cast<size_t>(sysconf(_SC_PAGESIZE));
 #else
-    std::vector<unsigned char>& /*img*/,
+    return 0;
 #endif
-    std::vector<float>& out) {
-#if defined(DIP_HAS_OPENCV)
-    cv::Mat resized; cv::resize(img, resized, cv::Size(224,224));
-    cv::Mat rgb; cv::cvtColor(resized, rgb, cv::COLOR_BGR2RGB);
-    out.resize(224*224*3);
-    size_t idx=0;
-    for (int y=0; y<224; ++y) {
-        for (int x=0; x<224; ++x) {
-            cv::Vec3b v = rgb.at<cv::Vec3b>(y,x);
-            out[idx++] = float(v[0]);
-            out[idx++] = float(v[1]);
-            out[idx++] = float(v[2]);
-        }
+}
+
+std::shared_ptr<SharedSession> load_session(const std::string& model_path, bool want_cuda, const OnnxSessionOptions& o, int index) {
+    auto t0 = std::chrono::steady_clock::now();
+    size_t rss0 = resident_bytes();
+    auto s = std::make_shared<SharedSession>();
+    Ort::SessionOptions opts;
+    if (o.intra_op_threads > 0) opts.SetIntraOpNumThreads(o.intra_op_threads);
+    if (o.inter_op_threads > 0) {
+        opts.SetInterOpNumThreads(o.inter_op_threads);
+        if (o.inter_op_threads > 1) opts.SetExecutionMode(ExecutionMode::ORT_PARALLEL);
+    }
+    s->use_cuda = want_cuda;
+    if (want_cuda) {
+        try { OrtSessionOptionsAppendExecutionProvider_CUDA(opts, 0); } catch (...) { s->use_cuda = false; }
     }
+#if defined(_WIN32)
+    std::wstring wpath = std::filesystem::path(model_path).wstring();
+    s->session.reset(new Ort::Session(shared_env(), wpath.c_str(), opts));
 #else
-    out.assign(224*224*3, 0.0f);
+    s->session.reset(new Ort::Session(shared_env(), model_path.c_str(), opts));
 #endif
+    Ort::AllocatorWithDefaultOptions allocator;
+    for (size_t i=0; i<s->session->GetInputCount(); ++i) s->input_storage.push_back(s->session->GetInputNameAllocated(i, allocator).get());
+    for (size_t i=0; i<s->session->GetOutputCount(); ++i) s->output_storage.push_back(s->session->GetOutputNameAllocated(i, allocator).get());
+    for (auto& n : s->input_storage) s->input_names.push_back(n.c_str());
+    for (auto& n : s->output_storage) s->output_names.push_back(n.c_str());
+    // Callers hand over float32 tensors and read float32 embeddings; FP16 exports must keep float32 I/O.
+    if (s->session->GetInputTypeInfo(0).GetTensorTypeAndShapeInfo().GetElementType() != ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT ||
+        s->session->GetOutputTypeInfo(0).GetTensorTypeAndShapeInfo().GetElementType() != ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT)
+        throw std::runtime_error(model_path + ": inputs and outputs must be float32 (export with keep_io_types)");
+    auto in_shape = s->session->GetInputTypeInfo(0).GetTensorTypeAndShapeInfo().GetShape();
+    s->dynamic_batch = !in_shape.empty() && in_shape[0] <= 0;
+    // RSS deltas overlap when several sessions load at once; they are exact for sequential loads.
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+    double mb = double(resident_bytes() > rss0 ? resident_bytes() - rss0 : 0) / (1024.0 * 1024.0);
+    std::cout << "onnx session " << index << " " << std::filesystem::path(model_path).filename().string() << " provider=" << (s->use_cuda ? "cuda" : "cpu") << " loaded in " << std::fixed << std::setprecision(0) << ms
+              << " ms, rss +" << std::setprecision(1) << mb << " MB (intra=" << o.intra_op_threads << " inter=" << o.inter_op_threads << ")" << std::endl;
+    return s;
+}
+
+// Backends are spread round-robin over `sessions` instances per model/provider/thread settings.
+std::shared_ptr<SharedSession> acquire_session(const std::string& model_path, bool want_cuda, const OnnxSessionOptions& o) {
+    static std::mutex reg_mtx;
+    static std::map<std::string, std::shared_ptr<SessionSlot>> slots;
+    static std::map<std::string, size_t> next;
+    std::string key = model_path + "|" + (want_cuda ? "cuda" : "cpu") + "|" + std::to_string(o.intra_op_threads) + "|" + std::to_string(o.inter_op_threads);
+    int index = 0;
+    std::shared_ptr<SessionSlot> slot;
+    {
+        std::lock_guard<std::mutex> lk(reg_mtx);
+        index = static_cast<int>(next[key]++ % static_cast<size_t>(std::max(1, o.sessions)));
+        auto& sl = slots[key + "#" + std::to_string(index)];
+        if (!sl) sl = std::make_shared<SessionSlot>();
+        slot = sl;
+    }
+    // Per-slot lock: the first backend loads, the rest wait for it rather than loading a copy.
+    std::lock_guard<std::mutex> lk(slot->mtx);
+    if (auto s = slot->session.lock()) return s;
+    auto s = load_session(model_path, want_cuda, o, index);
+    slot->session = s;
+    return s;
+}
+}
+
+struct OnnxRuntimeBackend::Impl {
+    bool want_cuda = false;
+    OnnxSessionOptions session_opts;
+    std::shared_ptr<SharedSession> shared;
+    std::vector<float> tensor;
+    std::vector<std::optional<InferenceResult>> run(const ImageView* images, size_t n);
+    // Runs `count` contiguous tensors at `data`; result k lands in results[slots[k]].
+    void run_tensors(const float* data, const std::array<int,2>* dims, const size_t* slots, size_t count, std::vector<std::optional<InferenceResult>>& results);
+};
+
+OnnxRuntimeBackend::OnnxRuntimeBackend(ProviderPref pref, const OnnxSessionOptions& opts) : impl(new Impl{}) {
+    impl->want_cuda = (pref == ProviderPref::CUDA);
+    impl->session_opts = opts;
 }
+OnnxRuntimeBackend::~OnnxRuntimeBackend() {}
 
 bool OnnxRuntimeBackend::init(const std::string& model_path) {
+    std::string path = model_variant_path(model_path, impl->session_opts.precision);
+    if (!std::filesystem::exists(path)) {
+        std::cerr << "onnx: no " << model_precision_name(impl->session_opts.precision) << " model at " << path << " (see onnx converter/convert_to_onnx.py)" << std::endl;
+        return false;
+    }
     try {
-        if (impl->use_cuda) {
-            try { OrtSessionOptionsAppendExecutionProvider_CUDA(impl->opts, 0); } catch (...) { impl->use_cuda = false; }
-        }
-        std::wstring wpath = std::filesystem::path(model_path).wstring();
-        impl->session.reset(new Ort::Session(impl->env, wpath.c_str(), impl->opts));
-        size_t n_in = impl->session->GetInputCount();
-        size_t n_out = impl->session->GetOutputCount();
-        impl->input_names.resize(n_in);
-        impl->output_names.resize(n_out);
-        Ort::AllocatorWithDefaultOptions allocator;
-        for (size_t i=0;i<n_in;++i) impl->input_names[i] = impl->session->GetInputNameAllocated(i, allocator).release();
-        for (size_t i=0;i<n_out;++i) impl->output_names[i] = impl->session->GetOutputNameAllocated(i, allocator).release();
-        return true;
+        impl->shared = acquire_session(path, impl->want_cuda, impl->session_opts);
+        return impl->shared != nullptr;
+    } catch (const std::exception& e) {
+        std::cerr << "onnx: " << e.what() << std::endl;
+        return false;
     } catch (...) { return false; }
 }
 
-std::optional<InferenceResult> OnnxRuntimeBackend::infer(const std::vector<unsigned char>& image_bytes) {
-#if defined(DIP_HAS_OPENCV)
-    cv::Mat buf(1, static_cast<int>(image_bytes.size()), CV_8UC1, const_cast<unsigned char*>(image_bytes.data()));
-    cv::Mat img = cv::imdecode(buf, cv::IMREAD_COLOR);
-    if (img.empty()) return {};
-#endif
-    std::vector<float> tensor;
-#if defined(DIP_HAS_OPENCV)
-    to_nhwc_float_rgb(img, tensor);
-#else
-    std::vector<unsigned char> dummy;
-    to_nhwc_float_rgb(dummy, tensor);
-#endif
+std::vector<std::optional<InferenceResult>> OnnxRuntimeBackend::Impl::run(const ImageView* images, size_t n) {
+    std::vector<std::optional<InferenceResult>> results(n);
+    std::vector<size_t> slots;
+    std::vector<std::array<int,2>> dims;
+    slots.reserve(n); dims.reserve(n);
+    tensor.resize(n * kTensorSize);
+    for (size_t i=0; i<n; ++i) {
+        std::array<int,2> d{0,0};
+        if (!decode_to_tensor(images[i].data, images[i].size, tensor.data() + slots.size() * kTensorSize, d[0], d[1])) continue;
+        dims.push_back(d);
+        slots.push_back(i);
+    }
+    if (!slots.empty()) run_tensors(tensor.data(), dims.data(), slots.data(), slots.size(), results);
+    return results;
+}
 
-    std::array<int64_t,4> shape{1,224,224,3};
+void OnnxRuntimeBackend::Impl::run_tensors(const float* data, const std::array<int,2>* dims, const size_t* slots, size_t n, std::vector<std::optional<InferenceResult>>& results) {
+    // Models exported with a fixed batch of 1 still work, one Run per image.
+    auto& sess = *shared;
+    size_t step = sess.dynamic_batch ? n : 1;
     Ort::MemoryInfo mem = Ort::MemoryInfo::CreateCpu(OrtArenaAllocator, OrtMemTypeDefault);
-    Ort::Value input = Ort::Value::CreateTensor<float>(mem, tensor.data(), tensor.size(), shape.data(), shape.size());
-    auto outputs = impl->session->Run(Ort::RunOptions{nullptr}, impl->input_names.data(), &input, 1, impl->output_names.data(), impl->output_names.size());
-    InferenceResult r;
-    r.faces.push_back({0,0,
-#if defined(DIP_HAS_OPENCV)
-        img.cols, img.rows,
-#else
-        224, 224,
-#endif
-        1.0f});
-    if (!outputs.empty() && outputs[0].IsTensor()) {
+    for (size_t b=0; b<n; b+=step) {
+        size_t count = std::min(step, n - b);
+        std::array<int64_t,4> shape{static_cast<int64_t>(count),kModelSide,kModelSide,3};
+        Ort::Value input = Ort::Value::CreateTensor<float>(mem, const_cast<float*>(data) + b * kTensorSize, count * kTensorSize, shape.data(), shape.size());
+        auto t0 = std::chrono::steady_clock::now();
+        auto outputs = sess.session->Run(Ort::RunOptions{nullptr}, sess.input_names.data(), &input, 1, sess.output_names.data(), sess.output_names.size());
+        record_stage(Stage::SessionRun, std::chrono::steady_clock::now() - t0);
+        if (outputs.empty() || !outputs[0].IsTensor()) continue;
         float* p = outputs[0].GetTensorMutableData<float>();
-        auto type = outputs[0].GetTensorTypeAndShapeInfo();
-        auto sz = type.GetElementCount();
-        r.embedding.assign(p, p + sz);
+        size_t per = outputs[0].GetTensorTypeAndShapeInfo().GetElementCount() / count;
+        for (size_t k=0; k<count; ++k) {
+            InferenceResult r;
+            r.faces.push_back({0, 0, dims[b+k][0], dims[b+k][1], 1.0f});
+            r.embedding.assign(p + k * per, p + (k + 1) * per);
+            r.meta = sess.use_cuda ? std::string("provider=cuda") : std::string("provider=cpu");
+            results[slots[b+k]] = std::move(r);
+        }
+    }
+}
+
+std::optional<InferenceResult> OnnxRuntimeBackend::infer(const std::vector<unsigned char>& image_bytes) {
+    ImageView v{image_bytes.data(), image_bytes.size()};
+    return std::move(impl->run(&v, 1)[0]);
+}
+
+std::vector<std::optional<InferenceResult>> OnnxRuntimeBackend::infer_batch(const std::vector<ImageView>& images) {
+    return impl->run(images.data(), images.size());
+}
+
+std::vector<std::optional<InferenceResult>> OnnxRuntimeBackend::infer_tensors(const std::vector<TensorView>& tensors) {
+    size_t n = tensors.size();
+    std::vector<std::optional<InferenceResult>> results(n);
+    if (n == 0) return results;
+    std::vector<std::array<int,2>> dims(n);
+    std::vector<size_t> slots(n);
+    bool contiguous = true;
+    for (size_t i=0; i<n; ++i) {
+        dims[i] = {tensors[i].width, tensors[i].height};
+        slots[i] = i;
+        if (tensors[i].data != tensors[0].data + i * kTensorSize) contiguous = false;
+    }
+    if (contiguous) {
+        impl->run_tensors(tensors[0].data, dims.data(), slots.data(), n, results);
+    } else if (impl->shared->dynamic_batch) {
+        // Tensors from a preprocessing pool are separate buffers; gather them so the batch is still one Run.
+        impl->tensor.resize(n * kTensorSize);
+        for (size_t i=0; i<n; ++i) std::memcpy(impl->tensor.data() + i * kTensorSize, tensors[i].data, kTensorSize * sizeof(float));
+        impl->run_tensors(impl->tensor.data(), dims.data(), slots.data(), n, results);
+    } else {
+        for (size_t i=0; i<n; ++i) impl->run_tensors(tensors[i].data, &dims[i], &slots[i], 1, results);
     }
-    r.meta = impl->use_cuda ? std::string("provider=cuda") : std::string("provider=cpu");
-    return r;
+    return results;
 }
 #endif
 }
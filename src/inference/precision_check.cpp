@@ -0,0 +1,98 @@
+#include <vector>
+#include <string>
+#include <chrono>
+#include <cmath>
+#include <algorithm>
+#include "inference/precision_check.h"
+#include "inference/preprocess.h"
+
+namespace dip {
+#if defined(DIP_HAS_ONNX)
+namespace {
+double cosine(const std::vector<float>& a, const std::vector<float>& b) {
+    double dot = 0, na = 0, nb = 0;
+    size_t n = std::min(a.size(), b.size());
+    for (size_t i=0; i<n; ++i) { dot += double(a[i]) * b[i]; na += double(a[i]) * a[i]; nb += double(b[i]) * b[i]; }
+    return na > 0 && nb > 0 ? dot / std::sqrt(na * nb) : 0.0;
+}
+
+// Index of the most similar other embedding, or -1.
+long nearest(const std::vector<std::vector<float>>& emb, size_t i) {
+    long best = -1;
+    double best_sim = -2;
+    for (size_t j=0; j<emb.size(); ++j) {
+        if (j == i) continue;
+        double s = cosine(emb[i], emb[j]);
+        if (s > best_sim) { best_sim = s; best = static_cast<long>(j); }
+    }
+    return best;
+}
+
+// Embeddings for every tensor and the steady-state throughput in images/s.
+bool run_model(OnnxRuntimeBackend& backend, const std::vector<TensorView>& views, size_t batch, std::vector<std::vector<float>>& out, double& images_per_s) {
+    size_t n = views.size();
+    out.assign(n, {});
+    std::vector<TensorView> part(views.begin(), views.begin() + static_cast<std::ptrdiff_t>(std::min(batch, n)));
+    backend.infer_tensors(part);
+    auto t0 = std::chrono::steady_clock::now();
+    for (size_t b=0; b<n; b+=batch) {
+        part.assign(views.begin() + static_cast<std::ptrdiff_t>(b), views.begin() + static_cast<std::ptrdiff_t>(std::min(n, b + batch)));
+        auto res = backend.infer_tensors(part);
+        for (size_t k=0; k<res.size(); ++k) {
+            if (!res[k]) return false;
+            out[b + k] = std::move(res[k]->embedding);
+        }
+    }
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    images_per_s = secs > 0 ? double(n) / secs : 0;
+    return true;
+}
+}
+
+std::optional<PrecisionReport> check_precision(const std::string& fp32_model, ModelPrecision variant, ProviderPref provider, const OnnxSessionOptions& opts, const std::vector<PrecisionSample>& samples, size_t batch) {
+    batch = std::max<size_t>(1, batch);
+    std::vector<float> tensors(samples.size() * kTensorSize);
+    std::vector<TensorView> views;
+    std::vector<const std::string*> labels;
+    for (auto& s : samples) {
+        int w = 0, h = 0;
+        float* dst = tensors.data() + views.size() * kTensorSize;
+        if (!decode_to_tensor(s.bytes.data(), s.bytes.size(), dst, w, h)) continue;
+        views.push_back(TensorView{dst, w, h});
+        labels.push_back(&s.label);
+    }
+    if (views.empty()) return std::nullopt;
+
+    OnnxSessionOptions ref_opts = opts, var_opts = opts;
+    ref_opts.precision = ModelPrecision::FP32;
+    var_opts.precision = variant;
+    OnnxRuntimeBackend ref(provider, ref_opts), var(provider, var_opts);
+    if (!ref.init(fp32_model) || !var.init(fp32_model)) return std::nullopt;
+    PrecisionReport r;
+    r.images = views.size();
+    std::vector<std::vector<float>> a, b;
+    if (!run_model(ref, views, batch, a, r.fp32_images_per_s)) return std::nullopt;
+    if (!run_model(var, views, batch, b, r.variant_images_per_s)) return std::nullopt;
+
+    std::vector<double> cos(r.images);
+    size_t agree = 0, label_a = 0, label_b = 0;
+    for (size_t i=0; i<r.images; ++i) {
+        cos[i] = cosine(a[i], b[i]);
+        long na = nearest(a, i), nb = nearest(b, i);
+        if (na == nb) agree++;
+        if (na >= 0 && *labels[static_cast<size_t>(na)] == *labels[i]) label_a++;
+        if (nb >= 0 && *labels[static_cast<size_t>(nb)] == *labels[i]) label_b++;
+    }
+    double sum = 0;
+    for (double c : cos) sum += c;
+    std::sort(cos.begin(), cos.end());
+    r.cos_mean = sum / double(r.images);
+    r.cos_min = cos.front();
+    r.cos_p01 = cos[static_cast<size_t>(0.01 * double(r.images - 1))];
+    r.nn_agreement = double(agree) / double(r.images);
+    r.label_nn_fp32 = double(label_a) / double(r.images);
+    r.label_nn_variant = double(label_b) / double(r.images);
+    return r;
+}
+#endif
+}
@@ -0,0 +1,267 @@
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include <chrono>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+#if defined(DIP_HAS_OPENCV)
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc.hpp>
+#endif
+#include "inference/preprocess.h"
+#include "common/metrics.h"
+
+namespace dip {
+namespace {
+struct ResizeTables {
+    int src_w = -1, src_h = -1, dst_w = -1, dst_h = -1;
+    std::vector<int> xofs;     // byte offset of the left source pixel
+    std::vector<int> xofs1;    // byte offset of the right source pixel
+    std::vector<float> xw;     // weight of the right source pixel
+    std::vector<int> y0, y1;
+    std::vector<float> yw;
+    std::vector<float> row0, row1;
+    int row0_y = -1, row1_y = -1;
+};
+
+// Same source coordinate mapping as cv::resize INTER_LINEAR: pixel centers, clamped at the edges.
+void axis_map(int src, int dst, std::vector<int>& i0, std::vector<int>& i1, std::vector<float>& w) {
+    i0.resize(dst); i1.resize(dst); w.resize(dst);
+    double scale = double(src) / double(dst);
+    for (int d=0; d<dst; ++d) {
+        double s = (d + 0.5) * scale - 0.5;
+        int s0 = static_cast<int>(std::floor(s));
+        float f = static_cast<float>(s - s0);
+        if (s0 < 0) { s0 = 0; f = 0.0f; }
+        if (s0 >= src - 1) { s0 = src - 1; f = 0.0f; }
+        i0[d] = s0; i1[d] = std::min(s0 + 1, src - 1); w[d] = f;
+    }
+}
+
+void prepare(ResizeTables& t, int src_w, int src_h, int dst_w, int dst_h) {
+    if (t.src_w == src_w && t.src_h == src_h && t.dst_w == dst_w && t.dst_h == dst_h) { t.row0_y = t.row1_y = -1; return; }
+    t.src_w = src_w; t.src_h = src_h; t.dst_w = dst_w; t.dst_h = dst_h;
+    axis_map(src_w, dst_w, t.xofs, t.xofs1, t.xw);
+    for (int d=0; d<dst_w; ++d) { t.xofs[d] *= 3; t.xofs1[d] *= 3; }
+    axis_map(src_h, dst_h, t.y0, t.y1, t.yw);
+    t.row0.resize(size_t(dst_w) * 3 + 1);
+    t.row1.resize(size_t(dst_w) * 3 + 1);
+    t.row0_y = t.row1_y = -1;
+}
+
+// Horizontal pass over one source row, written in RGB order. The SIMD path blends a whole pixel
+// per step and stores 4 lanes, so row buffers carry one float of padding.
+void hresize_row(const ResizeTables& t, const uint8_t* row, float* out) {
+    int d = 0;
+#if defined(__SSE2__) || defined(_M_X64)
+    const __m128i zero = _mm_setzero_si128();
+    for (; d<t.dst_w; ++d) {
+        const uint8_t* a = row + t.xofs[d];
+        const uint8_t* b = row + t.xofs1[d];
+        int pa = a[0] | (a[1] << 8) | (a[2] << 16);
+        int pb = b[0] | (b[1] << 8) | (b[2] << 16);
+        __m128 fa = _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(pa), zero), zero));
+        __m128 fb = _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(pb), zero), zero));
+        __m128 v = _mm_add_ps(fa, _mm_mul_ps(_mm_set1_ps(t.xw[d]), _mm_sub_ps(fb, fa)));
+        _mm_storeu_ps(out, _mm_shuffle_ps(v, v, _MM_SHUFFLE(3,0,1,2)));
+        out += 3;
+    }
+#endif
+    for (; d<t.dst_w; ++d) {
+        const uint8_t* a = row + t.xofs[d];
+        const uint8_t* b = row + t.xofs1[d];
+        float w = t.xw[d];
+        out[0] = float(a[2]) + w * (float(b[2]) - float(a[2]));
+        out[1] = float(a[1]) + w * (float(b[1]) - float(a[1]));
+        out[2] = float(a[0]) + w * (float(b[0]) - float(a[0]));
+        out += 3;
+    }
+}
+
+// Vertical blend out = r0 + w * (r1 - r0).
+void vblend(const float* r0, const float* r1, float w, float* out, size_t n) {
+    size_t i = 0;
+#if defined(__AVX2__)
+    __m256 vw = _mm256_set1_ps(w);
+    for (; i + 8 <= n; i += 8) {
+        __m256 a = _mm256_loadu_ps(r0 + i);
+        __m256 b = _mm256_loadu_ps(r1 + i);
+        _mm256_storeu_ps(out + i, _mm256_add_ps(a, _mm256_mul_ps(vw, _mm256_sub_ps(b, a))));
+    }
+#elif defined(__SSE2__) || defined(_M_X64)
+    __m128 vw = _mm_set1_ps(w);
+    for (; i + 4 <= n; i += 4) {
+        __m128 a = _mm_loadu_ps(r0 + i);
+        __m128 b = _mm_loadu_ps(r1 + i);
+        _mm_storeu_ps(out + i, _mm_add_ps(a, _mm_mul_ps(vw, _mm_sub_ps(b, a))));
+    }
+#endif
+    for (; i < n; ++i) out[i] = r0[i] + w * (r1[i] - r0[i]);
+}
+}
+
+void resize_bgr_to_rgb_f32(const uint8_t* src, int src_w, int src_h, size_t src_stride, float* dst, int dst_w, int dst_h) {
+    thread_local ResizeTables t;
+    prepare(t, src_w, src_h, dst_w, dst_h);
+    size_t n = size_t(dst_w) * 3;
+    for (int y=0; y<dst_h; ++y) {
+        int a = t.y0[y], b = t.y1[y];
+        // Keep the two most recent source rows; upscaling and neighbouring outputs reuse them.
+        if (t.row0_y != a) {
+            if (t.row1_y == a) { std::swap(t.row0, t.row1); std::swap(t.row0_y, t.row1_y); }
+            else { hresize_row(t, src + size_t(a) * src_stride, t.row0.data()); t.row0_y = a; }
+        }
+        if (t.row1_y != b) {
+            hresize_row(t, src + size_t(b) * src_stride, t.row1.data()); t.row1_y = b;
+        }
+        vblend(t.row0.data(), t.row1.data(), t.yw[y], dst + size_t(y) * n, n);
+    }
+}
+
+void resize_bgr_to_rgb_f32_reference(const uint8_t* src, int src_w, int src_h, size_t src_stride, float* dst, int dst_w, int dst_h) {
+#if defined(DIP_HAS_OPENCV)
+    cv::Mat img(src_h, src_w, CV_8UC3, const_cast<uint8_t*>(src), src_stride);
+    cv::Mat resized; cv::resize(img, resized, cv::Size(dst_w,dst_h));
+    cv::Mat rgb; cv::cvtColor(resized, rgb, cv::COLOR_BGR2RGB);
+    size_t idx=0;
+    for (int y=0; y<dst_h; ++y) {
+        for (int x=0; x<dst_w; ++x) {
+            cv::Vec3b v = rgb.at<cv::Vec3b>(y,x);
+            dst[idx++] = float(v[0]);
+            dst[idx++] = float(v[1]);
+            dst[idx++] = float(v[2]);
+        }
+    }
+#else
+    resize_bgr_to_rgb_f32(src, src_w, src_h, src_stride, dst, dst_w, dst_h);
+#endif
+}
+
+bool image_dimensions(const unsigned char* data, size_t size, int& width, int& height) {
+    if (size >= 24 && data[0] == 0x89 && data[1] == 'P' && data[2] == 'N' && data[3] == 'G') {
+        width = (data[16] << 24) | (data[17] << 16) | (data[18] << 8) | data[19];
+        height = (data[20] << 24) | (data[21] << 16) | (data[22] << 8) | data[23];
+        return width > 0 && height > 0;
+    }
+    if (size < 4 || data[0] != 0xFF || data[1] != 0xD8) return false;
+    size_t i = 2;
+    while (i + 4 <= size) {
+        if (data[i] != 0xFF) { ++i; continue; }
+        uint8_t marker = data[i+1];
+        if (marker == 0xFF) { ++i; continue; }
+        if (marker == 0xD8 || marker == 0x01 || (marker >= 0xD0 && marker <= 0xD7)) { i += 2; continue; }
+        size_t len = (size_t(data[i+2]) << 8) | data[i+3];
+        // SOF0..SOF15 except DHT (C4), JPG (C8) and DAC (CC).
+        if (marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC) {
+            if (i + 9 > size) return false;
+            height = (data[i+5] << 8) | data[i+6];
+            width = (data[i+7] << 8) | data[i+8];
+            return width > 0 && height > 0;
+        }
+        if (marker == 0xD9 || marker == 0xDA) return false;
+        i += 2 + len;
+    }
+    return false;
+}
+
+int reduced_decode_factor(const unsigned char* data, size_t size, int target) {
+    if (size < 2 || data[0] != 0xFF || data[1] != 0xD8) return 1;
+    int w = 0, h = 0;
+    if (!image_dimensions(data, size, w, h)) return 1;
+    for (int f : {8, 4, 2}) {
+        if (w / f >= target && h / f >= target) return f;
+    }
+    return 1;
+}
+
+bool decode_to_tensor(const unsigned char* data, size_t size, float* out, int& width, int& height) {
+#if defined(DIP_HAS_OPENCV)
+    if (size == 0) return false;
+    thread_local cv::Mat decoded;
+    int factor = reduced_decode_factor(data, size, kModelSide);
+    int flag = factor == 8 ? cv::IMREAD_REDUCED_COLOR_8 : factor == 4 ? cv::IMREAD_REDUCED_COLOR_4 : factor == 2 ? cv::IMREAD_REDUCED_COLOR_2 : cv::IMREAD_COLOR;
+    cv::Mat buf(1, static_cast<int>(size), CV_8UC1, const_cast<unsigned char*>(data));
+    auto t0 = std::chrono::steady_clock::now();
+    cv::imdecode(buf, flag, &decoded);
+    auto t1 = std::chrono::steady_clock::now();
+    record_stage(Stage::Decode, t1 - t0);
+    if (decoded.empty() || decoded.type() != CV_8UC3) return false;
+    resize_bgr_to_rgb_f32(decoded.data, decoded.cols, decoded.rows, decoded.step, out, kModelSide, kModelSide);
+    record_stage(Stage::Preprocess, std::chrono::steady_clock::now() - t1);
+    if (factor == 1 || !image_dimensions(data, size, width, height)) { width = decoded.cols * factor; height = decoded.rows * factor; }
+#else
+    (void)data; (void)size;
+    std::fill(out, out + kTensorSize, 0.0f);
+    width = height = kModelSide;
+#endif
+    return true;
+}
+
+bool decode_to_rgb8(const unsigned char* data, size_t size, unsigned char* out) {
+#if defined(DIP_HAS_OPENCV)
+    if (size == 0) return false;
+    thread_local cv::Mat decoded;
+    thread_local std::vector<float> tensor(kTensorSize);
+    int factor = reduced_decode_factor(data, size, kModelSide);
+    int flag = factor == 8 ? cv::IMREAD_REDUCED_COLOR_8 : factor == 4 ? cv::IMREAD_REDUCED_COLOR_4 : factor == 2 ? cv::IMREAD_REDUCED_COLOR_2 : cv::IMREAD_COLOR;
+    cv::Mat buf(1, static_cast<int>(size), CV_8UC1, const_cast<unsigned char*>(data));
+    auto t0 = std::chrono::steady_clock::now();
+    cv::imdecode(buf, flag, &decoded);
+    auto t1 = std::chrono::steady_clock::now();
+    record_stage(Stage::Decode, t1 - t0);
+    if (decoded.empty() || decoded.type() != CV_8UC3) return false;
+    resize_bgr_to_rgb_f32(decoded.data, decoded.cols, decoded.rows, decoded.step, tensor.data(), kModelSide, kModelSide);
+    for (size_t i=0; i<kTensorSize; ++i) out[i] = static_cast<unsigned char>(std::min(255.0f, std::max(0.0f, tensor[i] + 0.5f)));
+    record_stage(Stage::Preprocess, std::chrono::steady_clock::now() - t1);
+    return true;
+#else
+    (void)data; (void)size; (void)out;
+    return false;
+#endif
+}
+
+bool encode_rgb8_jpeg(const unsigned char* rgb, int quality, std::vector<unsigned char>& out) {
+#if defined(DIP_HAS_OPENCV)
+    thread_local cv::Mat bgr;
+    cv::Mat img(kModelSide, kModelSide, CV_8UC3, const_cast<unsigned char*>(rgb));
+    cv::cvtColor(img, bgr, cv::COLOR_RGB2BGR);
+    return cv::imencode(".jpg", bgr, out, {cv::IMWRITE_JPEG_QUALITY, std::min(100, std::max(1, quality))});
+#else
+    (void)rgb; (void)quality; (void)out;
+    return false;
+#endif
+}
+
+bool rgb8_to_tensor(const unsigned char* data, size_t size, float* out) {
+    if (size != kTensorSize) return false;
+    auto t0 = std::chrono::steady_clock::now();
+    for (size_t i=0; i<kTensorSize; ++i) out[i] = float(data[i]);
+    record_stage(Stage::Preprocess, std::chrono::steady_clock::now() - t0);
+    return true;
+}
+
+bool perceptual_hash(const unsigned char* data, size_t size, uint64_t& out) {
+#if defined(DIP_HAS_OPENCV)
+    if (size == 0) return false;
+    thread_local cv::Mat gray, thumb;
+    int factor = reduced_decode_factor(data, size, 64);
+    int flag = factor == 8 ? cv::IMREAD_REDUCED_GRAYSCALE_8 : factor == 4 ? cv::IMREAD_REDUCED_GRAYSCALE_4 : factor == 2 ? cv::IMREAD_REDUCED_GRAYSCALE_2 : cv::IMREAD_GRAYSCALE;
+    cv::Mat buf(1, static_cast<int>(size), CV_8UC1, const_cast<unsigned char*>(data));
+    cv::imdecode(buf, flag, &gray);
+    if (gray.empty()) return false;
+    cv::resize(gray, thumb, cv::Size(9, 8), 0, 0, cv::INTER_AREA);
+    out = 0;
+    for (int y=0; y<8; ++y) {
+        const unsigned char* row = thumb.ptr(y);
+        for (int x=0; x<8; ++x) out = (out << 1) | (row[x] < row[x+1] ? 1u : 0u);
+    }
+    return true;
+#else
+    (void)data; (void)size; (void)out;
+    return false;
+#endif
+}
+}
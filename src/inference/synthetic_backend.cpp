@@ -0,0 +1,74 @@
+#include <vector>
+#include <optional>
+#include <memory>
+#include <random>
+#include <thread>
+#include <chrono>
+#include <cmath>
+#include "inference/factory.h"
+#include "inference/preprocess.h"
+#include "common/hash.h"
+
+namespace dip {
+namespace {
+class SyntheticBackend : public IInferenceBackend {
+public:
+    explicit SyntheticBackend(const SyntheticBackendOptions& opts) : opts_(opts), rng_(opts.seed) {}
+    bool init(const std::string&) override { return true; }
+    std::optional<InferenceResult> infer(const std::vector<unsigned char>& image_bytes) override {
+        spin_us(opts_.decode_us);
+        wait(1);
+        return make(hash64(image_bytes.data(), image_bytes.size()));
+    }
+    std::vector<std::optional<InferenceResult>> infer_batch(const std::vector<ImageView>& images) override {
+        spin_us(opts_.decode_us * static_cast<long long>(images.size()));
+        wait(images.size());
+        std::vector<std::optional<InferenceResult>> out;
+        out.reserve(images.size());
+        for (auto& img : images) out.push_back(make(hash64(img.data, img.size)));
+        return out;
+    }
+    std::vector<std::optional<InferenceResult>> infer_tensors(const std::vector<TensorView>& tensors) override {
+        wait(tensors.size());
+        std::vector<std::optional<InferenceResult>> out;
+        out.reserve(tensors.size());
+        for (auto& t : tensors) out.push_back(make(hash64(t.data, kTensorSize * sizeof(float))));
+        return out;
+    }
+private:
+    static void spin_us(long long us) {
+        if (us <= 0) return;
+        auto end = std::chrono::steady_clock::now() + std::chrono::microseconds(us);
+        while (std::chrono::steady_clock::now() < end) {}
+    }
+    void wait(size_t images) {
+        long long us = opts_.latency_us + static_cast<long long>(opts_.per_image_us) * static_cast<long long>(images);
+        if (opts_.jitter_us > 0) us += std::uniform_int_distribution<long long>(-opts_.jitter_us, opts_.jitter_us)(rng_);
+        if (us > 0) std::this_thread::sleep_for(std::chrono::microseconds(us));
+    }
+    // splitmix64 stream from the content hash, mapped to [-1, 1) and L2-normalized.
+    InferenceResult make(uint64_t h) const {
+        InferenceResult r;
+        r.embedding.resize(opts_.dim);
+        double norm = 0;
+        for (auto& v : r.embedding) {
+            uint64_t z = (h += 0x9E3779B97F4A7C15ull);
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+            z ^= z >> 31;
+            v = static_cast<float>(static_cast<double>(z >> 11) * (2.0 / 9007199254740992.0) - 1.0);
+            norm += double(v) * v;
+        }
+        float inv = norm > 0 ? static_cast<float>(1.0 / std::sqrt(norm)) : 0.0f;
+        for (auto& v : r.embedding) v *= inv;
+        return r;
+    }
+    SyntheticBackendOptions opts_;
+    std::mt19937_64 rng_;
+};
+}
+
+std::unique_ptr<IInferenceBackend> make_synthetic_backend(const SyntheticBackendOptions& opts) {
+    return std::unique_ptr<IInferenceBackend>(new SyntheticBackend(opts));
+}
+}
@@ -0,0 +1,79 @@
+#include <bitset>
+#include <algorithm>
+#include "master/dedup.h"
+
+namespace dip {
+namespace {
+uint32_t band_key(uint64_t phash, int band) { return (static_cast<uint32_t>(band) << 16) | static_cast<uint32_t>((phash >> (band * 16)) & 0xFFFF); }
+}
+
+Deduper::Deduper(DedupOptions opts) : opts_(opts) { opts_.max_distance = std::max(0, std::min(opts_.max_distance, 3)); }
+
+Deduper::Verdict Deduper::check(const ContentKey& key, const uint64_t* phash, Item item, std::vector<float>& emb) {
+    std::lock_guard<std::mutex> lk(mtx_);
+    Canon* match = nullptr;
+    auto it = canon_.find(key);
+    if (it != canon_.end()) { match = &it->second; exact_++; }
+    if (!match && opts_.near && phash) {
+        for (int b=0; b<4 && !match; ++b) {
+            auto bt = bands_.find(band_key(*phash, b));
+            if (bt == bands_.end()) continue;
+            for (auto& ck : bt->second) {
+                auto ct = canon_.find(ck);
+                if (ct == canon_.end() || !ct->second.has_phash) continue;
+                if (static_cast<int>(std::bitset<64>(ct->second.phash ^ *phash).count()) <= opts_.max_distance) { match = &ct->second; near_++; break; }
+            }
+        }
+    }
+    if (match) {
+        if (!match->done) { match->waiters.push_back(std::move(item)); return Verdict::Parked; }
+        emb = match->emb;
+        return Verdict::Ready;
+    }
+    Canon& c = canon_[key];
+    if (phash) {
+        c.has_phash = true;
+        c.phash = *phash;
+        if (opts_.near) for (int b=0; b<4; ++b) bands_[band_key(*phash, b)].push_back(key);
+    }
+    return Verdict::Unique;
+}
+
+std::vector<Deduper::Item> Deduper::complete(const ContentKey& key, const std::vector<float>& emb) {
+    std::lock_guard<std::mutex> lk(mtx_);
+    auto it = canon_.find(key);
+    if (it == canon_.end() || it->second.done) return {};
+    auto waiters = std::move(it->second.waiters);
+    it->second.waiters.clear();
+    if (opts_.window == 0) { forget(key); return waiters; }
+    it->second.done = true;
+    it->second.emb = emb;
+    done_order_.push_back(key);
+    while (done_order_.size() > opts_.window) { forget(done_order_.front()); done_order_.pop_front(); }
+    return waiters;
+}
+
+std::vector<Deduper::Item> Deduper::fail(const ContentKey& key) {
+    std::lock_guard<std::mutex> lk(mtx_);
+    auto it = canon_.find(key);
+    if (it == canon_.end() || it->second.done) return {};
+    auto waiters = std::move(it->second.waiters);
+    forget(key);
+    return waiters;
+}
+
+void Deduper::forget(const ContentKey& key) {
+    auto it = canon_.find(key);
+    if (it == canon_.end()) return;
+    if (it->second.has_phash && opts_.near) {
+        for (int b=0; b<4; ++b) {
+            auto bt = bands_.find(band_key(it->second.phash, b));
+            if (bt == bands_.end()) continue;
+            auto& v = bt->second;
+            v.erase(std::remove(v.begin(), v.end(), key), v.end());
+            if (v.empty()) bands_.erase(bt);
+        }
+    }
+    canon_.erase(it);
+}
+}
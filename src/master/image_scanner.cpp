@@ -0,0 +1,205 @@
+#include <fstream>
+#include <algorithm>
+#include <charconv>
+#include "master/image_scanner.h"
+
+namespace fs = std::filesystem;
+
+namespace dip {
+namespace {
+const char* kManifestMagic = "DIP-MANIFEST 1";
+
+int64_t ticks(fs::file_time_type t) { return static_cast<int64_t>(t.time_since_epoch().count()); }
+
+bool ends_with_nocase(std::string_view s, std::string_view suffix) {
+    if (s.size() < suffix.size()) return false;
+    for (size_t i=0; i<suffix.size(); ++i) {
+        char c = s[s.size() - suffix.size() + i];
+        if (c >= 'A' && c <= 'Z') c = static_cast<char>(c - 'A' + 'a');
+        if (c != suffix[i]) return false;
+    }
+    return true;
+}
+
+// Names are the last field of a tab-separated line.
+bool storable(std::string_view s) { return s.find_first_of("\t\n\r") == std::string_view::npos; }
+
+template <typename T>
+bool parse_num(std::string_view s, T& out) { return std::from_chars(s.data(), s.data() + s.size(), out).ec == std::errc(); }
+
+// Splits "a\tb\tc" into at most `n` fields; the last one keeps any remaining tabs.
+size_t split_tabs(std::string_view line, std::string_view* out, size_t n) {
+    size_t k = 0;
+    while (k + 1 < n) {
+        size_t t = line.find('\t');
+        if (t == std::string_view::npos) break;
+        out[k++] = line.substr(0, t);
+        line.remove_prefix(t + 1);
+    }
+    out[k++] = line;
+    return k;
+}
+}
+
+bool is_image_name(std::string_view name) {
+    return ends_with_nocase(name, ".jpg") || ends_with_nocase(name, ".jpeg") || ends_with_nocase(name, ".png");
+}
+
+ImageScanner::ImageScanner(const std::string& root, const ScanOptions& opts) : root_(root), opts_(opts), queue_(opts.queue) {}
+
+ImageScanner::~ImageScanner() {
+    stop();
+    for (auto& t : threads_) if (t.joinable()) t.join();
+}
+
+void ImageScanner::start() {
+    t0_ = std::chrono::steady_clock::now();
+    if (!opts_.manifest.empty()) load_manifest();
+    std::error_code ec;
+    for (fs::directory_iterator it(root_, ec), end; !ec && it != end; it.increment(ec)) {
+        std::error_code ec2;
+        if (it->is_directory(ec2) && !it->is_symlink(ec2)) shards_.push_back(it->path().filename().string());
+    }
+    // Sorted so reruns dispatch in the same order.
+    std::sort(shards_.begin(), shards_.end());
+    int n = std::max(1, std::min(opts_.threads, static_cast<int>(shards_.size())));
+    running_ = n;
+    for (int i=0; i<n; ++i) threads_.emplace_back([this]{ worker(); });
+}
+
+bool ImageScanner::next(ScannedImage& out) { return queue_.pop(out); }
+
+void ImageScanner::stop() {
+    stopped_ = true;
+    queue_.close();
+}
+
+ScanStats ImageScanner::stats() const {
+    std::lock_guard<std::mutex> lk(mtx_);
+    return stats_;
+}
+
+void ImageScanner::worker() {
+    ScanStats local;
+    for (size_t i = next_shard_++; i < shards_.size() && !stopped_; i = next_shard_++) {
+        std::string label = shards_[i];
+        if (label.rfind("pin_", 0) == 0) label = label.substr(4);
+        walk(fs::path(root_) / shards_[i], shards_[i], label, local);
+    }
+    {
+        std::lock_guard<std::mutex> lk(mtx_);
+        stats_.dirs += local.dirs; stats_.dirs_reused += local.dirs_reused;
+        stats_.images += local.images; stats_.images_reused += local.images_reused;
+    }
+    if (--running_ > 0) return;
+    // Last thread out: every directory is recorded, so the manifest can be replaced.
+    bool written = !stopped_ && !opts_.manifest.empty() && save_manifest();
+    {
+        std::lock_guard<std::mutex> lk(mtx_);
+        stats_.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0_).count();
+        stats_.manifest_written = written;
+    }
+    queue_.close();
+}
+
+void ImageScanner::walk(const fs::path& dir, const std::string& rel, const std::string& label, ScanStats& local) {
+    std::error_code ec;
+    DirRec rec;
+    rec.mtime = ticks(fs::last_write_time(dir, ec));
+    if (ec) return;
+    rec.label = label;
+    local.dirs++;
+    auto old = old_.find(rel);
+    if (old != old_.end() && old->second.mtime == rec.mtime && old->second.label == label) {
+        // Unchanged directory: no listing and no per-file stat.
+        rec = old->second;
+        local.dirs_reused++;
+        for (auto& f : rec.files) {
+            if (!queue_.push(ScannedImage{label, (dir / f.name).string(), f.size})) return;
+            local.images++; local.images_reused++;
+        }
+    } else {
+        for (fs::directory_iterator it(dir, ec), end; !ec && it != end; it.increment(ec)) {
+            std::error_code ec2;
+            std::string name = it->path().filename().string();
+            if (it->is_directory(ec2)) {
+                // Like recursive_directory_iterator's default, symlinked directories are not followed.
+                if (!it->is_symlink(ec2)) rec.subdirs.push_back(std::move(name));
+                continue;
+            }
+            if (!is_image_name(name) || !it->is_regular_file(ec2)) continue;
+            uint64_t size = it->file_size(ec2);
+            if (ec2) size = 0;
+            int64_t mtime = ticks(it->last_write_time(ec2));
+            if (!queue_.push(ScannedImage{label, it->path().string(), size})) return;
+            rec.files.push_back(FileRec{std::move(name), size, mtime});
+            local.images++;
+        }
+        if (ec) return;
+        std::sort(rec.subdirs.begin(), rec.subdirs.end());
+    }
+    std::vector<std::string> subdirs = rec.subdirs;
+    {
+        std::lock_guard<std::mutex> lk(mtx_);
+        new_[rel] = std::move(rec);
+    }
+    for (auto& s : subdirs) {
+        if (stopped_) return;
+        walk(dir / s, rel + "/" + s, label, local);
+    }
+}
+
+// After a "DIP-MANIFEST 1\t<root>" line, one line per record, tab-separated, name last:
+//   D <mtime> <label> <dir relative to root, '/'-separated>
+//   F <size> <mtime> <file name>      images of the preceding D
+//   S <name>                          subdirectories of the preceding D
+// Directories with a tab or newline in any name are left out and simply listed again next run.
+bool ImageScanner::save_manifest() const {
+    std::vector<const std::pair<const std::string, DirRec>*> dirs;
+    for (auto& d : new_) dirs.push_back(&d);
+    std::sort(dirs.begin(), dirs.end(), [](auto* a, auto* b){ return a->first < b->first; });
+    std::string tmp = opts_.manifest + ".tmp";
+    {
+        std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+        out << kManifestMagic << "\t" << root_ << "\n";
+        for (auto* d : dirs) {
+            auto& r = d->second;
+            bool ok = storable(d->first) && storable(r.label);
+            for (auto& f : r.files) ok = ok && storable(f.name);
+            for (auto& s : r.subdirs) ok = ok && storable(s);
+            if (!ok) continue;
+            out << "D\t" << r.mtime << "\t" << r.label << "\t" << d->first << "\n";
+            for (auto& f : r.files) out << "F\t" << f.size << "\t" << f.mtime << "\t" << f.name << "\n";
+            for (auto& s : r.subdirs) out << "S\t" << s << "\n";
+        }
+        if (!out.good()) return false;
+    }
+    std::error_code ec;
+    fs::rename(tmp, opts_.manifest, ec);
+    return !ec;
+}
+
+void ImageScanner::load_manifest() {
+    std::ifstream in(opts_.manifest, std::ios::binary);
+    std::string line;
+    // A manifest of another root (or format) is ignored and replaced after the scan.
+    if (!std::getline(in, line) || line != std::string(kManifestMagic) + "\t" + root_) return;
+    DirRec* cur = nullptr;
+    std::string_view f[4];
+    while (std::getline(in, line)) {
+        if (line.size() < 2 || line[1] != '\t') { cur = nullptr; continue; }
+        std::string_view body(line.data() + 2, line.size() - 2);
+        if (line[0] == 'D' && split_tabs(body, f, 3) == 3) {
+            DirRec r;
+            if (!parse_num(f[0], r.mtime)) { cur = nullptr; continue; }
+            r.label = std::string(f[1]);
+            cur = &(old_[std::string(f[2])] = std::move(r));
+        } else if (cur && line[0] == 'F' && split_tabs(body, f, 3) == 3) {
+            FileRec r{std::string(f[2]), 0, 0};
+            if (parse_num(f[0], r.size) && parse_num(f[1], r.mtime)) cur->files.push_back(std::move(r));
+        } else if (cur && line[0] == 'S') {
+            cur->subdirs.emplace_back(body);
+        }
+    }
+}
+}
@@ -4,59 +4,117 @@
 #include <string>
 #include <vector>
 #include <cctype>
-#include <sstream>
 #include <thread>
 #include <mutex>
 #include <condition_variable>
-#include <queue>
+#include <unordered_map>
 #include <atomic>
 #include <iomanip>
+#include <algorithm>
 #include "common/csv_writer.h"
+#include "common/npy_writer.h"
+#include "common/config.h"
+#include "common/mapped_file.h"
+#include "common/byte_budget.h"
+#include "common/embedding_cache.h"
+#include "common/metrics.h"
+#include "common/trace.h"
+#include "common/embedding_codec.h"
+#include "index/ivf_index.h"
+#include "master/dedup.h"
+#include "master/image_scanner.h"
 #include "inference/factory.h"
-#if defined(DIP_HAS_ONNX)
+#include "inference/pipeline.h"
+#include "inference/preprocess.h"
 #include "inference/onnx_backend.h"
-#endif
+#include "inference/precision_check.h"
 #if defined(DIP_HAS_NETWORKING)
 #include "master/net_master.h"
-#include "networking/tcp_client.h"
+#include "worker/net_worker.h"
+#include "networking/metrics_server.h"
 #endif
 
 namespace fs = std::filesystem;
 using namespace dip;
 
-static std::vector<unsigned char> read_file_bytes(const fs::path& p) {
-    std::ifstream f(p, std::ios::binary);
-    std::vector<unsigned char> bytes;
-    f.seekg(0, std::ios::end);
-    std::streampos size = f.tellg();
-    f.seekg(0, std::ios::beg);
-    bytes.resize(static_cast<size_t>(size));
-    if (size > 0) f.read(reinterpret_cast<char*>(bytes.data()), size);
-    return bytes;
-}
-
 int main(int argc, char** argv) {
+    auto start_time = std::chrono::steady_clock::now();
     fs::path image_root = fs::path("data") / "images";
     fs::path output_dir = fs::path("output");
     fs::create_directories(output_dir);
-    CsvWriter csv((output_dir / "embeddings.csv").string());
     bool net_mode = false;
     std::string bind = "0.0.0.0";
     uint16_t port = 5555;
 
-    struct Job { std::string label; fs::path path; std::vector<unsigned char> bytes; };
-    struct Result { std::string label; fs::path path; std::vector<float> embedding; };
-    std::queue<Job> jobs;
-    std::mutex mtx;
-    std::condition_variable cvq;
+    // The file is mapped rather than read, so its pages are only faulted in by the decode thread;
+    // the lease charges its size to the ingest budget until then.
+    struct Job {
+        std::string label; fs::path path; MappedFile file; ByteBudget::Lease lease; ContentKey key;
+        ImageView image() const { return ImageView{file.data(), file.size()}; }
+        void release_image() { file.close(); lease.reset(); }
+    };
+    // `key` is set for freshly inferred images when the cache or dedup is on: the writer stores
+    // them in the cache and, for dedup canonicals, emits the duplicates parked on them.
+    struct Result { std::string label; fs::path path; std::vector<float> embedding; ContentKey key; bool cache_new = false; bool canonical = false; };
     std::atomic<bool> done{false};
     std::atomic<size_t> processed{0};
-    size_t total = 0;
+    std::atomic<size_t> total{0};
 
     int gpu_workers = 0;
     int cpu_workers = 1;
     int local_gpu_workers = 0;
     int local_cpu_workers = 0;
+    NetMasterOptions net_opts;
+    net_opts.io_threads = 2;
+    Config cfg;
+    cfg.load("config.json");
+    BatchPolicy batch_policy;
+    batch_policy.min_batch = static_cast<size_t>(cfg.get_int("batch_size_min", 1));
+    batch_policy.max_batch = static_cast<size_t>(cfg.get_int("batch_size_max", 1));
+    PipelineOptions pipe_opts;
+    pipe_opts.decode_threads = static_cast<int>(cfg.get_int("decode_threads", pipe_opts.decode_threads));
+    pipe_opts.decode_queue = static_cast<size_t>(cfg.get_int("decode_queue", static_cast<long long>(pipe_opts.decode_queue)));
+    pipe_opts.infer_queue = static_cast<size_t>(cfg.get_int("infer_queue", static_cast<long long>(pipe_opts.infer_queue)));
+    net_opts.max_credits = static_cast<int>(cfg.get_int("max_task_credits", net_opts.max_credits));
+    net_opts.ship_bytes = cfg.get_bool("ship_image_bytes", false);
+    net_opts.preresize_ratio = cfg.get_double("preresize_ratio", net_opts.preresize_ratio);
+    net_opts.preresize_jpeg_quality = static_cast<int>(cfg.get_int("preresize_jpeg_quality", net_opts.preresize_jpeg_quality));
+    net_opts.preresize_threads = static_cast<int>(cfg.get_int("preresize_threads", net_opts.preresize_threads));
+    net_opts.max_queued_jobs = static_cast<size_t>(cfg.get_int("max_queued_jobs", 4096));
+    net_opts.lookahead_ms = static_cast<int>(cfg.get_int("dispatch_lookahead_ms", net_opts.lookahead_ms));
+    net_opts.lease_ms = static_cast<int>(cfg.get_int("task_lease_ms", net_opts.lease_ms));
+    net_opts.max_attempts = static_cast<int>(cfg.get_int("max_task_attempts", net_opts.max_attempts));
+    net_opts.speculate = cfg.get_bool("speculative_tasks", net_opts.speculate);
+    size_t ingest_budget_mb = static_cast<size_t>(cfg.get_int("ingest_budget_mb", 256));
+    std::string output_format = cfg.get_string("output_format", "csv");
+    std::string cache_path = cfg.get_string("embedding_cache", (output_dir / "embedding_cache.bin").string());
+    std::string dedup_mode = cfg.get_string("dedup", "exact");
+    DedupOptions dedup_opts;
+    dedup_opts.max_distance = static_cast<int>(cfg.get_int("near_dup_bits", dedup_opts.max_distance));
+    OnnxSessionOptions onnx_opts;
+    onnx_opts.intra_op_threads = static_cast<int>(cfg.get_int("intra_op_threads", 0));
+    onnx_opts.inter_op_threads = static_cast<int>(cfg.get_int("inter_op_threads", 0));
+    onnx_opts.sessions = static_cast<int>(cfg.get_int("onnx_sessions", 1));
+    if (!parse_model_precision(cfg.get_string("model_precision", "fp32"), onnx_opts.precision)) std::cerr << "unknown model_precision, using fp32" << std::endl;
+    std::string validate_precision;
+    size_t validate_samples = 256;
+    double min_cosine = 0.99;
+    int metrics_port = static_cast<int>(cfg.get_int("metrics_port", 0));
+    std::string metrics_json = cfg.get_string("metrics_json", "");
+    int metrics_interval_s = static_cast<int>(cfg.get_int("metrics_interval_s", 10));
+    std::string trace_path = cfg.get_string("trace_path", "");
+    net_opts.trace_every = static_cast<int>(cfg.get_int("trace_every", net_opts.trace_every));
+    std::string encoding_name = cfg.get_string("embedding_encoding", "f32");
+    std::string pq_path = cfg.get_string("pq_codebook", "");
+    std::string train_pq, decode_out, embeddings_in;
+    bool eval_encodings = false;
+    bool build_index = cfg.get_bool("build_index", false);
+    ScanOptions scan_opts;
+    scan_opts.threads = static_cast<int>(cfg.get_int("scan_threads", scan_opts.threads));
+    scan_opts.manifest = cfg.get_string("scan_manifest", (output_dir / "scan_manifest.tsv").string());
+    IvfBuildOptions index_opts;
+    index_opts.lists = static_cast<size_t>(cfg.get_int("index_lists", 0));
+    size_t pq_subspaces = 64, eval_queries = 1000;
     for (int i=1; i<argc; ++i) {
         std::string arg = argv[i];
         if (arg == "--gpu-workers" && i+1 < argc) { gpu_workers = std::stoi(argv[++i]); }
@@ -66,96 +124,363 @@ int main(int argc, char** argv) {
         else if (arg == "--port" && i+1 < argc) { port = static_cast<uint16_t>(std::stoi(argv[++i])); }
         else if (arg == "--local-gpu-workers" && i+1 < argc) { local_gpu_workers = std::stoi(argv[++i]); }
         else if (arg == "--local-cpu-workers" && i+1 < argc) { local_cpu_workers = std::stoi(argv[++i]); }
+        else if (arg == "--io-threads" && i+1 < argc) { net_opts.io_threads = std::stoi(argv[++i]); }
+        else if (arg == "--max-credits" && i+1 < argc) { net_opts.max_credits = std::stoi(argv[++i]); }
+        else if (arg == "--ship-bytes") { net_opts.ship_bytes = true; }
+        else if (arg == "--preresize" && i+1 < argc) { net_opts.preresize_ratio = std::stod(argv[++i]); }
+        else if (arg == "--preresize-jpeg" && i+1 < argc) { net_opts.preresize_jpeg_quality = std::stoi(argv[++i]); }
+        else if (arg == "--preresize-threads" && i+1 < argc) { net_opts.preresize_threads = std::stoi(argv[++i]); }
+        else if (arg == "--batch-min" && i+1 < argc) { batch_policy.min_batch = static_cast<size_t>(std::stoi(argv[++i])); }
+        else if (arg == "--batch-max" && i+1 < argc) { batch_policy.max_batch = static_cast<size_t>(std::stoi(argv[++i])); }
+        else if (arg == "--batch-wait-ms" && i+1 < argc) { batch_policy.max_wait = std::chrono::milliseconds(std::stoi(argv[++i])); }
+        else if (arg == "--decode-threads" && i+1 < argc) { pipe_opts.decode_threads = std::stoi(argv[++i]); }
+        else if (arg == "--ingest-budget-mb" && i+1 < argc) { ingest_budget_mb = static_cast<size_t>(std::stoll(argv[++i])); }
+        else if (arg == "--lookahead-ms" && i+1 < argc) { net_opts.lookahead_ms = std::stoi(argv[++i]); }
+        else if (arg == "--lease-ms" && i+1 < argc) { net_opts.lease_ms = std::stoi(argv[++i]); }
+        else if (arg == "--max-attempts" && i+1 < argc) { net_opts.max_attempts = std::stoi(argv[++i]); }
+        else if (arg == "--no-speculation") { net_opts.speculate = false; }
+        else if (arg == "--max-queued-jobs" && i+1 < argc) { net_opts.max_queued_jobs = static_cast<size_t>(std::stoll(argv[++i])); }
+        else if (arg == "--intra-op-threads" && i+1 < argc) { onnx_opts.intra_op_threads = std::stoi(argv[++i]); }
+        else if (arg == "--inter-op-threads" && i+1 < argc) { onnx_opts.inter_op_threads = std::stoi(argv[++i]); }
+        else if (arg == "--sessions" && i+1 < argc) { onnx_opts.sessions = std::stoi(argv[++i]); }
+        else if (arg == "--precision" && i+1 < argc) { if (!parse_model_precision(argv[++i], onnx_opts.precision)) std::cerr << "unknown --precision, using fp32" << std::endl; }
+        else if (arg == "--validate-precision" && i+1 < argc) { validate_precision = argv[++i]; }
+        else if (arg == "--validate-samples" && i+1 < argc) { validate_samples = static_cast<size_t>(std::stoll(argv[++i])); }
+        else if (arg == "--min-cosine" && i+1 < argc) { min_cosine = std::stod(argv[++i]); }
+        else if (arg == "--output" && i+1 < argc) { output_format = argv[++i]; }
+        else if (arg == "--cache" && i+1 < argc) { cache_path = argv[++i]; }
+        else if (arg == "--no-cache") { cache_path.clear(); }
+        else if (arg == "--dedup" && i+1 < argc) { dedup_mode = argv[++i]; }
+        else if (arg == "--near-dup-bits" && i+1 < argc) { dedup_opts.max_distance = std::stoi(argv[++i]); }
+        else if (arg == "--metrics-port" && i+1 < argc) { metrics_port = std::stoi(argv[++i]); }
+        else if (arg == "--metrics-json" && i+1 < argc) { metrics_json = argv[++i]; }
+        else if (arg == "--metrics-interval-s" && i+1 < argc) { metrics_interval_s = std::stoi(argv[++i]); }
+        else if (arg == "--trace" && i+1 < argc) { trace_path = argv[++i]; }
+        else if (arg == "--trace-every" && i+1 < argc) { net_opts.trace_every = std::stoi(argv[++i]); }
+        else if (arg == "--encoding" && i+1 < argc) { encoding_name = argv[++i]; }
+        else if (arg == "--pq-codebook" && i+1 < argc) { pq_path = argv[++i]; }
+        else if (arg == "--train-pq" && i+1 < argc) { train_pq = argv[++i]; }
+        else if (arg == "--pq-subspaces" && i+1 < argc) { pq_subspaces = static_cast<size_t>(std::stoll(argv[++i])); }
+        else if (arg == "--eval-encodings") { eval_encodings = true; }
+        else if (arg == "--eval-queries" && i+1 < argc) { eval_queries = static_cast<size_t>(std::stoll(argv[++i])); }
+        else if (arg == "--decode-embeddings" && i+1 < argc) { decode_out = argv[++i]; }
+        else if (arg == "--embeddings" && i+1 < argc) { embeddings_in = argv[++i]; }
+        else if (arg == "--index") { build_index = true; }
+        else if (arg == "--scan-threads" && i+1 < argc) { scan_opts.threads = std::stoi(argv[++i]); }
+        else if (arg == "--manifest" && i+1 < argc) { scan_opts.manifest = argv[++i]; }
+        else if (arg == "--no-manifest") { scan_opts.manifest.clear(); }
+        else if (arg == "--index-lists" && i+1 < argc) { index_opts.lists = static_cast<size_t>(std::stoll(argv[++i])); }
     }
+    pipe_opts.batch = batch_policy;
+    ByteBudget ingest_budget(ingest_budget_mb << 20);
 
-    std::queue<Result> results_q;
+    // Producers append whole batches and the writer swaps the vector out, so the lock is taken
+    // once per batch on each side rather than once per row.
+    std::vector<Result> results_q;
     std::mutex results_mtx;
     std::condition_variable cv_results;
     bool writer_done = false;
 
     fs::path model_path = fs::path("models") / "vggface2_resnet50.onnx";
+    const size_t target_dim = 512;
+
+    // Validation mode: compare a reduced-precision model with FP32 on a sample of the images and
+    // exit; non-zero if the mean cosine similarity is below --min-cosine.
+    if (!validate_precision.empty()) {
+        ModelPrecision variant;
+        if (!parse_model_precision(validate_precision, variant) || variant == ModelPrecision::FP32) { std::cerr << "--validate-precision takes fp16 or int8" << std::endl; return 2; }
+#if defined(DIP_HAS_ONNX)
+        std::vector<std::pair<std::string, fs::path>> all;
+        ScanOptions sample_scan = scan_opts;
+        sample_scan.manifest.clear();
+        ImageScanner scanner(image_root.string(), sample_scan);
+        scanner.start();
+        for (ScannedImage img; scanner.next(img);) all.emplace_back(img.label, img.path);
+        // Scanner threads finish in any order; sorted so the sample is the same every run.
+        std::sort(all.begin(), all.end(), [](auto& a, auto& b){ return a.second < b.second; });
+        // Evenly strided, so the sample spans labels and nearest-neighbour checks have matches.
+        std::vector<PrecisionSample> samples;
+        size_t n = std::min(validate_samples, all.size());
+        for (size_t i=0; i<n; ++i) {
+            auto& [label, path] = all[i * all.size() / n];
+            std::ifstream f(path, std::ios::binary);
+            samples.push_back(PrecisionSample{label, std::vector<unsigned char>(std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>())});
+        }
+        auto r = check_precision(model_path.string(), variant, gpu_workers > 0 ? ProviderPref::CUDA : ProviderPref::CPU, onnx_opts, samples, batch_policy.max_batch);
+        if (!r) { std::cerr << "validation failed: cannot load both models or decode any sample" << std::endl; return 1; }
+        std::cout << std::fixed << std::setprecision(1) << "validate " << validate_precision << " vs fp32 on " << r->images << " images (" << (gpu_workers > 0 ? "cuda" : "cpu") << ", batch " << batch_policy.max_batch << ")\n"
+                  << "  throughput: fp32 " << r->fp32_images_per_s << " img/s, " << validate_precision << " " << r->variant_images_per_s << " img/s ("
+                  << std::setprecision(2) << (r->fp32_images_per_s > 0 ? r->variant_images_per_s / r->fp32_images_per_s : 0.0) << "x)\n"
+                  << std::setprecision(4) << "  cosine to fp32: mean " << r->cos_mean << " p1 " << r->cos_p01 << " min " << r->cos_min << "\n"
+                  << std::setprecision(3) << "  nearest neighbour unchanged: " << r->nn_agreement << ", same label: fp32 " << r->label_nn_fp32 << " " << validate_precision << " " << r->label_nn_variant << std::endl;
+        return r->cos_mean >= min_cosine ? 0 : 1;
+#else
+        (void)validate_samples; (void)min_cosine;
+        std::cerr << "ERROR: Built without ONNX Runtime. Reconfigure with USE_ONNXRUNTIME=ON." << std::endl;
+        return 1;
+#endif
+    }
+
+    // Embedding encodings: results travel from workers and are stored in the .npy sink in this
+    // encoding (embeddings.csv stays decimal text). PQ needs a codebook, trained from an earlier
+    // run's embeddings with --train-pq.
+    EmbeddingEncoding encoding;
+    if (!parse_embedding_encoding(encoding_name, encoding)) { std::cerr << "unknown --encoding " << encoding_name << " (f32, f16, i8 or pq)" << std::endl; return 2; }
+    std::shared_ptr<ProductQuantizer> pq;
+    if (!pq_path.empty() && train_pq.empty()) {
+        pq = std::make_shared<ProductQuantizer>();
+        if (!pq->load(pq_path)) { std::cerr << "cannot load PQ codebook " << pq_path << std::endl; return 2; }
+    }
+    if (encoding == EmbeddingEncoding::PQ && train_pq.empty() && (!pq || pq->dim() != target_dim)) { std::cerr << "--encoding pq needs a " << target_dim << "-d --pq-codebook" << std::endl; return 2; }
+
+    // Offline modes on an earlier run's output (.npy with its index, or embeddings.csv): train a
+    // PQ codebook, decode a compact .npy to float32, or report what each encoding costs in bytes
+    // and in retrieval quality against the labels.
+    if (!train_pq.empty() || !decode_out.empty() || eval_encodings) {
+        if (embeddings_in.empty()) embeddings_in = (output_dir / (fs::exists(output_dir / "embeddings.npy") ? "embeddings.npy" : "embeddings.csv")).string();
+        LabeledEmbeddings set;
+        if (!load_labeled_embeddings(embeddings_in, pq.get(), set)) { std::cerr << "cannot read embeddings from " << embeddings_in << (pq ? "" : " (pq files need --pq-codebook)") << std::endl; return 1; }
+        std::cout << "read " << set.rows() << " embeddings (" << set.dim << "-d) from " << embeddings_in << std::endl;
+        if (!train_pq.empty()) {
+            auto t0 = std::chrono::steady_clock::now();
+            ProductQuantizer trained;
+            if (!trained.train(set.data.data(), set.rows(), set.dim, pq_subspaces)) { std::cerr << "cannot train PQ: need at least " << ProductQuantizer::kCentroids << " rows and a dimension divisible by " << pq_subspaces << std::endl; return 1; }
+            if (!trained.save(train_pq)) { std::cerr << "cannot write " << train_pq << std::endl; return 1; }
+            std::cout << "PQ codebook " << pq_subspaces << "x" << ProductQuantizer::kCentroids << " (" << pq_subspaces << " B/embedding) -> " << train_pq << " in "
+                      << std::fixed << std::setprecision(1) << std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count() << "s" << std::endl;
+            pq = std::make_shared<ProductQuantizer>(std::move(trained));
+        }
+        if (!decode_out.empty()) {
+            fs::path out(decode_out);
+            {
+                NpyEmbeddingWriter w(out.string(), "", set.dim);
+                for (size_t r=0; r<set.rows(); ++r) w.append(set.labels[r], "", set.data.data() + r * set.dim, set.dim);
+                if (!w.good()) { std::cerr << "cannot write " << decode_out << std::endl; return 1; }
+            }
+            // Rows keep their order, so the source index still describes the decoded file.
+            fs::path in(embeddings_in);
+            if (in.extension() == ".npy") {
+                std::error_code ec;
+                fs::copy_file(fs::path(in).replace_extension(".index.csv"), fs::path(out).replace_extension(".index.csv"), fs::copy_options::overwrite_existing, ec);
+            }
+            std::cout << "decoded " << set.rows() << " rows -> " << decode_out << std::endl;
+        }
+        if (eval_encodings) {
+            std::cout << "encodings vs float32 search over " << set.rows() << " rows, " << std::min(eval_queries, set.rows()) << " queries:" << std::endl;
+            for (auto e : {EmbeddingEncoding::F32, EmbeddingEncoding::F16, EmbeddingEncoding::I8, EmbeddingEncoding::PQ}) {
+                if (e == EmbeddingEncoding::PQ && (!pq || pq->dim() != set.dim)) { std::cout << "  pq    (no " << set.dim << "-d codebook; pass --pq-codebook or --train-pq)" << std::endl; continue; }
+                auto r = evaluate_encoding(set, e, pq.get(), eval_queries);
+                std::cout << "  " << std::left << std::setw(5) << embedding_encoding_name(e) << std::right << std::setw(5) << r.bytes_per_embedding << " B/embedding"
+                          << std::fixed << std::setprecision(4) << "  cosine " << r.cos_mean << std::setprecision(3) << "  recall@10 " << r.recall_at_10 << "  same-label nn " << r.label_nn << std::endl;
+            }
+        }
+        return 0;
+    }
+#if defined(DIP_HAS_NETWORKING)
+    net_opts.pq = pq;
+    net_opts.result_format = encoding == EmbeddingEncoding::F16 ? ResultFormat::BinF16 : encoding == EmbeddingEncoding::I8 ? ResultFormat::BinI8 : encoding == EmbeddingEncoding::PQ ? ResultFormat::BinPQ : ResultFormat::BinF32;
+#endif
+
+    // Embeddings keyed by image content and the model file's fingerprint: unchanged images skip
+    // the workers on reruns and go straight to the writer.
+    EmbeddingCache cache;
+    std::atomic<size_t> cache_hits{0}, cache_misses{0};
+    if (!cache_path.empty()) {
+        // Keyed on the variant actually loaded, so FP32 and INT8 embeddings never mix.
+        std::string variant_path = model_variant_path(model_path.string(), onnx_opts.precision);
+        uint64_t fp = file_fingerprint(variant_path);
+        if (fp == 0) std::cerr << "cache disabled: cannot read " << variant_path << std::endl;
+        else if (!cache.open(cache_path, fp, target_dim)) std::cerr << "cache disabled: cannot open " << cache_path << std::endl;
+        else std::cout << "cache " << cache_path << ": " << cache.loaded() << " embeddings for model " << std::hex << fp << std::dec << std::endl;
+    }
+    auto push_result = [&](Result r){
+        {
+            std::lock_guard<std::mutex> g(results_mtx);
+            results_q.push_back(std::move(r));
+        }
+        cv_results.notify_one();
+    };
+    // Exact (content hash) and optionally near (perceptual hash) duplicates within the run reuse
+    // their canonical image's embedding but still get their own row.
+    std::unique_ptr<Deduper> dedup;
+    if (dedup_mode == "exact" || dedup_mode == "near") {
+        dedup_opts.near = (dedup_mode == "near");
+        dedup.reset(new Deduper(dedup_opts));
+    }
+    auto emit_duplicates = [&](const std::vector<Deduper::Item>& dups, const std::vector<float>* emb){
+        for (auto& d : dups) {
+            if (emb) push_result(Result{d.label, fs::path(d.path), *emb, ContentKey{}, false, false});
+            processed++;
+        }
+    };
+    // Resolves an image from the cache or as a duplicate; returns false if it must be inferred,
+    // with `key` set whenever the cache or dedup is on.
+    auto try_skip = [&](const std::string& label, const fs::path& path, const MappedFile& file, ContentKey& key) {
+        if (!cache.is_open() && !dedup) return false;
+        key = content_key(file.data(), file.size());
+        std::vector<float> emb;
+        if (cache.is_open()) {
+            if (cache.lookup(key, emb)) {
+                cache_hits++;
+                push_result(Result{label, path, std::move(emb), key, false, false});
+                processed++;
+                return true;
+            }
+            cache_misses++;
+        }
+        if (!dedup) return false;
+        uint64_t phash = 0;
+        bool has_phash = dedup_opts.near && perceptual_hash(file.data(), file.size(), phash);
+        auto verdict = dedup->check(key, has_phash ? &phash : nullptr, Deduper::Item{label, path.string()}, emb);
+        if (verdict == Deduper::Verdict::Unique) return false;
+        if (verdict == Deduper::Verdict::Ready) { push_result(Result{label, path, std::move(emb), ContentKey{}, false, false}); processed++; }
+        return true;
+    };
+
+    // Local mode: the producer thread reads files (I/O stage) into the decode pool, which hands
+    // float tensors to one inference thread per local worker.
+    InferencePipeline<Job> pipeline(pipe_opts, [&](std::vector<Job>& jobs, std::vector<std::optional<InferenceResult>>& res){
+        thread_local std::vector<Result> batch;
+        batch.clear();
+        for (size_t i=0; i<jobs.size(); ++i) {
+            auto& job = jobs[i];
+            if (res[i] && !res[i]->embedding.empty()) batch.push_back(Result{std::move(job.label), std::move(job.path), std::move(res[i]->embedding), job.key, cache.is_open(), dedup != nullptr});
+            else if (dedup) emit_duplicates(dedup->fail(job.key), nullptr);
+        }
+        if (!batch.empty()) {
+            {
+                std::lock_guard<std::mutex> g(results_mtx);
+                for (auto& r : batch) results_q.push_back(std::move(r));
+            }
+            cv_results.notify_one();
+        }
+        processed += jobs.size();
+    });
+    int pipeline_metrics = add_metrics_collector([&](std::vector<MetricSample>& out){
+        out.push_back({"dip_images_processed", "", double(processed.load())});
+        out.push_back({"dip_images_found", "", double(total)});
+        if (net_mode) return;
+        auto d = pipeline.depths();
+        out.push_back({"dip_pipeline_decode_queue", "", double(d.decode_queue)});
+        out.push_back({"dip_pipeline_decoding", "", double(d.decoding)});
+        out.push_back({"dip_pipeline_infer_queue", "", double(d.infer_queue)});
+        out.push_back({"dip_pipeline_inferring", "", double(d.inferring)});
+        out.push_back({"dip_ingest_bytes", "", double(ingest_budget.used())});
+    });
+#if defined(DIP_HAS_NETWORKING)
+    // Scrape endpoint on the master's bind address; 0 = off.
+    MetricsServer metrics_server(bind, static_cast<uint16_t>(metrics_port));
+    if (metrics_port > 0 && !metrics_server.start()) std::cerr << "cannot serve metrics on port " << metrics_port << std::endl;
+#endif
+    // Periodic JSON snapshot for runs nobody scrapes; the last one is written at exit.
+    std::atomic<bool> metrics_stop{false};
+    std::thread metrics_thr;
+    if (!metrics_json.empty()) {
+        metrics_thr = std::thread([&]{
+            int ticks = 0;
+            while (!metrics_stop.load()) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+                if (++ticks >= std::max(1, metrics_interval_s) * 10) { ticks = 0; write_metrics_snapshot(metrics_json); }
+            }
+        });
+    }
 
+    // Images stream from the parallel scanner, so work starts with the first directory listed.
+    auto report_scan = [&](const ImageScanner& scanner){
+        auto st = scanner.stats();
+        std::cout << "scan: " << st.images << " images in " << st.dirs << " directories (" << st.dirs_reused << " unchanged since the manifest) in "
+                  << std::fixed << std::setprecision(1) << st.seconds << "s" << (st.manifest_written ? ", manifest " + scan_opts.manifest : std::string()) << std::endl;
+    };
     auto producer = std::thread([&](){
-        for (auto& dir : fs::directory_iterator(image_root)) {
-            if (!dir.is_directory()) continue;
-            std::string dirname = dir.path().filename().string();
-            std::string label = dirname;
-            if (label.rfind("pin_", 0) == 0) label = label.substr(4);
-            for (auto& entry : fs::recursive_directory_iterator(dir.path())) {
-                if (!entry.is_regular_file()) continue;
-                auto ext = entry.path().extension().string();
-                for (auto& c : ext) c = std::tolower(c);
-                if (ext != ".jpg" && ext != ".jpeg" && ext != ".png") continue;
-                auto bytes = read_file_bytes(entry.path());
-                if (!net_mode) {
-                    {
-                        std::lock_guard<std::mutex> lk(mtx);
-                        jobs.push(Job{label, entry.path(), std::move(bytes)});
-                        total++;
-                    }
-                    cvq.notify_one();
-                }
+        if (!net_mode) {
+            ImageScanner scanner(image_root.string(), scan_opts);
+            scanner.start();
+            for (ScannedImage img; scanner.next(img);) {
+                Job job{img.label, fs::path(img.path), MappedFile(), ingest_budget.acquire(static_cast<size_t>(img.size)), ContentKey{}};
+                // Only the open and map; page faults are charged to decode.
+                { StageTimer t(Stage::FileRead); job.file.open(img.path); }
+                total++;
+                if (try_skip(img.label, job.path, job.file, job.key)) continue;
+                pipeline.push(std::move(job));
             }
+            report_scan(scanner);
         }
         done = true;
-        cvq.notify_all();
+        pipeline.close();
     });
 
-    auto worker_fn = [&](bool use_cuda){
-        std::unique_ptr<IInferenceBackend> backend;
+    auto make_backend = [&](bool use_cuda) -> std::unique_ptr<IInferenceBackend> {
 #if defined(DIP_HAS_ONNX)
-        backend.reset(new OnnxRuntimeBackend(use_cuda ? ProviderPref::CUDA : ProviderPref::CPU));
+        std::unique_ptr<IInferenceBackend> backend(new OnnxRuntimeBackend(use_cuda ? ProviderPref::CUDA : ProviderPref::CPU, onnx_opts));
         if (!backend->init(model_path.string())) {
             std::cerr << "ERROR: ONNX backend init failed for provider=" << (use_cuda?"cuda":"cpu") << std::endl;
-            return;
+            return nullptr;
         }
+        std::cout << "inference thread ready provider=" << (use_cuda?"cuda":"cpu") << " after "
+                  << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start_time).count() << " ms" << std::endl;
+        return backend;
 #else
+        (void)use_cuda; (void)start_time;
         std::cerr << "ERROR: Built without ONNX Runtime. Reconfigure with USE_ONNXRUNTIME=ON." << std::endl;
-        return;
+        return nullptr;
 #endif
-        while (true) {
-            Job job;
-            {
-                std::unique_lock<std::mutex> lk(mtx);
-                cvq.wait(lk, [&]{ return !jobs.empty() || done.load(); });
-                if (jobs.empty()) {
-                    if (done.load()) break;
-                    else continue;
-                }
-                job = std::move(jobs.front());
-                jobs.pop();
-            }
-            auto res = backend->infer(job.bytes);
-            if (res && !res->embedding.empty()) {
-                {
-                    std::lock_guard<std::mutex> g(results_mtx);
-                    results_q.push(Result{job.label, job.path, res->embedding});
-                }
-                cv_results.notify_one();
-            }
-            processed++;
-        }
     };
 
-    std::vector<std::thread> threads;
     if (!net_mode) {
-        for (int i=0; i<gpu_workers; ++i) threads.emplace_back(worker_fn, true);
-        for (int i=0; i<cpu_workers; ++i) threads.emplace_back(worker_fn, false);
+        for (int i=0; i<gpu_workers; ++i) pipeline.add_inference([&]{ return make_backend(true); });
+        for (int i=0; i<cpu_workers; ++i) pipeline.add_inference([&]{ return make_backend(false); });
     }
 
+    std::atomic<dip::NetMaster*> net_master{nullptr};
     auto progress_thr = std::thread([&]{
         while (!done.load() || processed.load() < total) {
             size_t p = processed.load();
             size_t t = total;
             double pct = t ? (100.0 * double(p) / double(t)) : 0.0;
-            std::cout << "progress " << p << "/" << t << " (" << std::fixed << std::setprecision(1) << pct << "%)" << std::endl;
+            std::cout << "progress " << p << "/" << t << " (" << std::fixed << std::setprecision(1) << pct << "%)";
+            if (!net_mode) {
+                auto d = pipeline.depths();
+                size_t pending;
+                { std::lock_guard<std::mutex> g(results_mtx); pending = results_q.size(); }
+                std::cout << " queues decode=" << d.decode_queue << "+" << d.decoding << " infer=" << d.infer_queue << "+" << d.inferring << " write=" << pending
+                          << " ingest=" << (ingest_budget.used() >> 20) << "/" << (ingest_budget.limit() >> 20) << "MB";
+            } else if (auto* nm = net_master.load()) {
+                // Per worker: measured rate and the window the master sized from it.
+                std::cout << " queued=" << nm->queued();
+                auto ts = nm->task_stats();
+                if (ts.requeued || ts.speculative || ts.worker_failed) std::cout << " retried=" << ts.requeued << " (expired " << ts.expired << ") backups=" << ts.speculative << " dup=" << ts.duplicates << " worker_failed=" << ts.worker_failed;
+                if (ts.preresized) std::cout << " preresized=" << ts.preresized << " (" << (ts.preresize_file_bytes >> 20) << "->" << (ts.preresize_sent_bytes >> 20) << "MB)";
+                for (auto& w : nm->worker_stats())
+                    std::cout << " " << w.worker_id << "[" << w.provider << " " << std::setprecision(0) << w.rate << "/s " << w.latency_ms << "ms w=" << w.window << "]" << std::setprecision(1);
+            }
+            std::cout << std::endl;
             std::this_thread::sleep_for(std::chrono::milliseconds(500));
         }
     });
 
-    const size_t target_dim = 512;
-    bool header_written = false;
+    // csv: output/embeddings.csv; npy: output/embeddings.npy + embeddings.index.csv; both: all three.
+    std::unique_ptr<CsvWriter> csv;
+    std::unique_ptr<NpyEmbeddingWriter> npy;
+    if (output_format != "npy") {
+        csv.reset(new CsvWriter((output_dir / "embeddings.csv").string()));
+        std::vector<std::string> header;
+        header.push_back("label");
+        header.push_back("path");
+        for (size_t i = 0; i < target_dim; ++i) header.push_back(std::string("e") + std::to_string(i));
+        csv->write_header(header);
+    }
+    if (output_format == "npy" || output_format == "both") {
+        npy.reset(new NpyEmbeddingWriter((output_dir / "embeddings.npy").string(), (output_dir / "embeddings.index.csv").string(), target_dim, encoding, pq.get()));
+        // PQ codes are meaningless without their codebook, so a copy travels with them.
+        std::error_code ec;
+        if (encoding == EmbeddingEncoding::PQ) fs::copy_file(pq_path, output_dir / "embeddings.pq", fs::copy_options::overwrite_existing, ec);
+    }
+    // Reduce stage: every written row also goes to the ANN index builder, which clusters and
+    // writes output/embeddings.ivf once the run ends (see the query tool).
+    std::unique_ptr<IvfIndexBuilder> index;
+    if (build_index) index.reset(new IvfIndexBuilder((output_dir / "embeddings.ivf").string(), target_dim, index_opts));
     auto writer_thr = std::thread([&]{
+        std::vector<Result> drained;
         while (true) {
             std::unique_lock<std::mutex> lk(results_mtx);
             cv_results.wait(lk, [&]{ return !results_q.empty() || (done.load() && writer_done); });
@@ -163,103 +488,161 @@ int main(int argc, char** argv) {
                 if (done.load() && writer_done) break;
                 continue;
             }
-            auto r = std::move(results_q.front());
-            results_q.pop();
+            drained.clear();
+            drained.swap(results_q);
             lk.unlock();
-            if (!header_written) {
-                std::vector<std::string> header;
-                header.push_back("label");
-                header.push_back("path");
-                for (size_t i = 0; i < target_dim; ++i) header.push_back(std::string("e") + std::to_string(i));
-                csv.write_header(header);
-                header_written = true;
+            for (auto& r : drained) {
+                std::string path = r.path.string();
+                if (csv) { StageTimer t(Stage::CsvWrite); csv->write_embedding_row(r.label, path, r.embedding.data(), r.embedding.size(), target_dim); }
+                if (npy) npy->append(r.label, path, r.embedding.data(), r.embedding.size());
+                if (index) index->add(r.label, path, r.embedding.data(), r.embedding.size());
+                if (r.cache_new) cache.insert(r.key, r.embedding.data(), r.embedding.size());
+                if (r.canonical) {
+                    for (auto& d : dedup->complete(r.key, r.embedding)) {
+                        std::string dpath = fs::path(d.path).string();
+                        if (csv) { StageTimer t(Stage::CsvWrite); csv->write_embedding_row(d.label, dpath, r.embedding.data(), r.embedding.size(), target_dim); }
+                        if (npy) npy->append(d.label, dpath, r.embedding.data(), r.embedding.size());
+                        if (index) index->add(d.label, dpath, r.embedding.data(), r.embedding.size());
+                        processed++;
+                    }
+                }
             }
-            std::vector<float> vec = r.embedding;
-            if (vec.size() > target_dim) vec.resize(target_dim);
-            if (vec.size() < target_dim) vec.insert(vec.end(), target_dim - vec.size(), 0.0f);
-            std::vector<std::string> row;
-            row.push_back(r.label);
-            row.push_back(r.path.string());
-            row.reserve(2 + target_dim);
-            for (auto v : vec) { std::ostringstream oss; oss.precision(6); oss << std::fixed << v; row.push_back(oss.str()); }
-            csv.write_row(row);
         }
     });
 
+    // Net mode: content keys of dispatched cache misses, by path, until their result arrives.
+    std::unordered_map<std::string, ContentKey> pending_keys;
+    std::mutex pending_mtx;
+    // Sampled per-task spans from the master and its workers, written when the run ends.
+    TraceWriter trace;
     if (net_mode) {
         dip::NetMaster nm(bind, port, [&](const std::string& label, const std::string& path, const std::vector<float>& emb){
+            Result r{label, fs::path(path), emb, ContentKey{}, false, false};
+            if (cache.is_open() || dedup) {
+                std::lock_guard<std::mutex> g(pending_mtx);
+                auto it = pending_keys.find(path);
+                if (it != pending_keys.end()) { r.key = it->second; r.cache_new = cache.is_open(); r.canonical = dedup != nullptr; pending_keys.erase(it); }
+            }
+            push_result(std::move(r));
+            processed++;
+        }, net_opts);
+        nm.set_on_failed([&](const dip::NetJob& job){
+            ContentKey key;
+            bool known = false;
             {
-                std::lock_guard<std::mutex> g(results_mtx);
-                results_q.push(Result{label, fs::path(path), emb});
+                std::lock_guard<std::mutex> g(pending_mtx);
+                auto it = pending_keys.find(job.path);
+                if (it != pending_keys.end()) { key = it->second; known = true; pending_keys.erase(it); }
             }
-            cv_results.notify_one();
+            if (known && dedup) emit_duplicates(dedup->fail(key), nullptr);
             processed++;
         });
+        if (!trace_path.empty()) nm.set_trace(&trace);
+        net_master = &nm;
+        int master_metrics = add_metrics_collector([&](std::vector<MetricSample>& out){
+            out.push_back({"dip_queued_tasks", "", double(nm.queued())});
+            auto ts = nm.task_stats();
+            out.push_back({"dip_tasks_requeued_total", "", double(ts.requeued)});
+            out.push_back({"dip_tasks_expired_total", "", double(ts.expired)});
+            out.push_back({"dip_tasks_speculative_total", "", double(ts.speculative)});
+            out.push_back({"dip_results_duplicate_total", "", double(ts.duplicates)});
+            out.push_back({"dip_tasks_worker_failed_total", "", double(ts.worker_failed)});
+            out.push_back({"dip_tasks_preresized_total", "", double(ts.preresized)});
+            out.push_back({"dip_preresize_file_bytes_total", "", double(ts.preresize_file_bytes)});
+            out.push_back({"dip_preresize_sent_bytes_total", "", double(ts.preresize_sent_bytes)});
+            for (auto& w : nm.worker_stats()) {
+                std::string l = "worker=\"" + w.worker_id + "\",provider=\"" + w.provider + "\"";
+                out.push_back({"dip_worker_completed_total", l, double(w.completed)});
+                out.push_back({"dip_worker_rate", l, w.rate});
+                out.push_back({"dip_worker_latency_seconds", l, w.latency_ms / 1000.0});
+                out.push_back({"dip_worker_window", l, double(w.window)});
+                out.push_back({"dip_worker_in_flight", l, double(w.in_flight)});
+            }
+        });
         std::thread server_thr([&]{ nm.run(); });
         std::this_thread::sleep_for(std::chrono::milliseconds(200));
-        auto start_local_worker = [&](bool prefer_cuda, int idx){
-            std::thread([&, prefer_cuda, idx]{
-                dip::TcpClient c;
-                if (!c.connect("127.0.0.1", port)) return;
-                std::string wid = std::string(prefer_cuda?"local-gpu-":"local-cpu-") + std::to_string(idx);
-                std::string hello = std::string("type=hello\nworker_id=") + wid + std::string("\nprovider=") + (prefer_cuda?"cuda":"cpu") + std::string("\n");
-                c.send(hello);
-                std::unique_ptr<dip::IInferenceBackend> be(new dip::OnnxRuntimeBackend(prefer_cuda ? dip::ProviderPref::CUDA : dip::ProviderPref::CPU));
-                std::string model = (std::string("models/") + "vggface2_resnet50.onnx");
-                bool ok = be->init(model);
-                std::cout << "local " << wid << " initialized provider=" << (prefer_cuda && ok?"cuda":"cpu") << std::endl;
-                if (!ok && prefer_cuda) { be.reset(new dip::OnnxRuntimeBackend(dip::ProviderPref::CPU)); be->init(model); std::cout << "local " << wid << " fallback provider=cpu" << std::endl; }
-                while (true) {
-                    std::string msg;
-                    if (!c.read(msg)) break;
-                    if (msg.find("type=task") != std::string::npos) {
-                        auto getv = [&](const std::string& key){ auto k = key + "="; auto pos = msg.find(k); if (pos==std::string::npos) return std::string(); auto end = msg.find('\n', pos); return msg.substr(pos + k.size(), end == std::string::npos ? std::string::npos : end - (pos + k.size())); };
-                        auto base64 = getv("base64");
-                        auto label = getv("label");
-                        auto path = getv("path");
-                        auto id = getv("id");
-                        std::vector<unsigned char> bytes(base64.begin(), base64.end());
-                        auto res = be->infer(bytes);
-                        if (res) {
-                            std::ostringstream oss;
-                            oss << "type=result\nlabel=" << label << "\npath=" << path << "\nid=" << id << "\nembedding=";
-                            for (size_t i=0;i<res->embedding.size();++i){ if (i) oss << ","; oss << res->embedding[i]; }
-                            c.send(oss.str());
-                        }
-                    }
-                }
-            }).detach();
-        };
+        dip::NetWorkerOptions wopts;
+        wopts.port = port;
+        wopts.model_path = model_path.string();
+        wopts.name_prefix = "local-";
+        wopts.batch = batch_policy;
+        wopts.decode_threads = pipe_opts.decode_threads;
+        wopts.onnx = onnx_opts;
+        wopts.pq_codebook = pq_path;
+        wopts.read_ahead.depth = static_cast<int>(cfg.get_int("read_ahead", wopts.read_ahead.depth));
+        wopts.read_ahead.threads = static_cast<int>(cfg.get_int("read_threads", wopts.read_ahead.threads));
+        wopts.read_ahead.io_uring = cfg.get_bool("io_uring", wopts.read_ahead.io_uring);
         int lg = local_gpu_workers ? local_gpu_workers : gpu_workers;
         int lc = local_cpu_workers ? local_cpu_workers : cpu_workers;
-        for (int i=0;i<lg;++i) start_local_worker(true, i);
-        for (int i=0;i<lc;++i) start_local_worker(false, i);
-        for (auto& dir : fs::directory_iterator(image_root)) {
-            if (!dir.is_directory()) continue;
-            std::string dirname = dir.path().filename().string();
-            std::string label = dirname;
-            if (label.rfind("pin_", 0) == 0) label = label.substr(4);
-            for (auto& entry : fs::recursive_directory_iterator(dir.path())) {
-                if (!entry.is_regular_file()) continue;
-                auto ext = entry.path().extension().string();
-                for (auto& c : ext) c = std::tolower(c);
-                if (ext != ".jpg" && ext != ".jpeg" && ext != ".png") continue;
-                auto bytes = read_file_bytes(entry.path());
-                std::string b64(bytes.begin(), bytes.end());
-                dip::NetJob nj{label, entry.path().string(), b64, entry.path().string()};
-                nm.enqueue(nj);
-                total++;
+        dip::start_net_worker_group(wopts, true, lg);
+        dip::start_net_worker_group(wopts, false, lc);
+        ImageScanner scanner(image_root.string(), scan_opts);
+        scanner.start();
+        bool stopped = false;
+        for (ScannedImage img; scanner.next(img);) {
+            dip::NetJob nj{img.label, img.path, img.path};
+            if (cache.is_open() || dedup) {
+                MappedFile file;
+                ContentKey key;
+                { StageTimer t(Stage::FileRead); file.open(nj.path); }
+                if (try_skip(img.label, fs::path(img.path), file, key)) { total++; continue; }
+                std::lock_guard<std::mutex> g(pending_mtx);
+                pending_keys[nj.path] = key;
             }
+            if (!nm.enqueue(nj)) { scanner.stop(); stopped = true; break; }
+            total++;
         }
+        report_scan(scanner);
+        // Every image ends as a result, a skip or an on_failed, each counted in `processed`; the
+        // server runs until then.
+        while (!stopped && processed.load() < total) std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        nm.stop();
         server_thr.join();
         done = true;
+        // The progress thread reads nm's worker stats, so it must finish before nm goes away.
+        progress_thr.join();
+        remove_metrics_collector(master_metrics);
+        net_master = nullptr;
+        if (!trace_path.empty()) {
+            if (trace.write(trace_path)) std::cout << "trace: " << trace.spans() << " spans (" << trace.dropped() << " dropped) -> " << trace_path << std::endl;
+            else std::cerr << "cannot write trace " << trace_path << std::endl;
+        }
     }
     producer.join();
-    for (auto& th : threads) th.join();
-    progress_thr.join();
+    pipeline.join();
+    if (progress_thr.joinable()) progress_thr.join();
     writer_done = true;
     cv_results.notify_all();
     writer_thr.join();
-    std::cout << "Processed " << processed.load() << " images. CSV: " << (output_dir / "embeddings.csv").string() << std::endl;
+    if (npy) npy->close();
+    if (index && index->rows()) {
+        auto t0 = std::chrono::steady_clock::now();
+        size_t rows = index->rows();
+        if (index->finish()) std::cout << "index: " << rows << " vectors -> " << (output_dir / "embeddings.ivf").string() << " in " << std::fixed << std::setprecision(1)
+                                       << std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count() << "s" << std::endl;
+        else std::cerr << "cannot write " << (output_dir / "embeddings.ivf").string() << std::endl;
+    }
+    metrics_stop = true;
+    if (metrics_thr.joinable()) metrics_thr.join();
+    if (!metrics_json.empty() && !write_metrics_snapshot(metrics_json)) std::cerr << "cannot write " << metrics_json << std::endl;
+#if defined(DIP_HAS_NETWORKING)
+    metrics_server.stop();
+#endif
+    remove_metrics_collector(pipeline_metrics);
+    if (cache.is_open()) {
+        cache.flush();
+        size_t hits = cache_hits.load(), misses = cache_misses.load();
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+        std::cout << "cache: hits=" << hits << " misses=" << misses << " stored=" << cache.inserted();
+        // Saved time is estimated from this run's own rate for images that did go through inference.
+        if (misses) std::cout << " saved~" << std::fixed << std::setprecision(1) << elapsed / double(misses) * double(hits) << "s";
+        std::cout << std::endl;
+    }
+    if (dedup) {
+        size_t avoided = dedup->exact() + dedup->near();
+        std::cout << "dedup: exact=" << dedup->exact() << " near=" << dedup->near() << " inference avoided for " << avoided << " of " << total
+                  << " images (" << std::fixed << std::setprecision(1) << (total ? 100.0 * double(avoided) / double(total) : 0.0) << "%)" << std::endl;
+    }
+    std::cout << "Processed " << processed.load() << " images. Output: " << (output_dir / (npy && !csv ? "embeddings.npy" : "embeddings.csv")).string() << std::endl;
     return 0;
 }
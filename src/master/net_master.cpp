@@ -1,59 +1,532 @@
 #include <vector>
 #include <unordered_map>
-#include <queue>
+#include <deque>
+#include <thread>
 #include <mutex>
 #include <condition_variable>
 #include <string>
 #include <memory>
+#include <charconv>
+#include <filesystem>
+#include <algorithm>
+#include <string_view>
+#include <cmath>
+#include <limits>
 #include "networking/tcp_server.h"
 #include "networking/protocol.h"
+#include "common/metrics.h"
+#include "common/mapped_file.h"
+#include "inference/preprocess.h"
 #include "master/net_master.h"
 
 namespace dip {
-static std::string make_task_payload(const NetJob& job) {
+static std::string make_task_payload(const NetJob& job, bool traced) {
     std::string p;
     p += "type=task\n";
     p += "label=" + job.label + "\n";
     p += "id=" + job.id + "\n";
     p += "path=" + job.path + "\n";
+    if (traced) p += "trace=1\n";
     return p;
 }
-static bool parse_result(const std::string& msg, std::string& label, std::string& path, std::vector<float>& emb) {
-    if (msg.find("type=result") == std::string::npos) return false;
-    auto getv = [&](const std::string& key){ auto k = key + "="; auto pos = msg.find(k); if (pos==std::string::npos) return std::string(); auto end = msg.find('\n', pos); return msg.substr(pos + k.size(), end == std::string::npos ? std::string::npos : end - (pos + k.size())); };
-    label = getv("label"); path = getv("path"); std::string ecsv = getv("embedding");
-    emb.clear();
-    size_t start = 0;
-    while (start < ecsv.size()) { auto comma = ecsv.find(',', start); std::string tok = ecsv.substr(start, comma == std::string::npos ? std::string::npos : comma - start); if (!tok.empty()) emb.push_back(static_cast<float>(std::stod(tok))); if (comma == std::string::npos) break; start = comma + 1; }
+// Master takes its preferred format if offered (PQ only with the same codebook), else raw float32,
+// else whatever else the worker offered, then text.
+static ResultFormat negotiate_format(std::string_view offered, ResultFormat preferred, bool pq_ok) {
+    ResultFormat best = ResultFormat::Text;
+    bool found = false, f32 = false;
+    size_t pos = 0;
+    while (pos <= offered.size()) {
+        size_t comma = offered.find(',', pos);
+        if (comma == std::string_view::npos) comma = offered.size();
+        ResultFormat f;
+        if (parse_result_format(offered.substr(pos, comma - pos), f) && (f != ResultFormat::BinPQ || pq_ok)) {
+            if (f == preferred) return f;
+            f32 |= f == ResultFormat::BinF32;
+            if (!found) { best = f; found = true; }
+        }
+        pos = comma + 1;
+    }
+    return f32 ? ResultFormat::BinF32 : best;
+}
+NetMaster::NetMaster(const std::string& bind_addr, uint16_t port, OnResult on_result, const NetMasterOptions& opts) : on_result_(on_result), opts_(opts) {
+    server_.reset(new TcpServer(bind_addr, port, [this](std::string_view m, ConnId c){ on_message(m,c); }, opts_.io_threads));
+    server_->set_on_close([this](ConnId c){ on_close(c); });
+    if (opts_.ship_bytes && opts_.preresize_ratio > 0) {
+        // Each entry is a task already counted in a worker's window, so the windows bound it.
+        preresize_q_.reset(new BoundedQueue<Preresize>(std::numeric_limits<size_t>::max()));
+        for (int i=0; i<std::max(1, opts_.preresize_threads); ++i) preresizers_.emplace_back([this]{ preresize_loop(); });
+    }
+}
+NetMaster::~NetMaster() { stop(); }
+bool NetMaster::enqueue(const NetJob& job) {
+    ConnId idle = 0;
+    {
+        std::unique_lock<std::mutex> lk(mtx_);
+        if (opts_.max_queued_jobs) space_cv_.wait(lk, [&]{ return jobs_.size() < opts_.max_queued_jobs || stopping_; });
+        if (stopping_) return false;
+        auto& t = tasks_[job.id];
+        t = TaskState{};
+        t.job = job;
+        t.queued_at = Clock::now();
+        jobs_.push_back(job.id);
+        // Round-robin over parked workers; send_next re-parks one that still has spare credit.
+        while (!idle_.empty() && !idle) {
+            ConnId c = idle_.front(); idle_.pop_front();
+            auto it = workers_.find(c);
+            if (it == workers_.end()) continue;
+            it->second.parked = false;
+            if (it->second.in_flight < it->second.window) idle = c;
+        }
+    }
+    if (idle) send_next(idle);
     return true;
 }
-NetMaster::NetMaster(const std::string& bind_addr, uint16_t port, OnResult on_result) : on_result_(on_result) {
-    server_ = new TcpServer(bind_addr, port, [this](const std::string& m, SOCKET s){ on_message(m,s); });
-}
-void NetMaster::enqueue(const NetJob& job) { std::lock_guard<std::mutex> lk(mtx_); jobs_.push(job); }
-void NetMaster::run() { server_->start(); }
-void NetMaster::on_message(const std::string& msg, SOCKET sock) {
-    if (msg.find("type=hello") != std::string::npos) {
-        workers_[sock] = 0;
-        send_next(sock);
-    } else if (msg.find("type=result") != std::string::npos) {
-        std::string label, path; std::vector<float> emb;
-        if (parse_result(msg, label, path, emb)) { on_result_(label, path, emb); }
-        workers_[sock] = 0;
-        OutputDebugStringA("master: result received\n");
-        send_next(sock);
-    }
-}
-void NetMaster::send_next(SOCKET sock) {
-    NetJob job;
+size_t NetMaster::queued() const { std::lock_guard<std::mutex> lk(mtx_); return jobs_.size(); }
+std::vector<NetWorkerStats> NetMaster::worker_stats() const {
+    std::lock_guard<std::mutex> lk(mtx_);
+    std::vector<NetWorkerStats> out;
+    for (auto& [conn, w] : workers_) out.push_back(NetWorkerStats{w.worker_id, w.provider, w.completed, w.rate, w.latency * 1000.0, w.window, w.in_flight});
+    return out;
+}
+NetTaskStats NetMaster::task_stats() const { std::lock_guard<std::mutex> lk(mtx_); return task_stats_; }
+void NetMaster::set_on_failed(OnFailed on_failed) { on_failed_ = on_failed; }
+void NetMaster::set_trace(TraceWriter* trace) {
+    std::lock_guard<std::mutex> lk(mtx_);
+    trace_ = trace;
+    if (trace_ && !trace_pid_) trace_pid_ = trace_->add_process("master");
+}
+void NetMaster::run() {
+    if (!reaper_.joinable()) reaper_ = std::thread([this]{ reap_loop(); });
+    server_->start();
+}
+void NetMaster::stop() {
+    { std::lock_guard<std::mutex> lk(mtx_); stopping_ = true; }
+    space_cv_.notify_all();
+    reap_cv_.notify_all();
+    server_->stop();
+    if (reaper_.joinable() && reaper_.get_id() != std::this_thread::get_id()) reaper_.join();
+    if (preresize_q_) preresize_q_->close();
+    for (auto& t : preresizers_) if (t.joinable() && t.get_id() != std::this_thread::get_id()) t.join();
+}
+void NetMaster::on_message(std::string_view msg, ConnId conn) {
+    thread_local std::vector<float> emb;
+    if (is_binary_frame(msg)) {
+        FrameView v;
+        // Unparseable frames (e.g. a newer version) carry no id to free a slot with; like
+        // undecodable codes, they leave the task to its lease.
+        if (!parse_result_frame(msg, v)) { net_log(("master: cannot parse result frame (" + std::to_string(msg.size()) + " bytes)\n").c_str()); return; }
+        // Decoded before claiming, so undecodable codes leave the task to its lease and a retry.
+        bool ok;
+        { StageTimer timer(Stage::Deserialize); ok = decode_embedding(v, emb, opts_.pq.get()); }
+        if (!ok) net_log(("master: cannot decode result " + std::string(v.id) + "\n").c_str());
+        else if (claim_result(v.id)) on_result_(std::string(v.label), std::string(v.path), emb);
+        on_result_done(conn, v.id);
+        return;
+    }
+    auto type = get_text_field(msg, "type");
+    if (type == "hello") {
+        int credits = 1;
+        auto cv = get_text_field(msg, "credits");
+        std::from_chars(cv.data(), cv.data() + cv.size(), credits);
+        {
+            std::lock_guard<std::mutex> lk(mtx_);
+            auto& w = workers_[conn];
+            w.credits = std::max(1, std::min(credits, opts_.max_credits));
+            // Slow start: two tasks until the first rate sample, so an unmeasured laptop cannot
+            // take a full window of work a GPU box would have finished first.
+            w.window = std::min(2, w.credits);
+            auto modes = get_text_field(msg, "task_modes");
+            w.accepts_data = modes.find("data") != std::string_view::npos;
+            w.accepts_rgb8 = modes.find("rgb8") != std::string_view::npos;
+            w.worker_id = std::string(get_text_field(msg, "worker_id"));
+            w.provider = std::string(get_text_field(msg, "provider"));
+            if (w.provider.empty()) w.provider = "unknown";
+            w.traces = get_text_field(msg, "trace") == "1";
+            if (trace_ && w.traces) w.trace_pid = trace_->add_process(w.worker_id + " (" + w.provider + ")");
+            net_log(("master: worker " + w.worker_id + " provider=" + w.provider + " credits=" + std::to_string(w.credits) + "\n").c_str());
+        }
+        // Workers that predate binary results send no result_formats and never get a welcome.
+        auto offered = get_text_field(msg, "result_formats");
+        bool pq_ok = false;
+        if (opts_.pq) {
+            uint64_t fp = 0;
+            auto fv = get_text_field(msg, "pq_codebook");
+            pq_ok = std::from_chars(fv.data(), fv.data() + fv.size(), fp, 16).ec == std::errc() && fp == opts_.pq->fingerprint();
+        }
+        if (!offered.empty()) server_->send(conn, std::string("type=welcome\nresult_format=") + result_format_name(negotiate_format(offered, opts_.result_format, pq_ok)) + "\n");
+        send_next(conn);
+    } else if (type == "result") {
+        std::string label, path;
+        bool ok = false;
+        if (claim_result(get_text_field(msg, "id"))) { StageTimer timer(Stage::Deserialize); ok = parse_text_result(msg, label, path, emb); }
+        if (ok) on_result_(label, path, emb);
+        on_result_done(conn, get_text_field(msg, "id"));
+    } else if (type == "trace") {
+        on_trace(msg, conn);
+    } else if (type == "failed") {
+        on_task_failed(conn, get_text_field(msg, "id"));
+    }
+}
+// Worker spans for a traced task. The task's send and result times on both clocks give one NTP-style
+// sample of the worker's clock offset; the sample with the least unexplained delay so far is used.
+// The network legs are drawn on the master's row from that offset, so they are estimates.
+void NetMaster::on_trace(std::string_view msg, ConnId conn) {
+    std::string id;
+    int64_t recv_us = 0, sent_us = 0;
+    std::vector<TraceSpan> spans;
+    if (!parse_trace_message(msg, id, recv_us, sent_us, spans)) return;
+    std::lock_guard<std::mutex> lk(mtx_);
+    auto it = workers_.find(conn);
+    if (!trace_ || it == workers_.end()) return;
+    auto& w = it->second;
+    auto t = w.traced.find(id);
+    if (t == w.traced.end() || !t->second.received_us) return;
+    auto tr = t->second;
+    w.traced.erase(t);
+    int64_t rtt = (tr.received_us - tr.sent_us) - (sent_us - recv_us);
+    if (rtt >= 0 && (w.best_rtt_us < 0 || rtt < w.best_rtt_us)) {
+        w.best_rtt_us = rtt;
+        w.clock_offset_us = ((recv_us - tr.sent_us) + (sent_us - tr.received_us)) / 2;
+    }
+    int64_t off = w.clock_offset_us;
+    int64_t arrive = std::clamp(recv_us - off, tr.sent_us, tr.received_us), leave = std::clamp(sent_us - off, arrive, tr.received_us);
+    trace_->span(trace_pid_, tr.row, "to_worker", tr.sent_us, arrive - tr.sent_us);
+    trace_->span(trace_pid_, tr.row, "to_master", leave, tr.received_us - leave);
+    for (auto& s : spans) trace_->span(w.trace_pid, tr.row, s.name, s.start_us - off, s.dur_us);
+}
+// First result for a task wins; later copies (speculative, or from an expired lease) are dropped.
+// Results without an id come from workers that predate ids and are always taken.
+bool NetMaster::claim_result(std::string_view id) {
+    if (id.empty()) return true;
+    std::lock_guard<std::mutex> lk(mtx_);
+    auto t = tasks_.find(std::string(id));
+    if (t == tasks_.end()) { task_stats_.duplicates++; return false; }
+    tasks_.erase(t);
+    return true;
+}
+void NetMaster::on_result_done(ConnId conn, std::string_view id) {
+    { std::lock_guard<std::mutex> lk(mtx_); auto it = workers_.find(conn); if (it != workers_.end()) record_result(it->second, id, Clock::now()); }
+    net_log("master: result received\n");
+    send_next(conn);
+}
+// The worker gave up on its copy: the slot is free at once, and the task goes back to the queue (or
+// to on_failed after max_attempts) unless another copy is still running.
+void NetMaster::on_task_failed(ConnId conn, std::string_view id) {
+    std::vector<NetJob> failed;
     {
         std::lock_guard<std::mutex> lk(mtx_);
-        if (jobs_.empty()) return;
-        job = jobs_.front(); jobs_.pop();
+        std::string key(id);
+        release_locked(conn, key);
+        task_stats_.worker_failed++;
+        auto t = tasks_.find(key);
+        if (t != tasks_.end()) {
+            auto& h = t->second.holders;
+            h.erase(std::remove(h.begin(), h.end(), conn), h.end());
+            if (h.empty() && !t->second.queued) requeue_locked(t, failed);
+        }
+    }
+    if (!failed.empty() && opts_.max_queued_jobs) space_cv_.notify_all();
+    for (auto& job : failed) if (on_failed_) on_failed_(job);
+    send_next(conn);
+}
+// Drops a copy from its worker's window without counting a completion.
+void NetMaster::release_locked(ConnId conn, const std::string& id) {
+    auto it = workers_.find(conn);
+    if (it == workers_.end()) return;
+    auto& w = it->second;
+    if (w.sent.erase(id) && w.in_flight > 0) w.in_flight--;
+    w.traced.erase(id);
+}
+// Rate is sampled over busy time only (the clock starts when the worker goes from idle to loaded),
+// so a worker starved by an empty queue does not look slow. Each sample resizes the window to
+// lookahead_ms of work, keeping at least two tasks in flight so the next image is always queued.
+void NetMaster::record_result(WorkerState& w, std::string_view id, Clock::time_point now) {
+    double a = opts_.ewma_alpha;
+    auto it = w.sent.find(std::string(id));
+    // Only copies still in `sent` hold a slot (not ones the worker reported failed or could not be
+    // sent); results without ids always did.
+    bool held = id.empty() || it != w.sent.end();
+    if (it != w.sent.end()) {
+        double lat = std::chrono::duration<double>(now - it->second).count();
+        w.latency = w.latency > 0 ? a * lat + (1 - a) * w.latency : lat;
+        w.sent.erase(it);
+    }
+    auto tr = w.traced.find(std::string(id));
+    if (tr != w.traced.end()) {
+        tr->second.received_us = trace_us(now);
+        trace_->span(trace_pid_, tr->second.row, "round_trip", tr->second.sent_us, tr->second.received_us - tr->second.sent_us);
+    }
+    w.completed++;
+    if (held && w.in_flight > 0) w.in_flight--;
+    w.done_since_mark++;
+    double busy = std::chrono::duration<double>(now - w.mark).count();
+    if (busy < 0.2 && (w.in_flight > 0 || busy <= 0)) return;
+    double sample = w.done_since_mark / busy;
+    w.rate = w.rate > 0 ? a * sample + (1 - a) * w.rate : sample;
+    w.mark = now;
+    w.done_since_mark = 0;
+    int want = static_cast<int>(std::ceil(w.rate * opts_.lookahead_ms / 1000.0));
+    w.window = std::max(std::min(2, w.credits), std::min(want, w.credits));
+}
+// Once the queue is shorter than the workers' combined windows, a task should go to whoever would
+// finish it first: returns a worker expected to finish it in well under `w`'s time (so `w` leaves
+// it), or 0. Unmeasured workers are never held back, and never preferred.
+ConnId NetMaster::tail_handoff(ConnId conn, const WorkerState& w) const {
+    if (w.rate <= 0) return 0;
+    size_t capacity = 0;
+    double best = std::numeric_limits<double>::infinity();
+    ConnId best_conn = 0;
+    for (auto& [c, v] : workers_) {
+        capacity += static_cast<size_t>(v.window);
+        if (c == conn || v.rate <= 0) continue;
+        double eta = (v.in_flight + 1) / v.rate;
+        if (eta < best) { best = eta; best_conn = c; }
+    }
+    if (jobs_.size() >= capacity) return 0;
+    return (w.in_flight + 1) / w.rate > 1.5 * best ? best_conn : 0;
+}
+// Queues a task again at the front, or gives it up after max_attempts dispatches.
+void NetMaster::requeue_locked(std::unordered_map<std::string, TaskState>::iterator t, std::vector<NetJob>& failed) {
+    if (t->second.attempts >= opts_.max_attempts) {
+        failed.push_back(std::move(t->second.job));
+        tasks_.erase(t);
+        return;
+    }
+    t->second.queued = true;
+    t->second.queued_at = Clock::now();
+    jobs_.push_front(t->first);
+    task_stats_.requeued++;
+}
+// Oldest task out on another worker, without a backup copy yet, that has taken more than twice the
+// usual latency of both its holder and `w`. `w` needs a latency measurement of its own.
+const std::string* NetMaster::pick_straggler(ConnId conn, const WorkerState& w, Clock::time_point now) const {
+    if (w.latency <= 0) return nullptr;
+    const std::string* best = nullptr;
+    double oldest = 0;
+    for (auto& [c, h] : workers_) {
+        if (c == conn) continue;
+        double limit = 2 * std::max(h.latency, w.latency);
+        for (auto& [id, sent] : h.sent) {
+            double age = std::chrono::duration<double>(now - sent).count();
+            if (age <= limit || age <= oldest) continue;
+            auto t = tasks_.find(id);
+            if (t == tasks_.end() || t->second.queued || t->second.holders.size() != 1 || t->second.attempts >= opts_.max_attempts || w.sent.count(id)) continue;
+            best = &id;
+            oldest = age;
+        }
+    }
+    return best;
+}
+std::vector<ConnId> NetMaster::unpark_all_locked() {
+    std::vector<ConnId> wake;
+    for (ConnId c : idle_) { auto it = workers_.find(c); if (it != workers_.end()) { it->second.parked = false; wake.push_back(c); } }
+    idle_.clear();
+    return wake;
+}
+// Tasks the worker held go back to the queue unless another copy is still running; parked workers
+// are woken for them (and for tail tasks they were leaving to this one).
+void NetMaster::on_close(ConnId conn) {
+    std::vector<ConnId> wake;
+    std::vector<NetJob> failed;
+    {
+        std::lock_guard<std::mutex> lk(mtx_);
+        auto it = workers_.find(conn);
+        if (it != workers_.end()) {
+            for (auto& [id, sent] : it->second.sent) {
+                auto t = tasks_.find(id);
+                if (t == tasks_.end()) continue;
+                auto& h = t->second.holders;
+                h.erase(std::remove(h.begin(), h.end(), conn), h.end());
+                if (h.empty() && !t->second.queued) requeue_locked(t, failed);
+            }
+            if (!it->second.sent.empty()) net_log(("master: worker " + it->second.worker_id + " disconnected with " + std::to_string(it->second.sent.size()) + " tasks\n").c_str());
+            workers_.erase(it);
+        }
+        if (!jobs_.empty()) wake = unpark_all_locked();
+    }
+    if (!failed.empty() && opts_.max_queued_jobs) space_cv_.notify_all();
+    for (auto& job : failed) if (on_failed_) on_failed_(job);
+    for (ConnId c : wake) send_next(c);
+}
+// Requeues tasks whose lease ran out and, while anything is outstanding, wakes parked workers so
+// they can pick up retries or straggler backups.
+void NetMaster::reap_loop() {
+    std::unique_lock<std::mutex> lk(mtx_);
+    while (!stopping_) {
+        reap_cv_.wait_for(lk, std::chrono::milliseconds(250), [&]{ return stopping_; });
+        if (stopping_) break;
+        auto now = Clock::now();
+        std::vector<NetJob> failed;
+        std::vector<std::string> expired;
+        for (auto& [id, t] : tasks_) if (!t.queued && now >= t.lease) expired.push_back(id);
+        // The task is queued again, or failed once it has used max_attempts. Holders keep the slot
+        // charged until the late copy answers (and is still taken if it comes first) or they
+        // disconnect, so a hung worker is not refilled; send_next never gives them the task again.
+        for (auto& id : expired) {
+            auto t = tasks_.find(id);
+            t->second.holders.clear();
+            task_stats_.expired++;
+            requeue_locked(t, failed);
+        }
+        std::vector<ConnId> wake;
+        if (!jobs_.empty() || (opts_.speculate && !tasks_.empty())) wake = unpark_all_locked();
+        lk.unlock();
+        if (!failed.empty() && opts_.max_queued_jobs) space_cv_.notify_all();
+        for (auto& job : failed) if (on_failed_) on_failed_(job);
+        for (ConnId c : wake) send_next(c);
+        lk.lock();
+    }
+}
+// Tops the worker up to its window, except for tail tasks a faster worker should take (a parked
+// faster worker is woken to take them). With the queue empty, spare window goes to straggler backups.
+void NetMaster::send_next(ConnId conn) {
+    std::vector<NetJob> out;
+    std::vector<char> traced_out;
+    bool data = false, rgb8 = false;
+    ConnId kick = 0;
+    {
+        std::lock_guard<std::mutex> lk(mtx_);
+        auto it = workers_.find(conn);
+        if (it == workers_.end()) return;
+        auto& w = it->second;
+        data = opts_.ship_bytes && w.accepts_data;
+        rgb8 = w.accepts_rgb8;
+        auto now = Clock::now();
+        auto lease = std::max<Clock::duration>(std::chrono::milliseconds(opts_.lease_ms), std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(4 * w.latency)));
+        auto dispatch = [&](TaskState& t) {
+            if (t.queued) record_stage(Stage::DispatchQueueWait, now - t.queued_at);
+            bool traced = trace_ && w.traces && opts_.trace_every > 0 && trace_dispatches_++ % static_cast<uint64_t>(opts_.trace_every) == 0;
+            if (traced) {
+                uint64_t row = ++trace_rows_;
+                std::string name = t.queued ? t.job.id : t.job.id + " (backup)";
+                trace_->name_row(trace_pid_, row, name);
+                trace_->name_row(w.trace_pid, row, name);
+                if (t.queued) trace_->span(trace_pid_, row, "queued", trace_us(t.queued_at), trace_us(now) - trace_us(t.queued_at));
+                w.traced[t.job.id] = WorkerState::Traced{row, trace_us(now), 0};
+            }
+            traced_out.push_back(traced);
+            t.queued = false;
+            t.holders.push_back(conn);
+            t.attempts++;
+            t.lease = now + lease;
+            if (w.in_flight == 0) { w.mark = now; w.done_since_mark = 0; }
+            w.sent[t.job.id] = now;
+            out.push_back(t.job);
+            w.in_flight++;
+        };
+        for (size_t i = 0; w.in_flight < w.window && i < jobs_.size();) {
+            auto t = tasks_.find(jobs_[i]);
+            if (t == tasks_.end() || !t->second.queued) { jobs_.erase(jobs_.begin() + static_cast<std::ptrdiff_t>(i)); continue; }
+            // Still running an expired copy of it: another worker takes the retry.
+            if (w.sent.count(t->first)) { ++i; continue; }
+            if (ConnId faster = tail_handoff(conn, w)) {
+                auto f = workers_.find(faster);
+                if (f->second.parked && f->second.in_flight < f->second.window) {
+                    f->second.parked = false;
+                    idle_.erase(std::find(idle_.begin(), idle_.end(), faster));
+                    kick = faster;
+                }
+                break;
+            }
+            jobs_.erase(jobs_.begin() + static_cast<std::ptrdiff_t>(i));
+            dispatch(t->second);
+        }
+        while (opts_.speculate && jobs_.empty() && w.in_flight < w.window) {
+            const std::string* id = pick_straggler(conn, w, now);
+            if (!id) break;
+            task_stats_.speculative++;
+            dispatch(tasks_[*id]);
+        }
+        if (w.in_flight < w.window && !w.parked) { w.parked = true; idle_.push_back(conn); }
+    }
+    if (kick) send_next(kick);
+    if (!out.empty() && opts_.max_queued_jobs) space_cv_.notify_all();
+    std::vector<const NetJob*> failed;
+    for (size_t k=0; k<out.size(); ++k) {
+        auto& job = out[k];
+        if (data && queue_preresize(conn, job, traced_out[k] != 0, rgb8)) continue;
+        if (data && !send_task_data(conn, job, traced_out[k] != 0)) {
+            net_log("master: cannot read task file\n");
+            failed.push_back(&job);
+            continue;
+        }
+        if (!data) server_->send(conn, make_task_payload(job, traced_out[k] != 0));
+        // optional: lightweight log for tracing
+        net_log("master: task sent\n");
+    }
+    if (!failed.empty()) drop_unsent(conn, failed);
+}
+// Takes back copies whose files could not be read. Like a worker-reported failure, the task is
+// queued again (or failed after max_attempts) only if no other copy is still running.
+void NetMaster::drop_unsent(ConnId conn, const std::vector<const NetJob*>& unsent) {
+    std::vector<NetJob> failed;
+    {
+        std::lock_guard<std::mutex> lk(mtx_);
+        for (auto* job : unsent) {
+            release_locked(conn, job->id);
+            auto t = tasks_.find(job->id);
+            if (t == tasks_.end()) continue;
+            auto& h = t->second.holders;
+            h.erase(std::remove(h.begin(), h.end(), conn), h.end());
+            if (h.empty() && !t->second.queued) requeue_locked(t, failed);
+        }
+    }
+    if (!failed.empty() && opts_.max_queued_jobs) space_cv_.notify_all();
+    for (auto& job : failed) if (on_failed_) on_failed_(job);
+    send_next(conn);
+}
+// The file is streamed into the frame at send time, so jobs never hold image bytes in memory.
+bool NetMaster::send_task_data(ConnId conn, const NetJob& job, bool traced) {
+    std::error_code ec;
+    auto size = std::filesystem::file_size(job.path, ec);
+    if (ec || size > 0xFFFFFFFFull) return false;
+    auto head = encode_frame_header(MsgType::Task, ElemType::U8, job.label, job.path, job.id, static_cast<uint32_t>(size), traced ? kFrameTraced : 0);
+    return server_->send_file(conn, head, job.path, size);
+}
+// Only the size is checked here, on the I/O thread; the decode runs on the pre-resize pool.
+bool NetMaster::queue_preresize(ConnId conn, const NetJob& job, bool traced, bool rgb8) {
+    if (!preresize_q_ || (!rgb8 && opts_.preresize_jpeg_quality <= 0)) return false;
+    std::error_code ec;
+    auto size = std::filesystem::file_size(job.path, ec);
+    if (ec || double(size) < opts_.preresize_ratio * double(kTensorSize)) return false;
+    return preresize_q_->push(Preresize{conn, job, traced, rgb8});
+}
+void NetMaster::preresize_loop() {
+    Preresize p;
+    std::vector<unsigned char> rgb(kTensorSize), jpeg;
+    while (preresize_q_->pop(p)) {
+        auto t0 = Clock::now();
+        MappedFile file;
+        bool ok;
+        { StageTimer t(Stage::FileRead); ok = file.open(p.job.path); }
+        if (!ok) { drop_unsent(p.conn, {&p.job}); continue; }
+        uint16_t flags = p.traced ? kFrameTraced : 0;
+        std::string frame;
+        if (decode_to_rgb8(file.data(), file.size(), rgb.data())) {
+            if (opts_.preresize_jpeg_quality > 0 && encode_rgb8_jpeg(rgb.data(), opts_.preresize_jpeg_quality, jpeg)) {
+                frame = encode_frame_header(MsgType::Task, ElemType::U8, p.job.label, p.job.path, p.job.id, static_cast<uint32_t>(jpeg.size()), flags);
+                frame.append(reinterpret_cast<const char*>(jpeg.data()), jpeg.size());
+            } else if (p.rgb8) {
+                frame = encode_frame_header(MsgType::Task, ElemType::RGB8, p.job.label, p.job.path, p.job.id, static_cast<uint32_t>(kTensorSize), flags);
+                frame.append(reinterpret_cast<const char*>(rgb.data()), rgb.size());
+            }
+        }
+        // Undecodable here (or no OpenCV): the worker gets the file and reports the failure itself.
+        if (frame.empty()) {
+            file.close();
+            if (!send_task_data(p.conn, p.job, p.traced)) drop_unsent(p.conn, {&p.job});
+            continue;
+        }
+        server_->send(p.conn, frame);
+        std::lock_guard<std::mutex> lk(mtx_);
+        task_stats_.preresized++;
+        task_stats_.preresize_file_bytes += file.size();
+        task_stats_.preresize_sent_bytes += frame.size();
+        if (!p.traced || !trace_) continue;
+        auto w = workers_.find(p.conn);
+        if (w == workers_.end()) continue;
+        auto tr = w->second.traced.find(p.job.id);
+        if (tr != w->second.traced.end()) trace_->span(trace_pid_, tr->second.row, "preresize", trace_us(t0), trace_us(Clock::now()) - trace_us(t0));
     }
-    auto framed = encode_length_prefixed(make_task_payload(job));
-    ::send(sock, framed.data(), static_cast<int>(framed.size()), 0);
-    // optional: lightweight log for tracing
-    OutputDebugStringA("master: task sent\n");
 }
 }
@@ -0,0 +1,70 @@
+#include <string>
+#include <cstring>
+#include "networking/metrics_server.h"
+#include "common/metrics.h"
+
+namespace dip {
+#if defined(_WIN32)
+static const int kSendFlags = 0;
+static const int kShutBoth = SD_BOTH;
+#else
+static const int kSendFlags = MSG_NOSIGNAL;
+static const int kShutBoth = SHUT_RDWR;
+#endif
+
+MetricsServer::MetricsServer(const std::string& bind_addr, uint16_t port) : bind_addr_(bind_addr), port_(port) { net_init(); }
+MetricsServer::~MetricsServer() { stop(); }
+
+bool MetricsServer::start() {
+    listen_ = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (listen_ == kInvalidSocket) return false;
+#if !defined(_WIN32)
+    int one = 1; setsockopt(listen_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+#endif
+    sockaddr_in addr{}; addr.sin_family = AF_INET; addr.sin_port = htons(port_); inet_pton(AF_INET, bind_addr_.c_str(), &addr.sin_addr);
+    if (::bind(listen_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || listen(listen_, 16) != 0) {
+        close_socket(listen_);
+        listen_ = kInvalidSocket;
+        return false;
+    }
+    thr_ = std::thread([this]{ serve(); });
+    return true;
+}
+
+void MetricsServer::stop() {
+    if (stop_.exchange(true)) return;
+    // shutdown wakes a blocked accept on Linux; closing does on Windows.
+    if (listen_ != kInvalidSocket) { shutdown(listen_, kShutBoth); close_socket(listen_); }
+    if (thr_.joinable()) thr_.join();
+}
+
+void MetricsServer::serve() {
+    while (!stop_.load()) {
+        socket_t s = accept(listen_, nullptr, nullptr);
+        if (s == kInvalidSocket) break;
+        // One thread serves every scrape, so a client that stalls must not hold it (or stop()).
+        set_io_timeout(s, 2000);
+        // The request line is all that matters; headers and body are ignored.
+        std::string req;
+        char buf[2048];
+        while (req.find("\r\n") == std::string::npos && req.size() < 8192) {
+            int n = ::recv(s, buf, static_cast<int>(sizeof(buf)), 0);
+            if (n <= 0) break;
+            req.append(buf, static_cast<size_t>(n));
+        }
+        std::string status = "200 OK", type, body;
+        if (req.compare(0, 18, "GET /metrics.json ") == 0) { type = "application/json"; body = metrics_json(); }
+        else if (req.compare(0, 13, "GET /metrics ") == 0 || req.compare(0, 6, "GET / ") == 0) { type = "text/plain; version=0.0.4"; body = metrics_prometheus(); }
+        else { status = "404 Not Found"; type = "text/plain"; body = "try /metrics or /metrics.json\n"; }
+        std::string resp = "HTTP/1.1 " + status + "\r\nContent-Type: " + type + "\r\nContent-Length: " + std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n" + body;
+        size_t sent = 0;
+        while (sent < resp.size()) {
+            int n = ::send(s, resp.data() + sent, static_cast<int>(resp.size() - sent), kSendFlags);
+            if (n <= 0) break;
+            sent += static_cast<size_t>(n);
+        }
+        shutdown(s, kShutBoth);
+        close_socket(s);
+    }
+}
+}
@@ -1,27 +1,231 @@
 #include <string>
 #include <vector>
 #include <cstdint>
+#include <cstring>
+#include <charconv>
+#include <sstream>
+#include "networking/protocol.h"
+#include "common/float16.h"
 
 namespace dip {
+static const bool kLittleEndian = []{ uint16_t x = 1; uint8_t b; std::memcpy(&b, &x, 1); return b == 1; }();
+
+static void put_u16(uint8_t* p, uint16_t v) { p[0] = uint8_t(v); p[1] = uint8_t(v >> 8); }
+static void put_u32(uint8_t* p, uint32_t v) { p[0] = uint8_t(v); p[1] = uint8_t(v >> 8); p[2] = uint8_t(v >> 16); p[3] = uint8_t(v >> 24); }
+static uint16_t get_u16(const uint8_t* p) { return uint16_t(p[0] | (uint16_t(p[1]) << 8)); }
+static uint32_t get_u32(const uint8_t* p) { return uint32_t(p[0]) | (uint32_t(p[1]) << 8) | (uint32_t(p[2]) << 16) | (uint32_t(p[3]) << 24); }
+
 std::string encode_length_prefixed(const std::string& payload) {
-    uint32_t len = static_cast<uint32_t>(payload.size());
     std::string out;
-    out.resize(4 + payload.size());
-    out[0] = static_cast<char>((len >> 24) & 0xFF);
-    out[1] = static_cast<char>((len >> 16) & 0xFF);
-    out[2] = static_cast<char>((len >> 8) & 0xFF);
-    out[3] = static_cast<char>(len & 0xFF);
-    std::memcpy(&out[4], payload.data(), payload.size());
+    append_length_prefixed(out, payload);
     return out;
 }
 
+void append_length_prefixed(std::string& out, const std::string& payload) {
+    uint32_t len = static_cast<uint32_t>(payload.size());
+    size_t base = out.size();
+    out.resize(base + 4 + payload.size());
+    out[base] = static_cast<char>((len >> 24) & 0xFF);
+    out[base+1] = static_cast<char>((len >> 16) & 0xFF);
+    out[base+2] = static_cast<char>((len >> 8) & 0xFF);
+    out[base+3] = static_cast<char>(len & 0xFF);
+    if (!payload.empty()) std::memcpy(&out[base+4], payload.data(), payload.size());
+}
+
 bool decode_length_prefixed(const std::vector<uint8_t>& buf, size_t& offset, std::string& out) {
+    std::string_view v;
+    if (!peek_length_prefixed(buf, offset, v)) return false;
+    out.assign(v.data(), v.size());
+    return true;
+}
+
+bool peek_length_prefixed(const std::vector<uint8_t>& buf, size_t& offset, std::string_view& out) {
     if (offset + 4 > buf.size()) return false;
     uint32_t len = (uint32_t(buf[offset]) << 24) | (uint32_t(buf[offset+1]) << 16) | (uint32_t(buf[offset+2]) << 8) | uint32_t(buf[offset+3]);
     if (offset + 4 + len > buf.size()) return false;
-    out.assign(reinterpret_cast<const char*>(&buf[offset+4]), len);
+    out = std::string_view(reinterpret_cast<const char*>(buf.data() + offset + 4), len);
     offset += 4 + len;
     return true;
 }
+
+const char* result_format_name(ResultFormat f) {
+    switch (f) {
+    case ResultFormat::BinF32: return "f32";
+    case ResultFormat::BinF16: return "f16";
+    case ResultFormat::BinI8: return "i8";
+    case ResultFormat::BinPQ: return "pq";
+    default: return "text";
+    }
+}
+
+bool parse_result_format(std::string_view name, ResultFormat& out) {
+    if (name == "f32") out = ResultFormat::BinF32;
+    else if (name == "f16") out = ResultFormat::BinF16;
+    else if (name == "i8") out = ResultFormat::BinI8;
+    else if (name == "pq") out = ResultFormat::BinPQ;
+    else if (name == "text") out = ResultFormat::Text;
+    else return false;
+    return true;
+}
+
+size_t elem_size(ElemType e) { return e == ElemType::U8 || e == ElemType::I8 || e == ElemType::PQ || e == ElemType::RGB8 ? 1 : e == ElemType::F16 ? 2 : 4; }
+size_t payload_size(ElemType e, uint32_t dim) { return size_t(dim) * elem_size(e) + (e == ElemType::I8 ? 4 : 0); }
+
+bool is_binary_frame(std::string_view msg) { return !msg.empty() && static_cast<uint8_t>(msg[0]) == kBinMagic; }
+
+static void write_header(uint8_t* p, MsgType type, ElemType elem, const std::string& label, const std::string& path, const std::string& id, uint32_t count, uint16_t flags = 0) {
+    p[0] = kBinMagic; p[1] = kBinVersion; p[2] = uint8_t(type); p[3] = uint8_t(elem);
+    put_u32(p + 4, count);
+    put_u16(p + 8, static_cast<uint16_t>(label.size()));
+    put_u16(p + 10, static_cast<uint16_t>(path.size()));
+    put_u16(p + 12, static_cast<uint16_t>(id.size()));
+    put_u16(p + 14, flags);
+    uint8_t* q = p + kBinHeaderSize;
+    std::memcpy(q, label.data(), label.size()); q += label.size();
+    std::memcpy(q, path.data(), path.size()); q += path.size();
+    std::memcpy(q, id.data(), id.size());
+}
+
+std::string encode_frame_header(MsgType type, ElemType elem, const std::string& label, const std::string& path, const std::string& id, uint32_t count, uint16_t flags) {
+    std::string out(kBinHeaderSize + label.size() + path.size() + id.size(), '\0');
+    write_header(reinterpret_cast<uint8_t*>(&out[0]), type, elem, label, path, id, count, flags);
+    return out;
+}
+
+std::string encode_result_frame(const std::string& label, const std::string& path, const std::string& id, const std::vector<float>& embedding, ElemType elem, const ProductQuantizer* pq) {
+    size_t dim = embedding.size();
+    if (elem == ElemType::PQ && (!pq || pq->dim() != dim)) elem = ElemType::F32;
+    uint32_t count = static_cast<uint32_t>(elem == ElemType::PQ ? pq->m() : dim);
+    size_t head = kBinHeaderSize + label.size() + path.size() + id.size();
+    std::string out(head + payload_size(elem, count), '\0');
+    uint8_t* p = reinterpret_cast<uint8_t*>(&out[0]);
+    write_header(p, MsgType::Result, elem, label, path, id, count);
+    uint8_t* q = p + head;
+    if (elem == ElemType::PQ) {
+        pq->encode(embedding.data(), q);
+    } else if (elem == ElemType::I8) {
+        float scale = encode_i8(embedding.data(), dim, reinterpret_cast<int8_t*>(q + 4));
+        uint32_t u; std::memcpy(&u, &scale, 4); put_u32(q, u);
+    } else if (elem == ElemType::F16) {
+        for (size_t i=0; i<dim; ++i) put_u16(q + 2*i, float_to_half(embedding[i]));
+    } else if (kLittleEndian) {
+        std::memcpy(q, embedding.data(), dim * 4);
+    } else {
+        for (size_t i=0; i<dim; ++i) { uint32_t u; std::memcpy(&u, &embedding[i], 4); put_u32(q + 4*i, u); }
+    }
+    return out;
+}
+
+bool parse_frame(std::string_view msg, FrameView& out) {
+    if (msg.size() < kBinHeaderSize) return false;
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(msg.data());
+    if (p[0] != kBinMagic || p[1] != kBinVersion) return false;
+    if (p[2] != uint8_t(MsgType::Result) && p[2] != uint8_t(MsgType::Task)) return false;
+    if (p[3] < uint8_t(ElemType::F32) || p[3] > uint8_t(ElemType::RGB8)) return false;
+    out.type = static_cast<MsgType>(p[2]);
+    out.elem = static_cast<ElemType>(p[3]);
+    out.dim = get_u32(p + 4);
+    out.flags = get_u16(p + 14);
+    size_t ll = get_u16(p + 8), pl = get_u16(p + 10), il = get_u16(p + 12);
+    size_t need = kBinHeaderSize + ll + pl + il + payload_size(out.elem, out.dim);
+    if (msg.size() != need) return false;
+    const char* s = msg.data() + kBinHeaderSize;
+    out.label = std::string_view(s, ll); s += ll;
+    out.path = std::string_view(s, pl); s += pl;
+    out.id = std::string_view(s, il); s += il;
+    out.data = reinterpret_cast<const uint8_t*>(s);
+    return true;
+}
+
+bool parse_result_frame(std::string_view msg, FrameView& out) {
+    return parse_frame(msg, out) && out.type == MsgType::Result && out.elem != ElemType::U8 && out.elem != ElemType::RGB8;
+}
+
+bool decode_embedding(const FrameView& v, std::vector<float>& out, const ProductQuantizer* pq) {
+    if (v.elem == ElemType::PQ) {
+        if (!pq || pq->m() != v.dim) return false;
+        out.resize(pq->dim());
+        pq->decode(v.data, out.data());
+        return true;
+    }
+    out.resize(v.dim);
+    if (v.elem == ElemType::I8) {
+        float scale; uint32_t u = get_u32(v.data); std::memcpy(&scale, &u, 4);
+        decode_i8(reinterpret_cast<const int8_t*>(v.data + 4), v.dim, scale, out.data());
+    } else if (v.elem == ElemType::F16) {
+        for (uint32_t i=0; i<v.dim; ++i) out[i] = half_to_float(get_u16(v.data + 2*i));
+    } else if (kLittleEndian) {
+        std::memcpy(out.data(), v.data, size_t(v.dim) * 4);
+    } else {
+        for (uint32_t i=0; i<v.dim; ++i) { uint32_t u = get_u32(v.data + 4*i); std::memcpy(&out[i], &u, 4); }
+    }
+    return true;
+}
+
+std::string_view get_text_field(std::string_view msg, std::string_view key) {
+    size_t pos = 0;
+    while (pos < msg.size()) {
+        size_t end = msg.find('\n', pos);
+        if (end == std::string_view::npos) end = msg.size();
+        std::string_view line = msg.substr(pos, end - pos);
+        if (line.size() > key.size() && line.compare(0, key.size(), key) == 0 && line[key.size()] == '=') return line.substr(key.size() + 1);
+        pos = end + 1;
+    }
+    return std::string_view();
+}
+
+std::string encode_text_result(const std::string& label, const std::string& path, const std::string& id, const std::vector<float>& embedding) {
+    std::ostringstream oss;
+    oss << "type=result\nlabel=" << label << "\npath=" << path << "\nid=" << id << "\nembedding=";
+    for (size_t i=0;i<embedding.size();++i){ if (i) oss << ","; oss << embedding[i]; }
+    return oss.str();
+}
+
+bool parse_text_result(std::string_view msg, std::string& label, std::string& path, std::vector<float>& embedding) {
+    if (get_text_field(msg, "type") != "result") return false;
+    label = std::string(get_text_field(msg, "label")); path = std::string(get_text_field(msg, "path"));
+    std::string_view ecsv = get_text_field(msg, "embedding");
+    embedding.clear();
+    const char* p = ecsv.data();
+    const char* e = p + ecsv.size();
+    while (p < e) {
+        float v = 0.0f;
+        auto r = std::from_chars(p, e, v);
+        if (r.ec == std::errc()) embedding.push_back(v);
+        p = r.ptr;
+        while (p < e && *p != ',') ++p;
+        if (p < e) ++p;
+    }
+    return true;
+}
+
+std::string encode_trace_message(const std::string& id, int64_t recv_us, int64_t sent_us, const std::vector<TraceSpan>& spans) {
+    std::string out = "type=trace\nid=" + id + "\nrecv_us=" + std::to_string(recv_us) + "\nsent_us=" + std::to_string(sent_us) + "\nspans=";
+    for (size_t i=0; i<spans.size(); ++i) {
+        if (i) out += ",";
+        out += spans[i].name + ":" + std::to_string(spans[i].start_us) + ":" + std::to_string(spans[i].dur_us);
+    }
+    out += "\n";
+    return out;
 }
 
+bool parse_trace_message(std::string_view msg, std::string& id, int64_t& recv_us, int64_t& sent_us, std::vector<TraceSpan>& spans) {
+    if (get_text_field(msg, "type") != "trace") return false;
+    auto num = [](std::string_view s, int64_t& v) { return !s.empty() && std::from_chars(s.data(), s.data() + s.size(), v).ec == std::errc(); };
+    id = std::string(get_text_field(msg, "id"));
+    if (!num(get_text_field(msg, "recv_us"), recv_us) || !num(get_text_field(msg, "sent_us"), sent_us)) return false;
+    spans.clear();
+    std::string_view list = get_text_field(msg, "spans");
+    while (!list.empty()) {
+        size_t comma = list.find(',');
+        std::string_view item = list.substr(0, comma);
+        list = comma == std::string_view::npos ? std::string_view() : list.substr(comma + 1);
+        size_t a = item.find(':'), b = a == std::string_view::npos ? a : item.find(':', a + 1);
+        TraceSpan s;
+        if (b == std::string_view::npos || !num(item.substr(a + 1, b - a - 1), s.start_us) || !num(item.substr(b + 1), s.dur_us)) return false;
+        s.name = std::string(item.substr(0, a));
+        spans.push_back(std::move(s));
+    }
+    return true;
+}
+}
@@ -0,0 +1,46 @@
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include "networking/socket.h"
+
+namespace dip {
+void net_init() {
+#if defined(_WIN32)
+    static std::once_flag once;
+    std::call_once(once, []{ WSADATA wsa; WSAStartup(MAKEWORD(2,2), &wsa); });
+#endif
+}
+
+void close_socket(socket_t s) {
+    if (s == kInvalidSocket) return;
+#if defined(_WIN32)
+    closesocket(s);
+#else
+    ::close(s);
+#endif
+}
+
+void set_nodelay(socket_t s) {
+    int one = 1;
+    setsockopt(s, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&one), sizeof(one));
+}
+
+void set_io_timeout(socket_t s, int ms) {
+#if defined(_WIN32)
+    DWORD t = static_cast<DWORD>(ms);
+#else
+    timeval t{ms / 1000, (ms % 1000) * 1000};
+#endif
+    setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, reinterpret_cast<const char*>(&t), sizeof(t));
+    setsockopt(s, SOL_SOCKET, SO_SNDTIMEO, reinterpret_cast<const char*>(&t), sizeof(t));
+}
+
+void net_log(const char* msg) {
+#if defined(_WIN32)
+    OutputDebugStringA(msg);
+#else
+    static const bool enabled = std::getenv("DIP_NET_DEBUG") != nullptr;
+    if (enabled) std::fputs(msg, stderr);
+#endif
+}
+}
@@ -1,27 +1,62 @@
 #include <string>
 #include <vector>
-#include <winsock2.h>
-#include <ws2tcpip.h>
+#include <chrono>
 #include "networking/tcp_client.h"
 #include "networking/protocol.h"
+#include "common/metrics.h"
 
 namespace dip {
-TcpClient::TcpClient() { WSADATA wsa; WSAStartup(MAKEWORD(2,2), &wsa); }
+#if defined(_WIN32)
+static const int kSendFlags = 0;
+#else
+static const int kSendFlags = MSG_NOSIGNAL;
+#endif
+
+TcpClient::TcpClient() { net_init(); }
+TcpClient::~TcpClient() { close(); }
 bool TcpClient::connect(const std::string& host, uint16_t port) {
     sock_ = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (sock_ == kInvalidSocket) return false;
     sockaddr_in addr{}; addr.sin_family = AF_INET; addr.sin_port = htons(port); inet_pton(AF_INET, host.c_str(), &addr.sin_addr);
-    return ::connect(sock_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0;
+    if (::connect(sock_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) { close(); return false; }
+    set_nodelay(sock_);
+    return true;
+}
+void TcpClient::close() { close_socket(sock_); sock_ = kInvalidSocket; }
+bool TcpClient::send_all(const char* data, size_t len) {
+    size_t sent = 0;
+    while (sent < len) {
+        auto n = ::send(sock_, data + sent, static_cast<int>(len - sent), kSendFlags);
+        if (n <= 0) return false;
+        sent += static_cast<size_t>(n);
+    }
+    return true;
 }
 bool TcpClient::send(const std::string& payload) {
+    StageTimer t(Stage::NetSend);
     auto framed = encode_length_prefixed(payload);
-    int n = ::send(sock_, framed.data(), static_cast<int>(framed.size()), 0);
-    return n == static_cast<int>(framed.size());
+    if (!send_all(framed.data(), framed.size())) return false;
+    add_counter(Counter::BytesSent, framed.size());
+    return true;
 }
 bool TcpClient::read(std::string& out) {
-    std::vector<uint8_t> buf(65536);
-    int n = ::recv(sock_, reinterpret_cast<char*>(buf.data()), static_cast<int>(buf.size()), 0);
-    if (n <= 0) return false;
-    buf.resize(n);
-    size_t off = 0; return decode_length_prefixed(buf, off, out);
+    char chunk[65536];
+    // NetRecv runs from the first byte of the frame being buffered, not from the call, so idle time
+    // between tasks is not counted.
+    std::chrono::steady_clock::time_point first;
+    if (rpos_ < rbuf_.size()) first = std::chrono::steady_clock::now();
+    while (true) {
+        if (decode_length_prefixed(rbuf_, rpos_, out)) {
+            if (rpos_ == rbuf_.size()) { rbuf_.clear(); rpos_ = 0; }
+            record_stage(Stage::NetRecv, std::chrono::steady_clock::now() - first);
+            return true;
+        }
+        if (rpos_ > 0) { rbuf_.erase(rbuf_.begin(), rbuf_.begin() + static_cast<std::ptrdiff_t>(rpos_)); rpos_ = 0; }
+        auto n = ::recv(sock_, chunk, static_cast<int>(sizeof(chunk)), 0);
+        if (n <= 0) return false;
+        if (first == std::chrono::steady_clock::time_point{}) first = std::chrono::steady_clock::now();
+        add_counter(Counter::BytesReceived, static_cast<uint64_t>(n));
+        rbuf_.insert(rbuf_.end(), chunk, chunk + n);
+    }
 }
 }
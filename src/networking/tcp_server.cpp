@@ -1,45 +1,366 @@
-#include <winsock2.h>
-#include <ws2tcpip.h>
 #include <vector>
 #include <string>
 #include <thread>
+#include <cerrno>
 #include "networking/tcp_server.h"
 #include "networking/protocol.h"
+#include "common/metrics.h"
+#if !defined(_WIN32)
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#else
+#include <fstream>
+#endif
+#include <deque>
 
 namespace dip {
-TcpServer::TcpServer(const std::string& bind_addr, uint16_t port, OnMessage on_message) : on_message_(on_message) {
-    WSADATA wsa; WSAStartup(MAKEWORD(2,2), &wsa);
+static const uint32_t kMaxFrame = 64u << 20;
+
+// Pending output: either buffered bytes or a range of an open file to sendfile.
+struct OutSegment {
+    std::string data;
+    size_t pos = 0;
+    int fd = -1;
+    int64_t off = 0;
+    uint64_t remaining = 0;
+};
+
+struct TcpServer::Connection {
+    ConnId id = 0;
+    socket_t sock = kInvalidSocket;
+    Loop* loop = nullptr;
+    std::vector<uint8_t> rbuf;
+    size_t rpos = 0;
+    std::mutex wmtx;
+    std::deque<OutSegment> wq;
+    bool want_write = false;
+    bool closed = false;
+};
+
+static void release_segments(std::deque<OutSegment>& wq) {
+#if !defined(_WIN32)
+    for (auto& seg : wq) if (seg.fd >= 0) ::close(seg.fd);
+#endif
+    wq.clear();
+}
+
+struct TcpServer::Loop {
+    int epfd = -1;
+    int wake_fd = -1;
+    std::thread thr;
+};
+
+TcpServer::TcpServer(const std::string& bind_addr, uint16_t port, OnMessage on_message, int io_threads)
+    : on_message_(on_message), io_threads_(io_threads < 1 ? 1 : io_threads) {
+    net_init();
     listen_ = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+#if !defined(_WIN32)
+    int one = 1; setsockopt(listen_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+#endif
     sockaddr_in addr{}; addr.sin_family = AF_INET; addr.sin_port = htons(port); inet_pton(AF_INET, bind_addr.c_str(), &addr.sin_addr);
-    ::bind(listen_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+    if (::bind(listen_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) net_log("tcp_server: bind failed\n");
     listen(listen_, SOMAXCONN);
 }
+
+TcpServer::~TcpServer() {
+    stop();
+    std::lock_guard<std::mutex> lk(conns_mtx_);
+    for (auto& kv : conns_) { close_socket(kv.second->sock); release_segments(kv.second->wq); }
+    conns_.clear();
+#if !defined(_WIN32)
+    for (auto& l : loops_) { if (l->thr.joinable()) l->thr.join(); ::close(l->epfd); ::close(l->wake_fd); }
+#endif
+    close_socket(listen_);
+}
+
+void TcpServer::set_on_close(OnClose on_close) { on_close_ = on_close; }
+
+size_t TcpServer::connection_count() const { std::lock_guard<std::mutex> lk(conns_mtx_); return conns_.size(); }
+
+std::shared_ptr<TcpServer::Connection> TcpServer::add_connection(socket_t sock, Loop* loop) {
+    auto conn = std::make_shared<Connection>();
+    conn->id = next_id_++;
+    conn->sock = sock;
+    conn->loop = loop;
+    std::lock_guard<std::mutex> lk(conns_mtx_);
+    conns_[conn->id] = conn;
+    return conn;
+}
+
+void TcpServer::remove_connection(const std::shared_ptr<Connection>& conn) {
+    {
+        std::lock_guard<std::mutex> lk(conn->wmtx);
+        if (conn->closed) return;
+        conn->closed = true;
+#if !defined(_WIN32)
+        epoll_ctl(conn->loop->epfd, EPOLL_CTL_DEL, conn->sock, nullptr);
+#endif
+        close_socket(conn->sock);
+        release_segments(conn->wq);
+    }
+    { std::lock_guard<std::mutex> lk(conns_mtx_); conns_.erase(conn->id); }
+    if (on_close_) on_close_(conn->id);
+}
+
+#if defined(_WIN32)
 void TcpServer::start() { do_accept(); }
+
+void TcpServer::stop() {
+    if (stop_.exchange(true)) return;
+    close_socket(listen_);
+    listen_ = kInvalidSocket;
+}
+
 void TcpServer::do_accept() {
-    while (true) {
-        SOCKET sock = accept(listen_, nullptr, nullptr);
-        if (sock == INVALID_SOCKET) break;
-        std::thread([this, sock]{ connection_loop(sock); }).detach();
+    while (!stop_.load()) {
+        socket_t sock = accept(listen_, nullptr, nullptr);
+        if (sock == kInvalidSocket) break;
+        set_nodelay(sock);
+        auto conn = add_connection(sock, nullptr);
+        std::thread([this, conn]{ connection_loop(conn); }).detach();
     }
 }
-bool TcpServer::read_exact(SOCKET sock, char* buf, size_t len) {
+
+bool TcpServer::read_exact(socket_t sock, char* buf, size_t len) {
     size_t read_total = 0;
     while (read_total < len) {
         int n = ::recv(sock, buf + read_total, static_cast<int>(len - read_total), 0);
         if (n <= 0) return false;
         read_total += static_cast<size_t>(n);
     }
+    add_counter(Counter::BytesReceived, len);
     return true;
 }
-void TcpServer::connection_loop(SOCKET sock) {
+
+void TcpServer::connection_loop(std::shared_ptr<Connection> conn) {
     for (;;) {
         char hdr[4];
-        if (!read_exact(sock, hdr, 4)) break;
+        if (!read_exact(conn->sock, hdr, 4)) break;
         uint32_t len = (uint8_t)hdr[0]; len = (len << 8) | (uint8_t)hdr[1]; len = (len << 8) | (uint8_t)hdr[2]; len = (len << 8) | (uint8_t)hdr[3];
         if (len == 0) continue;
+        if (len > kMaxFrame) break;
         std::string payload; payload.resize(len);
-        if (!read_exact(sock, payload.data(), len)) break;
-        on_message_(payload, sock);
+        if (!read_exact(conn->sock, payload.data(), len)) break;
+        on_message_(payload, conn->id);
+    }
+    remove_connection(conn);
+}
+
+bool TcpServer::send(ConnId id, const std::string& payload) {
+    StageTimer timer(Stage::NetSend);
+    std::shared_ptr<Connection> conn;
+    {
+        std::lock_guard<std::mutex> lk(conns_mtx_);
+        auto it = conns_.find(id);
+        if (it == conns_.end()) return false;
+        conn = it->second;
+    }
+    auto framed = encode_length_prefixed(payload);
+    std::lock_guard<std::mutex> lk(conn->wmtx);
+    if (conn->closed) return false;
+    size_t sent = 0;
+    while (sent < framed.size()) {
+        int n = ::send(conn->sock, framed.data() + sent, static_cast<int>(framed.size() - sent), 0);
+        if (n <= 0) return false;
+        sent += static_cast<size_t>(n);
+    }
+    add_counter(Counter::BytesSent, sent);
+    return true;
+}
+
+bool TcpServer::send_file(ConnId id, const std::string& prefix, const std::string& path, uint64_t size) {
+    std::string payload = prefix;
+    {
+        StageTimer timer(Stage::FileRead);
+        std::ifstream f(path, std::ios::binary);
+        if (!f.good() || prefix.size() + size > 0xFFFFFFFFull) return false;
+        payload.resize(prefix.size() + static_cast<size_t>(size));
+        if (size > 0 && !f.read(&payload[prefix.size()], static_cast<std::streamsize>(size))) return false;
+    }
+    return send(id, payload);
+}
+#else
+void TcpServer::start() {
+    {
+        std::lock_guard<std::mutex> lk(conns_mtx_);
+        int fl = fcntl(listen_, F_GETFL, 0); fcntl(listen_, F_SETFL, fl | O_NONBLOCK);
+        for (int i=0; i<io_threads_; ++i) {
+            auto loop = std::make_unique<Loop>();
+            loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+            loop->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            epoll_event wev{}; wev.events = EPOLLIN; wev.data.ptr = loop.get();
+            epoll_ctl(loop->epfd, EPOLL_CTL_ADD, loop->wake_fd, &wev);
+            epoll_event lev{}; lev.events = EPOLLIN | EPOLLEXCLUSIVE; lev.data.ptr = nullptr;
+            epoll_ctl(loop->epfd, EPOLL_CTL_ADD, listen_, &lev);
+            loops_.push_back(std::move(loop));
+        }
+        for (size_t i=1; i<loops_.size(); ++i) { Loop* l = loops_[i].get(); l->thr = std::thread([this, l]{ run_loop(*l); }); }
+    }
+    run_loop(*loops_[0]);
+    for (size_t i=1; i<loops_.size(); ++i) if (loops_[i]->thr.joinable()) loops_[i]->thr.join();
+}
+
+void TcpServer::stop() {
+    stop_ = true;
+    std::lock_guard<std::mutex> lk(conns_mtx_);
+    uint64_t one = 1;
+    for (auto& l : loops_) { ssize_t r = ::write(l->wake_fd, &one, sizeof(one)); (void)r; }
+}
+
+void TcpServer::run_loop(Loop& loop) {
+    epoll_event events[256];
+    while (!stop_.load()) {
+        int n = epoll_wait(loop.epfd, events, 256, -1);
+        if (n < 0) { if (errno == EINTR) continue; break; }
+        for (int i=0; i<n; ++i) {
+            void* tag = events[i].data.ptr;
+            if (tag == nullptr) { on_accept(loop); continue; }
+            if (tag == &loop) { uint64_t v; while (::read(loop.wake_fd, &v, sizeof(v)) > 0) {} continue; }
+            auto* conn = static_cast<Connection*>(tag);
+            bool ok = true;
+            if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) ok = on_readable(*conn);
+            if (ok && (events[i].events & EPOLLOUT)) ok = on_writable(*conn);
+            if (!ok) {
+                std::shared_ptr<Connection> sp;
+                { std::lock_guard<std::mutex> lk(conns_mtx_); auto it = conns_.find(conn->id); if (it != conns_.end()) sp = it->second; }
+                if (sp) remove_connection(sp);
+            }
+        }
+    }
+}
+
+void TcpServer::on_accept(Loop& loop) {
+    // Bounded per wakeup so a connection storm spreads across loops.
+    for (int k=0; k<32; ++k) {
+        socket_t sock = accept4(listen_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (sock < 0) break;
+        set_nodelay(sock);
+        auto conn = add_connection(sock, &loop);
+        epoll_event ev{}; ev.events = EPOLLIN; ev.data.ptr = conn.get();
+        epoll_ctl(loop.epfd, EPOLL_CTL_ADD, sock, &ev);
+    }
+}
+
+bool TcpServer::on_readable(Connection& conn) {
+    char chunk[65536];
+    bool eof = false;
+    for (int k=0; k<16; ++k) {
+        ssize_t n = ::recv(conn.sock, chunk, sizeof(chunk), 0);
+        if (n > 0) {
+            add_counter(Counter::BytesReceived, static_cast<uint64_t>(n));
+            conn.rbuf.insert(conn.rbuf.end(), chunk, chunk + n);
+            if (static_cast<size_t>(n) < sizeof(chunk)) break;
+            continue;
+        }
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        eof = true;
+        break;
+    }
+    std::string_view msg;
+    while (conn.rbuf.size() - conn.rpos >= 4) {
+        const uint8_t* h = conn.rbuf.data() + conn.rpos;
+        uint32_t len = (uint32_t(h[0]) << 24) | (uint32_t(h[1]) << 16) | (uint32_t(h[2]) << 8) | uint32_t(h[3]);
+        if (len > kMaxFrame) return false;
+        if (!peek_length_prefixed(conn.rbuf, conn.rpos, msg)) break;
+        if (!msg.empty()) on_message_(msg, conn.id);
+    }
+    if (conn.rpos == conn.rbuf.size()) { conn.rbuf.clear(); conn.rpos = 0; }
+    else if (conn.rpos > 0) { conn.rbuf.erase(conn.rbuf.begin(), conn.rbuf.begin() + static_cast<std::ptrdiff_t>(conn.rpos)); conn.rpos = 0; }
+    return !eof;
+}
+
+bool TcpServer::on_writable(Connection& conn) {
+    std::lock_guard<std::mutex> lk(conn.wmtx);
+    if (conn.closed) return true;
+    return flush_locked(conn);
+}
+
+// Writes as much of the queue as the socket accepts and arms EPOLLOUT for the rest. Caller holds
+// conn.wmtx.
+bool TcpServer::flush_locked(Connection& conn) {
+    while (!conn.wq.empty()) {
+        auto& seg = conn.wq.front();
+        if (seg.fd < 0 && seg.pos < seg.data.size()) {
+            ssize_t n = ::send(conn.sock, seg.data.data() + seg.pos, seg.data.size() - seg.pos, MSG_NOSIGNAL | MSG_DONTWAIT);
+            if (n > 0) { seg.pos += static_cast<size_t>(n); add_counter(Counter::BytesSent, static_cast<uint64_t>(n)); continue; }
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+            return false;
+        }
+        if (seg.fd >= 0 && seg.remaining > 0) {
+            off_t off = static_cast<off_t>(seg.off);
+            ssize_t n = ::sendfile(conn.sock, seg.fd, &off, static_cast<size_t>(seg.remaining));
+            seg.off = off;
+            if (n > 0) { seg.remaining -= static_cast<uint64_t>(n); add_counter(Counter::BytesSent, static_cast<uint64_t>(n)); continue; }
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+            // n == 0: the file shrank under us and the frame can no longer be completed.
+            return false;
+        }
+        if (seg.fd >= 0) ::close(seg.fd);
+        conn.wq.pop_front();
+    }
+    if (!conn.wq.empty() && conn.wq.front().fd < 0 && conn.wq.front().pos > (1u << 20)) {
+        auto& seg = conn.wq.front();
+        seg.data.erase(0, seg.pos); seg.pos = 0;
+    }
+    bool pending = !conn.wq.empty();
+    if (pending != conn.want_write) {
+        epoll_event ev{}; ev.events = EPOLLIN | (pending ? uint32_t(EPOLLOUT) : 0u); ev.data.ptr = &conn;
+        epoll_ctl(conn.loop->epfd, EPOLL_CTL_MOD, conn.sock, &ev);
+        conn.want_write = pending;
+    }
+    return true;
+}
+
+bool TcpServer::send(ConnId id, const std::string& payload) {
+    StageTimer timer(Stage::NetSend);
+    std::shared_ptr<Connection> conn;
+    {
+        std::lock_guard<std::mutex> lk(conns_mtx_);
+        auto it = conns_.find(id);
+        if (it == conns_.end()) return false;
+        conn = it->second;
+    }
+    std::lock_guard<std::mutex> lk(conn->wmtx);
+    if (conn->closed) return false;
+    if (conn->wq.empty() || conn->wq.back().fd >= 0) conn->wq.emplace_back();
+    append_length_prefixed(conn->wq.back().data, payload);
+    return flush_locked(*conn);
+}
+
+bool TcpServer::send_file(ConnId id, const std::string& prefix, const std::string& path, uint64_t size) {
+    StageTimer timer(Stage::NetSend);
+    if (prefix.size() + size > 0xFFFFFFFFull) return false;
+    std::shared_ptr<Connection> conn;
+    {
+        std::lock_guard<std::mutex> lk(conns_mtx_);
+        auto it = conns_.find(id);
+        if (it == conns_.end()) return false;
+        conn = it->second;
     }
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    struct stat st{};
+    if (fstat(fd, &st) != 0 || static_cast<uint64_t>(st.st_size) != size) { ::close(fd); return false; }
+    uint32_t len = static_cast<uint32_t>(prefix.size() + size);
+    std::lock_guard<std::mutex> lk(conn->wmtx);
+    if (conn->closed) { ::close(fd); return false; }
+    if (conn->wq.empty() || conn->wq.back().fd >= 0) conn->wq.emplace_back();
+    auto& head = conn->wq.back().data;
+    char hdr[4] = { char((len >> 24) & 0xFF), char((len >> 16) & 0xFF), char((len >> 8) & 0xFF), char(len & 0xFF) };
+    head.append(hdr, 4);
+    head += prefix;
+    OutSegment body;
+    body.fd = fd;
+    body.remaining = size;
+    if (size > 0) conn->wq.push_back(std::move(body));
+    else ::close(fd);
+    return flush_locked(*conn);
 }
+#endif
 }
@@ -0,0 +1,145 @@
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <unordered_set>
+#include "index/ivf_index.h"
+#include "common/embedding_codec.h"
+#include "common/vector_math.h"
+#if defined(DIP_HAS_ONNX)
+#include "inference/onnx_backend.h"
+#endif
+
+using namespace dip;
+
+// Nearest-face lookup over the master's output.
+// Usage:
+//   query --build output/embeddings.ivf [--embeddings output/embeddings.npy] [--lists N]
+//         [--pq-codebook P]
+//   query --index output/embeddings.ivf (--image FILE ... | --sample N) [--k 10] [--nprobe 16]
+//         [--exact] [--recall] [--print N] [--model PATH] [--gpu]
+// --image embeds each file with the model; --sample uses N evenly spaced indexed vectors as queries.
+// --exact answers by brute force; --recall also runs brute force and reports recall@k of the IVF
+// answers against it. Prints the top k of the first --print queries (default 10), then latency.
+namespace {
+struct Query { std::string name; std::vector<float> v; };
+
+void print_latency(const std::string& what, std::vector<double>& ms) {
+    if (ms.empty()) return;
+    std::sort(ms.begin(), ms.end());
+    double sum = 0;
+    for (double x : ms) sum += x;
+    auto pct = [&](double p) { return ms[static_cast<size_t>(p * double(ms.size() - 1))]; };
+    std::cout << std::fixed << std::setprecision(3) << what << ": " << ms.size() << " queries, mean " << sum / double(ms.size()) << " ms, p50 " << pct(0.5)
+              << " p95 " << pct(0.95) << " p99 " << pct(0.99) << " max " << ms.back() << " ms, " << std::setprecision(0) << (sum > 0 ? 1000.0 * double(ms.size()) / sum : 0.0) << " queries/s" << std::endl;
+}
+
+int build(const std::string& out, const std::string& in, size_t lists, const std::string& pq_path) {
+    ProductQuantizer pq;
+    if (!pq_path.empty() && !pq.load(pq_path)) { std::cerr << "cannot load PQ codebook " << pq_path << std::endl; return 2; }
+    LabeledEmbeddings set;
+    if (!load_labeled_embeddings(in, pq.empty() ? nullptr : &pq, set) || set.rows() == 0) { std::cerr << "cannot read embeddings from " << in << std::endl; return 1; }
+    auto t0 = std::chrono::steady_clock::now();
+    IvfBuildOptions opts;
+    opts.lists = lists;
+    IvfIndexBuilder b(out, set.dim, opts);
+    for (size_t r=0; r<set.rows(); ++r) b.add(set.labels[r], set.paths[r], set.data.data() + r * set.dim, set.dim);
+    if (!b.good() || !b.finish()) { std::cerr << "cannot write " << out << std::endl; return 1; }
+    IvfIndex idx;
+    idx.open(out);
+    std::cout << "index " << out << ": " << idx.rows() << " vectors in " << idx.lists() << " lists, built in " << std::fixed << std::setprecision(1)
+              << std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count() << "s" << std::endl;
+    return 0;
+}
+}
+
+int main(int argc, char** argv) {
+    std::string index_path, build_path, embeddings = "output/embeddings.npy", pq_path, model = "models/vggface2_resnet50.onnx";
+    std::vector<std::string> images;
+    size_t k = 10, nprobe = 16, sample = 0, print = 10, lists = 0;
+    bool exact = false, recall = false, gpu = false;
+    for (int i=1; i<argc; ++i) {
+        std::string a = argv[i];
+        if (a == "--index" && i+1 < argc) { index_path = argv[++i]; }
+        else if (a == "--build" && i+1 < argc) { build_path = argv[++i]; }
+        else if (a == "--embeddings" && i+1 < argc) { embeddings = argv[++i]; }
+        else if (a == "--pq-codebook" && i+1 < argc) { pq_path = argv[++i]; }
+        else if (a == "--lists" && i+1 < argc) { lists = static_cast<size_t>(std::stoll(argv[++i])); }
+        else if (a == "--image" && i+1 < argc) { images.push_back(argv[++i]); }
+        else if (a == "--sample" && i+1 < argc) { sample = static_cast<size_t>(std::stoll(argv[++i])); }
+        else if (a == "--k" && i+1 < argc) { k = static_cast<size_t>(std::stoll(argv[++i])); }
+        else if (a == "--nprobe" && i+1 < argc) { nprobe = static_cast<size_t>(std::stoll(argv[++i])); }
+        else if (a == "--print" && i+1 < argc) { print = static_cast<size_t>(std::stoll(argv[++i])); }
+        else if (a == "--model" && i+1 < argc) { model = argv[++i]; }
+        else if (a == "--exact") { exact = true; }
+        else if (a == "--recall") { recall = true; }
+        else if (a == "--gpu") { gpu = true; }
+        else { std::cerr << "unknown argument " << a << std::endl; return 2; }
+    }
+    if (!build_path.empty()) return build(build_path, embeddings, lists, pq_path);
+    if (index_path.empty()) { std::cerr << "need --index PATH or --build PATH" << std::endl; return 2; }
+
+    IvfIndex idx;
+    if (!idx.open(index_path)) { std::cerr << "cannot open index " << index_path << std::endl; return 1; }
+    std::cout << "index " << index_path << ": " << idx.rows() << " vectors (" << idx.dim() << "-d) in " << idx.lists() << " lists" << std::endl;
+
+    std::vector<Query> queries;
+    if (!images.empty()) {
+#if defined(DIP_HAS_ONNX)
+        OnnxRuntimeBackend backend(gpu ? ProviderPref::CUDA : ProviderPref::CPU);
+        if (!backend.init(model)) { std::cerr << "cannot load model " << model << std::endl; return 1; }
+        for (auto& p : images) {
+            std::ifstream f(p, std::ios::binary);
+            std::vector<unsigned char> bytes((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+            auto r = bytes.empty() ? std::nullopt : backend.infer(bytes);
+            if (!r) { std::cerr << "cannot embed " << p << std::endl; continue; }
+            r->embedding.resize(idx.dim(), 0.0f);
+            l2_normalize(r->embedding.data(), idx.dim());
+            queries.push_back(Query{p, std::move(r->embedding)});
+        }
+#else
+        (void)gpu;
+        std::cerr << "ERROR: Built without ONNX Runtime; --image is unavailable, use --sample." << std::endl;
+        return 1;
+#endif
+    }
+    size_t n = std::min(sample, idx.rows());
+    for (size_t i=0; i<n; ++i) {
+        uint64_t pos = i * idx.rows() / n;
+        queries.push_back(Query{"row " + std::to_string(idx.row(pos)) + " (" + std::string(idx.path(pos)) + ")", std::vector<float>(idx.vector(pos), idx.vector(pos) + idx.dim())});
+    }
+    if (queries.empty()) { std::cerr << "no queries: pass --image FILE or --sample N" << std::endl; return 2; }
+
+    std::vector<IvfIndex::Hit> hits, truth;
+    std::vector<double> ms, exact_ms;
+    size_t found = 0, wanted = 0;
+    for (size_t qi=0; qi<queries.size(); ++qi) {
+        const float* q = queries[qi].v.data();
+        auto t0 = std::chrono::steady_clock::now();
+        if (exact) idx.search_exact(q, k, hits);
+        else idx.search(q, k, nprobe, hits);
+        ms.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count());
+        if (recall && !exact) {
+            t0 = std::chrono::steady_clock::now();
+            idx.search_exact(q, k, truth);
+            exact_ms.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count());
+            std::unordered_set<uint64_t> want;
+            for (auto& h : truth) want.insert(h.pos);
+            for (auto& h : hits) found += want.count(h.pos);
+            wanted += truth.size();
+        }
+        if (qi >= print) continue;
+        std::cout << "query " << queries[qi].name << std::endl;
+        for (size_t r=0; r<hits.size(); ++r)
+            std::cout << "  " << std::setw(2) << r + 1 << "  " << std::fixed << std::setprecision(4) << hits[r].score << "  " << idx.label(hits[r].pos) << "  " << idx.path(hits[r].pos) << std::endl;
+    }
+    print_latency(exact ? "exact" : "ivf nprobe=" + std::to_string(std::min(std::max<size_t>(1, nprobe), idx.lists())), ms);
+    if (recall && !exact) {
+        print_latency("exact", exact_ms);
+        std::cout << std::setprecision(3) << "recall@" << k << " " << (wanted ? double(found) / double(wanted) : 0.0) << std::endl;
+    }
+    return 0;
+}
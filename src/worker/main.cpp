@@ -1,73 +1,71 @@
 #include <iostream>
 #include <string>
-#include <vector>
-#include <sstream>
 #include <thread>
 #include <chrono>
-#include <winsock2.h>
-#include <ws2tcpip.h>
-#include <fstream>
-#include "networking/tcp_client.h"
-#include "inference/onnx_backend.h"
+#include <algorithm>
+#include "worker/net_worker.h"
+#include "common/config.h"
+#include "common/metrics.h"
+#include "networking/metrics_server.h"
 
 int main(int argc, char** argv) {
-    std::string master_host = "127.0.0.1";
-    uint16_t master_port = 5555;
+    dip::NetWorkerOptions opts;
     int gpu_workers = 0;
     int cpu_workers = 1;
+    dip::Config cfg;
+    cfg.load("config.json");
+    opts.batch.min_batch = static_cast<size_t>(cfg.get_int("batch_size_min", 1));
+    opts.batch.max_batch = static_cast<size_t>(cfg.get_int("batch_size_max", 1));
+    opts.credits = static_cast<int>(cfg.get_int("task_credits", 0));
+    opts.decode_threads = static_cast<int>(cfg.get_int("decode_threads", opts.decode_threads));
+    opts.onnx.intra_op_threads = static_cast<int>(cfg.get_int("intra_op_threads", 0));
+    opts.onnx.inter_op_threads = static_cast<int>(cfg.get_int("inter_op_threads", 0));
+    opts.onnx.sessions = static_cast<int>(cfg.get_int("onnx_sessions", 1));
+    if (!dip::parse_model_precision(cfg.get_string("model_precision", "fp32"), opts.onnx.precision)) std::cerr << "unknown model_precision, using fp32" << std::endl;
+    opts.pq_codebook = cfg.get_string("pq_codebook", "");
+    opts.read_ahead.depth = static_cast<int>(cfg.get_int("read_ahead", opts.read_ahead.depth));
+    opts.read_ahead.threads = static_cast<int>(cfg.get_int("read_threads", opts.read_ahead.threads));
+    opts.read_ahead.io_uring = cfg.get_bool("io_uring", opts.read_ahead.io_uring);
+    int metrics_port = static_cast<int>(cfg.get_int("metrics_port", 0));
+    std::string metrics_json = cfg.get_string("metrics_json", "");
+    int metrics_interval_s = static_cast<int>(cfg.get_int("metrics_interval_s", 10));
     for (int i=1;i<argc;++i){
         std::string a = argv[i];
         if (a == "--master" && i+1<argc){
             std::string hp = argv[++i];
             auto pos = hp.find(":");
-            if (pos!=std::string::npos){ master_host = hp.substr(0,pos); master_port = static_cast<uint16_t>(std::stoi(hp.substr(pos+1))); }
+            if (pos!=std::string::npos){ opts.host = hp.substr(0,pos); opts.port = static_cast<uint16_t>(std::stoi(hp.substr(pos+1))); }
         }
         else if (a == "--gpu-workers" && i+1<argc){ gpu_workers = std::stoi(argv[++i]); }
         else if (a == "--cpu-workers" && i+1<argc){ cpu_workers = std::stoi(argv[++i]); }
+        else if (a == "--batch-min" && i+1<argc){ opts.batch.min_batch = static_cast<size_t>(std::stoi(argv[++i])); }
+        else if (a == "--batch-max" && i+1<argc){ opts.batch.max_batch = static_cast<size_t>(std::stoi(argv[++i])); }
+        else if (a == "--batch-wait-ms" && i+1<argc){ opts.batch.max_wait = std::chrono::milliseconds(std::stoi(argv[++i])); }
+        else if (a == "--credits" && i+1<argc){ opts.credits = std::stoi(argv[++i]); }
+        else if (a == "--decode-threads" && i+1<argc){ opts.decode_threads = std::stoi(argv[++i]); }
+        else if (a == "--queue-stats" && i+1<argc){ opts.stats_interval_s = std::stoi(argv[++i]); }
+        else if (a == "--intra-op-threads" && i+1<argc){ opts.onnx.intra_op_threads = std::stoi(argv[++i]); }
+        else if (a == "--inter-op-threads" && i+1<argc){ opts.onnx.inter_op_threads = std::stoi(argv[++i]); }
+        else if (a == "--sessions" && i+1<argc){ opts.onnx.sessions = std::stoi(argv[++i]); }
+        else if (a == "--precision" && i+1<argc){ if (!dip::parse_model_precision(argv[++i], opts.onnx.precision)) std::cerr << "unknown --precision, using fp32" << std::endl; }
+        else if (a == "--metrics-port" && i+1<argc){ metrics_port = std::stoi(argv[++i]); }
+        else if (a == "--metrics-json" && i+1<argc){ metrics_json = argv[++i]; }
+        else if (a == "--metrics-interval-s" && i+1<argc){ metrics_interval_s = std::stoi(argv[++i]); }
+        else if (a == "--result-format" && i+1<argc){ if (!dip::parse_result_format(argv[++i], opts.result_format)) std::cerr << "unknown --result-format, using f32" << std::endl; }
+        else if (a == "--pq-codebook" && i+1<argc){ opts.pq_codebook = argv[++i]; }
+        else if (a == "--read-ahead" && i+1<argc){ opts.read_ahead.depth = std::stoi(argv[++i]); }
+        else if (a == "--read-threads" && i+1<argc){ opts.read_ahead.threads = std::stoi(argv[++i]); }
+        else if (a == "--no-io-uring"){ opts.read_ahead.io_uring = false; }
     }
-    auto start_worker = [&](bool prefer_cuda, int idx){
-        std::thread([&, prefer_cuda, idx]{
-            dip::TcpClient client;
-            if (!client.connect(master_host, master_port)) return;
-            std::string wid = std::string(prefer_cuda?"gpu-":"cpu-") + std::to_string(idx);
-            std::string hello = std::string("type=hello\nworker_id=") + wid + std::string("\nprovider=") + (prefer_cuda?"cuda":"cpu") + std::string("\n");
-            client.send(hello);
-            std::unique_ptr<dip::IInferenceBackend> backend(new dip::OnnxRuntimeBackend(prefer_cuda ? dip::ProviderPref::CUDA : dip::ProviderPref::CPU));
-            std::string model = (std::string("models/") + "vggface2_resnet50.onnx");
-            bool ok = backend->init(model);
-            std::cout << "worker " << wid << " initialized provider=" << (prefer_cuda && ok?"cuda":"cpu") << std::endl;
-            if (!ok && prefer_cuda) { backend.reset(new dip::OnnxRuntimeBackend(dip::ProviderPref::CPU)); backend->init(model); std::cout << "worker " << wid << " fallback provider=cpu" << std::endl; }
-            while (true) {
-                std::string msg;
-                if (!client.read(msg)) break;
-                if (msg.find("type=task") != std::string::npos) {
-                    auto getv = [&](const std::string& key){ auto k = key + "="; auto pos = msg.find(k); if (pos==std::string::npos) return std::string(); auto end = msg.find('\n', pos); return msg.substr(pos + k.size(), end == std::string::npos ? std::string::npos : end - (pos + k.size())); };
-                    auto label = getv("label");
-                    auto path = getv("path");
-                    auto id = getv("id");
-                    std::vector<unsigned char> bytes;
-                    std::ifstream f(path, std::ios::binary);
-                    if (f.good()) {
-                        f.seekg(0, std::ios::end);
-                        std::streampos szpos = f.tellg();
-                        size_t sz = szpos > 0 ? static_cast<size_t>(szpos) : 0;
-                        f.seekg(0, std::ios::beg);
-                        bytes.resize(sz);
-                        if (sz > 0) f.read(reinterpret_cast<char*>(bytes.data()), static_cast<std::streamsize>(sz));
-                    }
-                    auto res = backend->infer(bytes);
-                    if (res) {
-                        std::ostringstream oss;
-                        oss << "type=result\nlabel=" << label << "\npath=" << path << "\nid=" << id << "\nembedding=";
-                        for (size_t i=0;i<res->embedding.size();++i){ if (i) oss << ","; oss << res->embedding[i]; }
-                        client.send(oss.str());
-                    }
-                }
-            }
-        }).detach();
-    };
-    for (int i=0;i<gpu_workers;++i) start_worker(true, i);
-    for (int i=0;i<cpu_workers;++i) start_worker(false, i);
-    std::this_thread::sleep_for(std::chrono::hours(24));
+    dip::start_net_worker_group(opts, true, gpu_workers);
+    dip::start_net_worker_group(opts, false, cpu_workers);
+    dip::MetricsServer metrics("0.0.0.0", static_cast<uint16_t>(metrics_port));
+    if (metrics_port > 0 && !metrics.start()) std::cerr << "cannot serve metrics on port " << metrics_port << std::endl;
+    auto until = std::chrono::steady_clock::now() + std::chrono::hours(24);
+    while (!metrics_json.empty() && std::chrono::steady_clock::now() < until) {
+        std::this_thread::sleep_for(std::chrono::seconds(std::max(1, metrics_interval_s)));
+        dip::write_metrics_snapshot(metrics_json);
+    }
+    std::this_thread::sleep_until(until);
     return 0;
 }
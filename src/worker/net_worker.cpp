@@ -0,0 +1,231 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <fstream>
+#include <algorithm>
+#include <chrono>
+#include <charconv>
+#include <cmath>
+#include "worker/net_worker.h"
+#include "networking/tcp_client.h"
+#include "common/metrics.h"
+#include "inference/backend.h"
+#include "inference/pipeline.h"
+#if defined(DIP_HAS_ONNX)
+#include "inference/onnx_backend.h"
+#endif
+
+namespace dip {
+namespace {
+struct Conn {
+    TcpClient client;
+    std::mutex send_mtx;
+    // Stays text until the master answers hello with type=welcome, so older masters keep working.
+    std::atomic<int> format{static_cast<int>(ResultFormat::Text)};
+};
+// `buf` holds either the file read from `path` or the whole received task frame; the image is the
+// [off, off+len) slice of it, so data-mode tasks are decoded straight from the received buffer.
+// With read-ahead, a path task's file arrives in `read` instead, and the decode thread waits for it.
+struct Task {
+    std::shared_ptr<Conn> conn;
+    std::string label; std::string path; std::string id;
+    std::string buf; size_t off = 0; size_t len = 0;
+    // Set when the master sampled this task for tracing; spans are on this machine's clock.
+    bool traced = false; int64_t recv_us = 0; std::vector<TraceSpan> spans;
+    std::shared_ptr<PendingRead> read;
+    AsyncFileReader* reader = nullptr;  // buffers go back to its pool
+    bool rgb8 = false;                  // pre-resized by the master (RGB8 task frame)
+    ImageView image() const {
+        if (!read) return ImageView{reinterpret_cast<const unsigned char*>(buf.data()) + off, len, rgb8};
+        reader->wait_for(*read);
+        return ImageView{reinterpret_cast<const unsigned char*>(read->buf.data()), read->buf.size()};
+    }
+    void release_image() {
+        if (read) {
+            on_stage(Stage::FileRead, read->submitted, read->completed);
+            reader->recycle(std::move(read->buf));
+            read.reset();
+        }
+        if (reader) reader->recycle(std::move(buf));
+        else std::string().swap(buf);
+        off = len = 0;
+    }
+    void on_stage(Stage s, std::chrono::steady_clock::time_point begin, std::chrono::steady_clock::time_point end) {
+        if (traced) spans.push_back(TraceSpan{stage_name(s), trace_us(begin), trace_us(end) - trace_us(begin)});
+    }
+};
+
+std::string make_result_payload(const Task& t, const std::vector<float>& emb, ResultFormat fmt, const ProductQuantizer* pq) {
+    StageTimer timer(Stage::Serialize);
+    if (fmt == ResultFormat::BinF32) return encode_result_frame(t.label, t.path, t.id, emb, ElemType::F32);
+    if (fmt == ResultFormat::BinF16) return encode_result_frame(t.label, t.path, t.id, emb, ElemType::F16);
+    if (fmt == ResultFormat::BinI8) return encode_result_frame(t.label, t.path, t.id, emb, ElemType::I8);
+    if (fmt == ResultFormat::BinPQ) return encode_result_frame(t.label, t.path, t.id, emb, ElemType::PQ, pq);
+    return encode_text_result(t.label, t.path, t.id, emb);
+}
+
+std::string offered_formats(ResultFormat preferred, bool pq) {
+    std::string s;
+    if (preferred != ResultFormat::BinPQ || pq) s = result_format_name(preferred);
+    for (auto f : {ResultFormat::BinF32, ResultFormat::BinF16, ResultFormat::BinI8, ResultFormat::BinPQ, ResultFormat::Text}) {
+        if (f == preferred || (f == ResultFormat::BinPQ && !pq)) continue;
+        if (!s.empty()) s += ",";
+        s += result_format_name(f);
+    }
+    return s;
+}
+
+void read_task_file(Task& task) {
+    StageTimer timer(Stage::FileRead);
+    std::ifstream f(task.path, std::ios::binary);
+    if (!f.good()) return;
+    f.seekg(0, std::ios::end);
+    std::streampos szpos = f.tellg();
+    size_t sz = szpos > 0 ? static_cast<size_t>(szpos) : 0;
+    f.seekg(0, std::ios::beg);
+    task.buf.resize(sz);
+    if (sz > 0) f.read(&task.buf[0], static_cast<std::streamsize>(sz));
+    task.off = 0; task.len = sz;
+}
+}
+
+void start_net_worker_group(const NetWorkerOptions& opts, bool prefer_cuda, int connections) {
+    if (connections <= 0) return;
+    PipelineOptions popts;
+    popts.decode_threads = opts.decode_threads;
+    popts.batch = opts.batch;
+    std::shared_ptr<ProductQuantizer> pq;
+    if (!opts.pq_codebook.empty()) {
+        pq = std::make_shared<ProductQuantizer>();
+        if (!pq->load(opts.pq_codebook)) { std::cerr << "cannot load PQ codebook " << opts.pq_codebook << "; pq results disabled" << std::endl; pq.reset(); }
+    }
+    auto pipeline = std::make_shared<InferencePipeline<Task>>(popts, [pq](std::vector<Task>& tasks, std::vector<std::optional<InferenceResult>>& res){
+        for (size_t k=0; k<tasks.size(); ++k) {
+            auto& t = tasks[k];
+            auto& conn = *t.conn;
+            if (!res[k]) {
+                // Frees the master's window slot now instead of at lease expiry; it retries elsewhere.
+                std::lock_guard<std::mutex> lk(conn.send_mtx);
+                conn.client.send("type=failed\nid=" + t.id + "\n");
+                continue;
+            }
+            auto t0 = std::chrono::steady_clock::now();
+            auto payload = make_result_payload(t, res[k]->embedding, static_cast<ResultFormat>(conn.format.load()), pq.get());
+            std::lock_guard<std::mutex> lk(conn.send_mtx);
+            auto t1 = std::chrono::steady_clock::now();
+            conn.client.send(payload);
+            if (!t.traced) continue;
+            // Sent right behind the result, so the master already has its receive time for the
+            // clock-offset estimate; send_mtx covers the lock wait as part of net_send.
+            t.on_stage(Stage::Serialize, t0, t1);
+            t.on_stage(Stage::NetSend, t1, std::chrono::steady_clock::now());
+            conn.client.send(encode_trace_message(t.id, t.recv_us, trace_us(t1), t.spans));
+        }
+    });
+    int credits = opts.credits > 0 ? opts.credits : std::max<int>(2, static_cast<int>((opts.batch.max_batch + connections - 1) / connections) + 1);
+    std::string group = opts.name_prefix + (prefer_cuda ? "gpu" : "cpu");
+    // Shared by the group's connections; lives as long as they do, i.e. the process.
+    std::shared_ptr<AsyncFileReader> reader;
+    if (opts.read_ahead.depth > 0) {
+        reader = std::make_shared<AsyncFileReader>(opts.read_ahead);
+        std::cout << "worker " << group << " read-ahead engine=" << reader->engine() << " depth=" << opts.read_ahead.depth << std::endl;
+    }
+    pipeline->add_inference([opts, prefer_cuda, group]() -> std::unique_ptr<IInferenceBackend> {
+#if defined(DIP_HAS_ONNX)
+        std::unique_ptr<IInferenceBackend> backend(new OnnxRuntimeBackend(prefer_cuda ? ProviderPref::CUDA : ProviderPref::CPU, opts.onnx));
+        bool ok = backend->init(opts.model_path);
+        std::cout << "worker " << group << " initialized provider=" << (prefer_cuda && ok?"cuda":"cpu") << " precision=" << model_precision_name(opts.onnx.precision) << " batch=" << opts.batch.min_batch << ".." << opts.batch.max_batch << " decode_threads=" << opts.decode_threads << std::endl;
+        if (!ok && prefer_cuda) { backend.reset(new OnnxRuntimeBackend(ProviderPref::CPU, opts.onnx)); ok = backend->init(opts.model_path); std::cout << "worker " << group << " fallback provider=cpu" << std::endl; }
+        if (!ok) return nullptr;
+        return backend;
+#else
+        std::cerr << "ERROR: Built without ONNX Runtime. Reconfigure with USE_ONNXRUNTIME=ON." << std::endl;
+        return nullptr;
+#endif
+    });
+    // Lives as long as the detached connection threads, i.e. the process.
+    add_metrics_collector([pipeline, group, reader](std::vector<MetricSample>& out){
+        auto d = pipeline->depths();
+        std::string l = "group=\"" + group + "\"";
+        out.push_back({"dip_pipeline_decode_queue", l, double(d.decode_queue)});
+        out.push_back({"dip_pipeline_decoding", l, double(d.decoding)});
+        out.push_back({"dip_pipeline_infer_queue", l, double(d.infer_queue)});
+        out.push_back({"dip_pipeline_inferring", l, double(d.inferring)});
+        if (!reader) return;
+        // read - exposed is the file-read time hidden behind decode and inference.
+        auto r = reader->stats();
+        out.push_back({"dip_read_ahead_reads_total", l, double(r.reads)});
+        out.push_back({"dip_read_ahead_read_seconds_total", l, double(r.read_ns) * 1e-9});
+        out.push_back({"dip_read_ahead_exposed_seconds_total", l, double(r.wait_ns) * 1e-9});
+    });
+    if (opts.stats_interval_s > 0) {
+        std::thread([pipeline, group, reader, interval = opts.stats_interval_s]{
+            while (true) {
+                std::this_thread::sleep_for(std::chrono::seconds(interval));
+                auto d = pipeline->depths();
+                std::cout << "worker " << group << " queues decode=" << d.decode_queue << "+" << d.decoding << " infer=" << d.infer_queue << "+" << d.inferring;
+                if (reader) {
+                    auto r = reader->stats();
+                    double read_ms = double(r.read_ns) * 1e-6, exposed_ms = double(r.wait_ns) * 1e-6;
+                    std::cout << " read_ahead reads=" << r.reads << " read=" << std::llround(read_ms) << "ms exposed=" << std::llround(exposed_ms) << "ms hidden="
+                              << (read_ms > 0 ? std::llround(100.0 * std::max(0.0, read_ms - exposed_ms) / read_ms) : 0) << "%";
+                }
+                std::cout << std::endl;
+            }
+        }).detach();
+    }
+    for (int idx=0; idx<connections; ++idx) {
+        std::thread([opts, prefer_cuda, idx, pipeline, credits, pq, reader]{
+            auto conn = std::make_shared<Conn>();
+            if (!conn->client.connect(opts.host, opts.port)) return;
+            std::string wid = opts.name_prefix + (prefer_cuda?"gpu-":"cpu-") + std::to_string(idx);
+            std::string hello = std::string("type=hello\nworker_id=") + wid + "\nprovider=" + (prefer_cuda?"cuda":"cpu")
+                + "\nresult_formats=" + offered_formats(opts.result_format, pq != nullptr) + "\ncredits=" + std::to_string(credits) + "\ntask_modes=data,path,rgb8\ntrace=1\n";
+            if (pq) {
+                char fp[17];
+                auto r = std::to_chars(fp, fp + sizeof(fp), pq->fingerprint(), 16);
+                hello += "pq_codebook=" + std::string(fp, r.ptr) + "\n";
+            }
+            {
+                std::lock_guard<std::mutex> lk(conn->send_mtx);
+                conn->client.send(hello);
+            }
+            while (true) {
+                std::string msg = reader ? reader->buffer() : std::string();
+                if (!conn->client.read(msg)) break;
+                int64_t recv_us = trace_now_us();
+                if (is_binary_frame(msg)) {
+                    FrameView v;
+                    if (!parse_frame(msg, v) || v.type != MsgType::Task || (v.elem != ElemType::U8 && v.elem != ElemType::RGB8)) continue;
+                    Task task{conn, std::string(v.label), std::string(v.path), std::string(v.id), {}, 0, v.dim, (v.flags & kFrameTraced) != 0, recv_us, {}, nullptr, reader.get()};
+                    task.off = static_cast<size_t>(reinterpret_cast<const char*>(v.data) - msg.data());
+                    task.rgb8 = v.elem == ElemType::RGB8;
+                    task.buf = std::move(msg);
+                    pipeline->push(std::move(task));
+                    continue;
+                }
+                auto type = get_text_field(msg, "type");
+                if (type == "welcome") {
+                    ResultFormat f;
+                    if (parse_result_format(get_text_field(msg, "result_format"), f)) conn->format = static_cast<int>(f);
+                } else if (type == "task") {
+                    Task task{conn, std::string(get_text_field(msg, "label")), std::string(get_text_field(msg, "path")), std::string(get_text_field(msg, "id")), {}, 0, 0, get_text_field(msg, "trace") == "1", recv_us, {}, nullptr, reader.get()};
+                    if (reader) {
+                        task.read = reader->read(task.path);
+                        reader->recycle(std::move(msg));
+                    } else {
+                        auto t0 = std::chrono::steady_clock::now();
+                        read_task_file(task);
+                        task.on_stage(Stage::FileRead, t0, std::chrono::steady_clock::now());
+                    }
+                    pipeline->push(std::move(task));
+                }
+            }
+        }).detach();
+    }
+}
+}